@@ -21,6 +21,7 @@
 #pragma once
 
 #include <map>
+#include <vector>
 
 #include <boost/optional/optional_fwd.hpp>
 
@@ -106,16 +107,31 @@ public:
     auto
     engine() -> execution_unit_t& = 0;
 
+    /// Shared pool of worker threads to offload blocking slots to, so that they don't stall the
+    /// I/O threads. See dispatch::offload().
+    virtual
+    auto
+    workers() -> api::executor_t& = 0;
+
+    /// Returns all the execution units, e.g. to spread some work across every one of them.
+    virtual
+    auto
+    engines() -> std::vector<execution_unit_t*> = 0;
+
     /// Binds a new socket on the specified endpoint and starts listening for new connections.
     template<typename Protocol>
     auto
     expose(typename Protocol::endpoint endpoint) -> std::unique_ptr<typename Protocol::acceptor> {
-        return std::make_unique<typename Protocol::acceptor>(
-            acceptor_loop(),
-            std::move(endpoint)
-        );
+        return expose<Protocol>(acceptor_loop(), std::move(endpoint), false);
     }
 
+    /// Same as above, but the socket is handled by the specified event loop. Shared sockets are
+    /// bound with SO_REUSEPORT, so that multiple shared sockets can listen on the same endpoint.
+    template<typename Protocol>
+    auto
+    expose(asio::io_service& loop, typename Protocol::endpoint endpoint, bool shared)
+        -> std::unique_ptr<typename Protocol::acceptor>;
+
 private:
     virtual
     auto
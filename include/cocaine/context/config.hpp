@@ -70,6 +70,26 @@ public:
             shared() const = 0;
         };
 
+        // Sets of CPUs to pin the I/O threads to, in the Linux CPU list format like "0-3,8".
+        struct affinity_t {
+            typedef std::vector<unsigned int> cpuset_t;
+
+            virtual
+            ~affinity_t() {}
+
+            // CPU sets for the execution units, assigned to them in a round-robin manner. Empty if
+            // execution units are not pinned.
+            virtual
+            const std::vector<cpuset_t>&
+            units() const = 0;
+
+            // CPU set for the acceptor thread and the threads running the services, including
+            // storage I/O. Empty if they're not pinned.
+            virtual
+            const cpuset_t&
+            acceptor() const = 0;
+        };
+
         virtual
         ~network_t() {}
 
@@ -77,6 +97,10 @@ public:
         const ports_t&
         ports() const = 0;
 
+        virtual
+        const affinity_t&
+        affinity() const = 0;
+
         // An endpoint where all the services will be bound. Note that binding on [::] will bind on
         // 0.0.0.0 too as long as the "net.ipv6.bindv6only" sysctl is set to 0 (default).
         virtual
@@ -93,6 +117,105 @@ public:
         virtual
         size_t
         pool() const = 0;
+
+        // Whether idle sessions should give their read buffers back to the execution unit's pool
+        // and borrow them again only when there's some data to read.
+        virtual
+        bool
+        lazy_buffers() const = 0;
+
+        // The maximum number of idle read buffers retained in every execution unit's pool.
+        virtual
+        size_t
+        buffer_pool() const = 0;
+
+        // How sessions do their socket I/O: either "epoll", via the execution unit's reactor, or
+        // "uring", via the execution unit's io_uring instance. The latter falls back to the former if
+        // the running kernel has no io_uring with multishot receives, i.e. older than 6.0.
+        virtual
+        const std::string&
+        backend() const = 0;
+
+        // The maximum number of already received messages a session handles in one go before
+        // yielding to the other sessions of the same execution unit.
+        virtual
+        size_t
+        read_budget() const = 0;
+
+        // Sessions stop reading new messages once more than the high watermark bytes are queued for
+        // writing and resume once the queue drains down to the low watermark. Zero high watermark
+        // disables the limit.
+        virtual
+        size_t
+        high_watermark() const = 0;
+
+        virtual
+        size_t
+        low_watermark() const = 0;
+
+        // Flow control window in bytes granted to the peers for every channel, which is replenished
+        // as the messages are handled. Zero means that the peers are not limited.
+        virtual
+        size_t
+        initial_window() const = 0;
+
+        // Time in seconds given to the sessions to finish their active channels on shutdown, after
+        // they have asked their peers not to open new ones.
+        virtual
+        size_t
+        drain_timeout() const = 0;
+
+        // Interval in seconds between keepalive pings sent to every client, zero disables them. Note
+        // that clients have to reply to pings on the channel zero, so it's disabled by default.
+        virtual
+        size_t
+        ping_interval() const = 0;
+
+        // The number of unanswered pings after which the client is considered dead.
+        virtual
+        size_t
+        ping_misses() const = 0;
+
+        // Only one in this many invocations is timed, so that per-slot timers don't cost too much
+        // under heavy load. Load and request counters are always exact.
+        virtual
+        size_t
+        timer_sampling() const = 0;
+
+        // Whether every execution unit should accept connections to TCP services on its own, with
+        // its own listening socket bound with SO_REUSEPORT, instead of sharing a single acceptor
+        // thread. The kernel then spreads incoming connections across the execution units.
+        virtual
+        bool
+        reuse_port() const = 0;
+
+        // Maximum length of the queue of pending connections of every listening socket.
+        virtual
+        size_t
+        backlog() const = 0;
+
+        // How new connections are spread across the execution units: either "two-choices", which
+        // picks the less loaded of two random units judging by their live load, or "utilization",
+        // which picks the unit with the lowest CPU utilization over the last minute.
+        virtual
+        const std::string&
+        balancer() const = 0;
+
+        // Size of the worker pool blocking slots can be offloaded to, and the maximum number of
+        // invocations queued there. Invocations over the limit are rejected.
+        virtual
+        size_t
+        workers() const = 0;
+
+        virtual
+        size_t
+        worker_queue() const = 0;
+
+        // Number of threads shared by the services which don't have their own dedicated threads,
+        // see component_t::dedicated(). Services never run on the acceptor thread.
+        virtual
+        size_t
+        service_pool() const = 0;
     };
 
     struct logging_t {
@@ -119,6 +242,12 @@ public:
         virtual
         const dynamic_t&
         args() const = 0;
+
+        // Whether the service gets its own thread instead of sharing the service pool. Doesn't mean
+        // anything for other components.
+        virtual
+        bool
+        dedicated() const = 0;
     };
 
     // Component group such as storages, services or unicorns
@@ -34,6 +34,8 @@
 
 #include "cocaine/locked_ptr.hpp"
 
+#include <boost/optional/optional.hpp>
+
 namespace cocaine { namespace service {
 
 class locator_t;
@@ -79,8 +81,45 @@ class locator_t:
 
     typedef std::map<std::string, uplink_t> client_map_t;
 
-    typedef std::map<std::string, streamed<results::connect>> remote_map_t;
-    typedef std::map<std::string, streamed<results::routing>> router_map_t;
+    // Outgoing stream, which holds updates back while the peer's flow control window has no room for
+    // them, coalescing them into a single update which is sent once the window is replenished.
+    template<class T>
+    class outgoing_t
+    {
+        struct state_t {
+            streamed<T> stream;
+            synchronized<boost::optional<T>> pending;
+        };
+
+        std::shared_ptr<state_t> state;
+
+    public:
+        outgoing_t():
+            state(std::make_shared<state_t>())
+        { }
+
+        auto
+        stream() const -> streamed<T> {
+            return state->stream;
+        }
+
+        // Returns errors other than the exhausted window, in which case the update is dropped.
+        auto
+        write(T update) -> std::error_code;
+
+        void
+        close() {
+            state->stream.close();
+        }
+
+    private:
+        static
+        void
+        flush(const std::weak_ptr<state_t>& weak);
+    };
+
+    typedef std::map<std::string, outgoing_t<results::connect>> remote_map_t;
+    typedef std::map<std::string, outgoing_t<results::routing>> router_map_t;
 
     context_t& m_context;
 
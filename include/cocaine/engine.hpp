@@ -25,6 +25,9 @@
 
 #include <asio/deadline_timer.hpp>
 
+#include <atomic>
+#include <vector>
+
 namespace cocaine {
 
 class session_t;
@@ -36,6 +39,8 @@ class execution_unit_t {
     COCAINE_DECLARE_NONCOPYABLE(execution_unit_t)
 
     class gc_action_t;
+    class publish_action_t;
+    class probe_action_t;
 
     // Connections
 
@@ -50,16 +55,59 @@ class execution_unit_t {
     const std::unique_ptr<logging::logger_t> m_log;
     metrics::registry_t& m_metrics;
 
+    // The maximum number of buffered messages handled per session wakeup.
+    const size_t m_read_budget;
+
+    // Session write queue watermarks.
+    const size_t m_high_watermark;
+    const size_t m_low_watermark;
+
+    // Flow control window granted to the peers for every channel.
+    const size_t m_initial_window;
+
+    // Time given to sessions to finish their active channels when they are shut down.
+    const boost::posix_time::time_duration m_drain_timeout;
+
+    // Keepalive ping interval, zero if pings are disabled, and the number of pings clients might
+    // leave unanswered before being detached.
+    const boost::posix_time::time_duration m_ping_interval;
+    const size_t m_ping_misses;
+
+    // Only one in this many invocations is timed.
+    const size_t m_timer_sampling;
+
     static const unsigned int kCollectionInterval = 60;
 
     // Collects detached sessions every kCollectionInterval seconds. Normally, session slots will be
     // reused because of system fd rotation, but for low loads this will help a bit.
     std::unique_ptr<asio::deadline_timer> m_cron;
 
+    static const unsigned int kPublishInterval = 1;
+
+    // Publishes session metrics every kPublishInterval seconds, see session_t::publish_metrics().
+    std::unique_ptr<asio::deadline_timer> m_publisher;
+
+    // Live load signals, see pressure(). Connections which are attached, but not yet registered on
+    // the reactor, are accounted right away, everything else is refreshed by the probe.
+    std::atomic<std::int64_t> m_pending;
+    std::atomic<std::int64_t> m_active;
+    std::atomic<std::int64_t> m_channels;
+
+    // Event loop lag in microseconds, i.e. how late the probe timer fires.
+    std::atomic<std::int64_t> m_lag;
+
+    static const unsigned int kProbeInterval = 100;
+
+    // Refreshes the load signals every kProbeInterval milliseconds.
+    std::unique_ptr<asio::deadline_timer> m_probe;
+
 public:
     explicit
     execution_unit_t(context_t& context);
 
+    // The unit's thread is pinned to the given CPUs, unless there are none.
+    execution_unit_t(context_t& context, const std::vector<unsigned int>& cpus);
+
    ~execution_unit_t();
 
     template<class Socket>
@@ -68,6 +116,20 @@ public:
 
     double
     utilization() const;
+
+    // Unlike utilization(), which is averaged over the last minute, this one reacts immediately to
+    // new connections. It's the number of connections, plus the number of their active channels,
+    // plus the event loop lag, where every millisecond of lag weighs as much as a connection.
+    double
+    pressure() const;
+
+    // The unit's event loop. Sockets created on it can be attached without being cloned.
+    auto
+    reactor() -> asio::io_service&;
+
+    // Gracefully shuts down all the sessions of the given service, see session_t::drain().
+    void
+    drain(const std::string& service);
 };
 
 } // namespace cocaine
@@ -37,7 +37,8 @@ enum transport_errors {
 };
 
 enum protocol_errors {
-    closed_upstream = 1
+    closed_upstream = 1,
+    window_exhausted
 };
 
 enum dispatch_errors {
@@ -47,7 +48,9 @@ enum dispatch_errors {
     revoked_channel,
     slot_not_found,
     unbound_dispatch,
-    uncaught_error
+    uncaught_error,
+    session_draining,
+    workers_overloaded
 };
 
 enum repository_errors {
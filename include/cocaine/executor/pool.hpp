@@ -0,0 +1,70 @@
+#pragma once
+
+#include "cocaine/api/executor.hpp"
+#include "cocaine/forwards.hpp"
+#include "cocaine/locked_ptr.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+namespace cocaine {
+namespace executor {
+
+// Runs callbacks provided to spawn on a fixed number of worker threads. Every worker has its own
+// queue, callbacks are distributed between them in a round-robin manner, and idle workers steal
+// callbacks from the others. The total number of queued callbacks is bounded, spawning one more
+// throws instead of queueing it indefinitely.
+//
+// Publishes the number of queued callbacks, the number of rejected ones and the time callbacks spend
+// in the queue as "<name>.queue.depth", "<name>.queue.rejected" and "<name>.queue.wait".
+class worker_pool_t: public api::executor_t {
+public:
+    worker_pool_t(std::size_t threads, std::size_t capacity, metrics::registry_t& metrics_hub,
+                  const std::string& name);
+
+    // Runs all the queued callbacks before returning.
+    ~worker_pool_t();
+
+    // Throws std::system_error with error::workers_overloaded if the queue is full.
+    auto
+    spawn(work_t work) -> void override;
+
+    auto
+    depth() const -> std::size_t;
+
+private:
+    struct task_t;
+    struct metrics_t;
+
+    typedef synchronized<std::deque<task_t>> queue_type;
+
+    auto
+    take(std::size_t index, task_t& task) -> bool;
+
+    auto
+    run(std::size_t index) -> void;
+
+private:
+    const std::size_t capacity;
+
+    std::unique_ptr<metrics_t> metrics;
+
+    std::vector<std::unique_ptr<queue_type>> queues;
+    std::atomic<std::size_t> next;
+
+    // Idle workers sleep here until there are some callbacks queued.
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopped;
+
+    boost::thread_group threads;
+};
+
+} // namespace executor
+} // namespace cocaine
@@ -88,6 +88,7 @@ typedef unsigned short port_t;
 namespace cocaine { namespace api {
 
 class authentication_t;
+class executor_t;
 class repository_t;
 class unicorn_t;
 class unicorn_scope_t;
@@ -21,6 +21,8 @@
 #pragma once
 
 #include <array>
+#include <cstring>
+#include <cstdint>
 #include <deque>
 #include <functional>
 #include <string>
@@ -35,6 +37,7 @@ namespace cocaine { namespace hpack {
 
 struct init_header_t;
 class header_t;
+class header_view_t;
 
 namespace header {
 
@@ -65,16 +68,25 @@ pack(const char* source, size_t size) {
 
 template<class To>
 To
-unpack(const std::string& from) {
+unpack(const char* data, size_t size) {
     static_assert(std::is_pod<typename std::remove_reference<To>::type>::value &&
                   !std::is_pointer<typename std::remove_reference<To>::type>::value &&
                   !std::is_array<typename std::remove_reference<To>::type>::value,
                   "only POD non pointer, non array data type is allowed to convert header data"
     );
-    if(from.size() != sizeof(typename std::remove_reference<To>::type)) {
+    if(size != sizeof(typename std::remove_reference<To>::type)) {
         throw std::system_error(std::make_error_code(std::errc::invalid_argument), "invalid header data size");
     }
-    return *(reinterpret_cast<const To*>(from.c_str()));
+    typename std::remove_cv<typename std::remove_reference<To>::type>::type result;
+    // NOTE: Header views point right into the received frame, which is not aligned in any way.
+    std::memcpy(&result, data, size);
+    return result;
+}
+
+template<class To>
+To
+unpack(const std::string& from) {
+    return unpack<To>(from.data(), from.size());
 }
 
 boost::optional<const header_t&>
@@ -95,6 +107,24 @@ find_first(const std::vector<header_t>& headers) {
     return find_first(headers, Header::name());
 }
 
+boost::optional<const header_view_t&>
+find_first(const std::vector<header_view_t>& headers, const std::string& name);
+
+boost::optional<const header_view_t&>
+find_first(const std::vector<header_view_t>& headers, const char* name, size_t sz);
+
+template<size_t N>
+boost::optional<const header_view_t&>
+find_first(const std::vector<header_view_t>& headers, char const (&name)[N]) {
+    return find_first(headers, name, N - 1);
+}
+
+template<class Header>
+boost::optional<const header_view_t&>
+find_first(const std::vector<header_view_t>& headers) {
+    return find_first(headers, Header::name());
+}
+
 template <class To, class From>
 boost::optional<To>
 convert_first(const std::vector<header_t>& headers, From&& from) {
@@ -156,6 +186,42 @@ private:
 typedef std::vector<header_t> header_storage_t;
 using headers_t = std::vector<header_t>;
 
+// Non-owning header, referencing the data it was decoded from, e.g. the received frame or the
+// static table. It's valid only as long as the referenced data is.
+class header_view_t {
+public:
+    struct slice_t {
+        const char* data;
+        size_t size;
+    };
+
+    header_view_t(const char* name, size_t name_size, const char* value, size_t value_size);
+
+    explicit
+    header_view_t(const header_t& header);
+
+    const slice_t&
+    name() const;
+
+    const slice_t&
+    value() const;
+
+    bool
+    name_equal(const char* name, size_t size) const;
+
+    // Makes an owned copy of the header.
+    header_t
+    materialize() const;
+
+private:
+    struct {
+        slice_t name;
+        slice_t value;
+    } data;
+};
+
+typedef std::vector<header_view_t> header_views_t;
+
 // Header static and dynamic table as described in http2
 // See https://tools.ietf.org/html/draft-ietf-httpbis-header-compression-12#section-2.3
 class header_table_t {
@@ -168,17 +234,11 @@ public:
     void
     push(header_t header);
 
-    inline
     size_t
-    find_by_full_match(const header_t& header) {
-        return find(std::bind(&header_t::operator==, &header, std::placeholders::_1));
-    }
+    find_by_full_match(const header_t& header) const;
 
-    inline
     size_t
-    find_by_name(const header_t& header) {
-        return find(std::bind(&header_t::name_equal, &header, std::placeholders::_1));
-    }
+    find_by_name(const header_t& header) const;
 
     size_t
     data_size() const;
@@ -197,15 +257,40 @@ public:
     // 32 bytes overhead per record and 2 bytes for nil-nil header.
     static constexpr size_t max_header_capacity = max_data_capacity / (http2_header_overhead + 2);
 
+    // Number of hash buckets for each of the lookup indexes. Must be a power of two.
+    static constexpr size_t bucket_count = 64;
+
 private:
     void
     pop();
 
-    size_t
-    find(const std::function<bool(const header_t&)> comp);
+    void
+    grow();
+
+    struct entry_t {
+        header_t header;
+
+        // Links to the previous (older) entries in the same full match and name buckets. Links are
+        // sequence numbers plus one, so that zero means there's nothing there.
+        uint64_t next_full;
+        uint64_t next_name;
+    };
+
+    // Dynamic table entries in a ring buffer, addressed by their insertion sequence numbers. Grows
+    // on demand by powers of two, since most tables hold just a few entries.
+    std::vector<entry_t> ring;
+
+    // Sequence numbers of the next inserted entry and of the oldest live entry.
+    uint64_t head;
+    uint64_t tail;
+
+    // Hash indexes, linking to the newest entry in every bucket. Links to the evicted entries are
+    // never cleared, instead chains are cut at the oldest live entry.
+    std::array<uint64_t, bucket_count> full_buckets;
+    std::array<uint64_t, bucket_count> name_buckets;
 
-    // Header storage. Implemented as a circular buffer.
-    std::deque<header_t> headers;
+    // Total http2 size of the dynamic entries.
+    size_t occupied;
     size_t capacity;
 };
 
@@ -37,9 +37,6 @@ struct msgpack_traits {
     void
     pack(msgpack::packer<Stream>& packer) {
         pack_uncompressed(packer, header_t::create<Header>());
-        /// Note: this code is commented for a migration process to 'vanilla' hpack
-        //static_assert(boost::mpl::contains<header_static_table_t::headers_storage, Header>::type::value, "Header is not present in static table");
-        //packer.pack_fix_uint64(header_static_table_t::idx<Header>());
     }
 
     // Pack a header from static table but with different value
@@ -48,20 +45,6 @@ struct msgpack_traits {
     void
     pack(msgpack::packer<Stream>& packer, header_table_t& /*table*/, std::string header_data) {
         pack_uncompressed(packer, header_t::create<Header>(header_data));
-        /// Note: this code is commented for a migration process to 'vanilla' hpack
-        //size_t pos = header_static_table_t::idx<Header>();
-        //if(table[pos].value() == header_data) {
-        //    packer.pack_fix_uint64(pos);
-        //    return;
-        //}
-        //packer.pack_array(3);
-        //header_t header(Header::name(), std::move(header_data));
-        //// true flag means store header in dynamic_table on receiver side
-        //packer.pack_true();
-        //packer.pack_fix_uint64(pos);
-        //packer.pack_raw(header.value().size());
-        //packer.pack_raw_body(header.value().c_str(), header.value().size());
-        //table.push(std::move(header));
     }
 
     // Pack any other header
@@ -70,25 +53,69 @@ struct msgpack_traits {
     void
     pack(msgpack::packer<Stream>& packer, header_table_t& /*table*/, const header_t& source) {
         pack_uncompressed(packer, source);
-        /// Note: this code is commented for a migration process to 'vanilla' hpack
-        //size_t pos = table.find_by_full_match(source);
-        //if(pos) {
-        //    packer.pack_fix_uint64(pos);
-        //    return;
-        //}
-        //packer.pack_array(3);
-        //pos = table.find_by_name(source);
-        //// true flag means store header in dynamic_table on receiver side
-        //packer.pack_true();
-        //table.push(source);
-        //if(pos) {
-        //    packer.pack_fix_uint64(pos);
-        //} else {
-        //    packer.pack_raw(source.name().size());
-        //    packer.pack_raw_body(source.name().c_str(), source.name().size());
-        //}
-        //packer.pack_raw(source.value().size());
-        //packer.pack_raw_body(source.value().c_str(), source.value().size());
+    }
+
+    // Pack a header either as a reference to the table, if it's already there, or as a literal which
+    // is then stored in the dynamic table on both sides. Must only be used if the receiver is known
+    // to maintain the dynamic table.
+    template<class Stream>
+    static
+    void
+    pack_compressed(msgpack::packer<Stream>& packer, header_table_t& table, const header_t& source) {
+        if(const size_t pos = table.find_by_full_match(source)) {
+            packer.pack(static_cast<uint64_t>(pos));
+            return;
+        }
+
+        // NOTE: The name must be looked up before the header is pushed, which shifts the indices.
+        const size_t pos = table.find_by_name(source);
+
+        packer.pack_array(3);
+        // True flag means store header in dynamic_table on receiver side
+        packer.pack_true();
+
+        if(pos) {
+            packer.pack(static_cast<uint64_t>(pos));
+        } else {
+            packer.pack_raw(source.name().size());
+            packer.pack_raw_body(source.name().c_str(), source.name().size());
+        }
+
+        packer.pack_raw(source.value().size());
+        packer.pack_raw_body(source.value().c_str(), source.value().size());
+
+        table.push(source);
+    }
+
+    // Pack a header as a literal which is not stored in the dynamic table, referencing only its name
+    // if it's in the table. Meant for headers with values unique for every message, which would just
+    // evict the entries which are actually reused.
+    template<class Stream>
+    static
+    void
+    pack_unindexed(msgpack::packer<Stream>& packer, header_table_t& table, const header_t& source) {
+        const size_t pos = table.find_by_name(source);
+
+        packer.pack_array(3);
+        packer.pack_false();
+
+        if(pos) {
+            packer.pack(static_cast<uint64_t>(pos));
+        } else {
+            packer.pack_raw(source.name().size());
+            packer.pack_raw_body(source.name().c_str(), source.name().size());
+        }
+
+        packer.pack_raw(source.value().size());
+        packer.pack_raw_body(source.value().c_str(), source.value().size());
+    }
+
+    // Size of the header packed uncompressed.
+    static inline
+    size_t
+    uncompressed_size(const header_t& source) {
+        // Array tag and the flag, followed by two raw strings with their tags.
+        return 2 + raw_size(source.name().size()) + raw_size(source.value().size());
     }
 
     template<class Stream>
@@ -104,6 +131,12 @@ struct msgpack_traits {
         packer.pack_raw_body(source.value().c_str(), source.value().size());
     }
 
+    static inline
+    size_t
+    raw_size(size_t size) {
+        return size + (size < 32 ? 1 : size < 65536 ? 3 : 5);
+    }
+
     static inline
     header_t
     unpack(const msgpack::object& source, header_table_t& table) {
@@ -136,39 +169,110 @@ struct msgpack_traits {
         return result;
     }
 
+    // Unpack a header without copying its data where possible. Literals reference the frame and
+    // static entries reference the static table, but dynamic entries might be evicted by the headers
+    // that follow, so they are copied to the given storage, which must not be reallocated meanwhile.
+    static inline
+    header_view_t
+    unpack_view(const msgpack::object& source, header_table_t& table, header_storage_t& pinned) {
+        if(source.type == msgpack::type::POSITIVE_INTEGER) {
+            if(source.via.u64 >= table.size() || source.via.u64 == 0) {
+                throw cocaine::error_t("invalid index for header table: {}", source.via.u64);
+            }
+            if(source.via.u64 >= header_static_table_t::get_size()) {
+                pinned.push_back(table[source.via.u64]);
+                return header_view_t(pinned.back());
+            }
+            return header_view_t(table[source.via.u64]);
+        }
+
+        const msgpack::object& name = source.via.array.ptr[1];
+        const msgpack::object& value = source.via.array.ptr[2];
+
+        header_view_t::slice_t header_name;
+        if(name.type == msgpack::type::POSITIVE_INTEGER) {
+            const header_t& entry = table[name.via.u64];
+
+            if(name.via.u64 >= header_static_table_t::get_size()) {
+                pinned.emplace_back(entry.name(), std::string());
+                header_name = {pinned.back().name().data(), pinned.back().name().size()};
+            } else {
+                header_name = {entry.name().data(), entry.name().size()};
+            }
+        } else {
+            header_name = {name.via.raw.ptr, name.via.raw.size};
+        }
+
+        header_view_t result(header_name.data, header_name.size, value.via.raw.ptr, value.via.raw.size);
+
+        if(source.via.array.ptr[0].via.boolean) {
+            table.push(result.materialize());
+        }
+
+        return result;
+    }
+
     static inline
     bool
     unpack_vector(const msgpack::object& source, header_table_t& table, std::vector<header_t>& target) {
         target.reserve(source.via.array.size);
         for (size_t i = 0; i < source.via.array.size; i++) {
-            msgpack::object& obj = source.via.array.ptr[i];
-            if(obj.type == msgpack::type::POSITIVE_INTEGER || (
-                   obj.type == msgpack::type::ARRAY &&
-                   obj.via.array.size == 3 &&
-                   //Either to add header to dynamic table or not
-                   obj.via.array.ptr[0].type == msgpack::type::BOOLEAN && (
-                        //Either reference to table or raw data
-                        obj.via.array.ptr[1].type == msgpack::type::POSITIVE_INTEGER ||
-                        obj.via.array.ptr[1].type == msgpack::type::RAW
-                   ) && (
-                        //Raw data.
-                        obj.via.array.ptr[2].type == msgpack::type::RAW
-                   )
-               )
-            ) {
-                try {
-                    target.push_back(unpack(obj, table));
-                } catch (...) {
-                    // TODO: Return `std::error_code` instead of boolean.
-                    // Just swallow it. We can not do anything here.
-                    return false;
-                }
-            } else {
+            const msgpack::object& obj = source.via.array.ptr[i];
+            if(!is_valid(obj)) {
+                return false;
+            }
+            try {
+                target.push_back(unpack(obj, table));
+            } catch (...) {
+                // TODO: Return `std::error_code` instead of boolean.
+                // Just swallow it. We can not do anything here.
                 return false;
             }
         }
         return true;
     }
+
+    // Same as above, but unpacks header views. Both target containers are expected to be empty.
+    static inline
+    bool
+    unpack_views(const msgpack::object& source, header_table_t& table, header_views_t& target,
+                 header_storage_t& pinned)
+    {
+        target.reserve(source.via.array.size);
+        // NOTE: Views point into the pinned storage, so it must never be reallocated while unpacking.
+        pinned.reserve(source.via.array.size);
+        for (size_t i = 0; i < source.via.array.size; i++) {
+            const msgpack::object& obj = source.via.array.ptr[i];
+            if(!is_valid(obj)) {
+                return false;
+            }
+            try {
+                target.push_back(unpack_view(obj, table, pinned));
+            } catch (...) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static inline
+    bool
+    is_valid(const msgpack::object& obj) {
+        return obj.type == msgpack::type::POSITIVE_INTEGER || (
+            obj.type == msgpack::type::ARRAY &&
+            obj.via.array.size == 3 &&
+            //Either to add header to dynamic table or not
+            obj.via.array.ptr[0].type == msgpack::type::BOOLEAN && (
+                //Either reference to table or raw data
+                obj.via.array.ptr[1].type == msgpack::type::POSITIVE_INTEGER ||
+                obj.via.array.ptr[1].type == msgpack::type::RAW
+            ) && (
+                //Raw data.
+                obj.via.array.ptr[2].type == msgpack::type::RAW
+            )
+        );
+    }
 };
 
 }} // namespace cocaine::hpack
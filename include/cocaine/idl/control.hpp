@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+#include <map>
+#include <string>
 #include <system_error>
 
 // primitive protocol is always required for responses on control events
@@ -37,13 +40,32 @@ struct revoke {
 /// The settings event conveys configuration parameters that affect how endpoints communicate,
 /// such as preferences and constraints on peer behavior.
 ///
-/// This is also used to acknowledge the receipt of those parameters.
+/// This is also used to acknowledge the receipt of those parameters. The side which establishes
+/// the connection sends its parameters on the channel zero right away, and the other side replies
+/// with its own ones.
+///
+/// Known parameters:
+///   header_table_size - maximum size of the HPACK dynamic table the sender's decoder supports.
+///     When it is at least as large as the receiver's table, the receiver starts to index the
+///     headers it sends. Peers which have never sent it always get uncompressed headers.
+///   initial_window_size - flow control window in bytes the sender grants for every stream the
+///     receiver opens after that, see window_update. Streams are not flow controlled otherwise.
 struct settings {
     typedef control_tag tag;
 
     static const char* alias() {
         return "settings";
     }
+
+    typedef boost::mpl::list<
+        /// Parameters of the sender.
+        std::map<std::string, std::uint64_t>
+    >::type argument_type;
+
+    /// Parameters of the receiver, which also acknowledge the sender's ones.
+    typedef option_of<
+        std::map<std::string, std::uint64_t>
+    >::tag upstream_type;
 };
 
 /// The ping event is a mechanism for measuring a minimal round-trip time from the sender, as well
@@ -73,6 +95,29 @@ struct goaway {
         /// Error reason.
         std::error_code
     >::type argument_type;
+
+    /// Sent on the channel zero, which can only carry replies to pings, so it's never acknowledged.
+    typedef void upstream_type;
+};
+
+/// The window_update event grants the receiver more flow control credit for a stream, in bytes
+/// of encoded chunks it is allowed to send. Only sent by peers which have sent a non-zero
+/// initial_window_size setting before, as they handle the messages received on the stream. Every
+/// received frame is accounted as a whole, so the credit granted back never falls short of the
+/// credit spent.
+struct window_update {
+    typedef control_tag tag;
+
+    static const char* alias() {
+        return "window_update";
+    }
+
+    typedef boost::mpl::list<
+        /// Channel to grant the credit for.
+        std::uint64_t,
+        /// Window size increment.
+        std::uint64_t
+    >::type argument_type;
 };
 
 }; // struct control
@@ -87,7 +132,8 @@ struct protocol<control_tag> {
         control::revoke,
         control::settings,
         control::ping,
-        control::goaway
+        control::goaway,
+        control::window_update
         // TODO: To be added more, incomplete.
     >::type messages;
 
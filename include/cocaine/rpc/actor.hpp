@@ -62,10 +62,11 @@ private:
     // after the authentication process completes successfully. Constant.
     io::dispatch_ptr_t m_prototype;
 
-    // I/O acceptor action. There is a separate thread to accept new connections. After a connection
-    // is accepted, it is assigned to a least busy thread from the main thread pool. Synchronized to
-    // allow concurrent observing and operations.
-    synchronized<std::shared_ptr<accept_action_t>> m_acceptor;
+    // I/O acceptor actions. Normally, there is a separate thread to accept new connections. After
+    // a connection is accepted, it is assigned to a least busy thread from the main thread pool. If
+    // the port is shared, every thread of the main thread pool accepts its connections on its own.
+    // Synchronized to allow concurrent observing and operations.
+    synchronized<std::vector<std::shared_ptr<accept_action_t>>> m_acceptors;
 
 public:
     actor_base(context_t& context, std::unique_ptr<io::basic_dispatch_t> prototype);
@@ -106,6 +107,16 @@ protected:
     auto
     make_endpoint() const -> endpoint_type = 0;
 
+    /// Whether every execution unit should listen on the endpoint with its own socket, see
+    /// config_t::network_t::reuse_port().
+    ///
+    /// Default implementation returns false.
+    virtual
+    auto
+    shared() const -> bool {
+        return false;
+    }
+
     /// Called after been run.
     ///
     /// Default implementation does nothing.
@@ -138,6 +149,9 @@ protected:
     auto
     make_endpoint() const -> endpoint_type override;
 
+    auto
+    shared() const -> bool override;
+
     auto
     on_terminate() -> void override;
 };
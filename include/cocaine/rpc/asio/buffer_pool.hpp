@@ -0,0 +1,88 @@
+/*
+    Copyright (c) 2011-2016 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2016 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COCAINE_IO_BUFFER_POOL_HPP
+#define COCAINE_IO_BUFFER_POOL_HPP
+
+#include "cocaine/common.hpp"
+#include "cocaine/locked_ptr.hpp"
+#include "cocaine/memory.hpp"
+
+#include <asio/io_service.hpp>
+
+#include <atomic>
+#include <vector>
+
+namespace cocaine { namespace io {
+
+// Pool of read buffers shared by all the streams running on the same reactor. Registered as an
+// asio service, so every execution unit gets its own pool without any additional plumbing. When
+// the pool is configured to be lazy, readable streams hold no buffers while their connections are
+// idle, borrowing them from the pool only when there's some data to read.
+
+class buffer_pool_t:
+    public asio::io_service::service
+{
+public:
+    typedef std::vector<char, uninitialized<char>> buffer_type;
+
+    static const size_t kBufferSize = 65536;
+
+    static asio::io_service::id id;
+
+    explicit
+    buffer_pool_t(asio::io_service& asio);
+
+    void
+    configure(bool lazy, size_t capacity);
+
+    // Observers
+
+    bool
+    lazy() const;
+
+    // Total size of all the idle buffers retained in the pool.
+    size_t
+    retained() const;
+
+    // Modifiers
+
+    auto
+    acquire() -> buffer_type;
+
+    // Takes the buffer's memory back, leaving the buffer empty. Buffers which have grown larger
+    // than the default size and buffers which don't fit in the pool are freed.
+    void
+    release(buffer_type& buffer);
+
+private:
+    void
+    shutdown_service();
+
+private:
+    std::atomic<bool> m_lazy;
+    std::atomic<size_t> m_capacity;
+
+    synchronized<std::vector<buffer_type>> m_buffers;
+};
+
+}} // namespace cocaine::io
+
+#endif
@@ -28,6 +28,9 @@
 
 #include <msgpack/object.hpp>
 
+#include <system_error>
+#include <vector>
+
 namespace cocaine { namespace io {
 
 struct decoder_t;
@@ -37,6 +40,8 @@ namespace aux {
 struct decoded_message_t {
     friend struct io::decoder_t;
 
+    decoded_message_t();
+
     auto
     span() const -> uint64_t;
 
@@ -46,6 +51,15 @@ struct decoded_message_t {
     auto
     args() const -> const msgpack::object&;
 
+    // Size of the whole frame, including the headers.
+    auto
+    size() const -> size_t;
+
+    // Headers referencing the decoder buffer, valid until the message is cleared.
+    auto
+    header_views() const -> const hpack::header_views_t&;
+
+    // Owned copies of the headers, which are only made on the first call.
     auto
     headers() const -> const hpack::header_storage_t&;
 
@@ -56,7 +70,48 @@ private:
 
     // These objects keep references to message buffer in the Decoder.
     msgpack::object object;
-    hpack::header_storage_t metadata;
+    hpack::header_views_t views;
+
+    size_t length;
+
+    // Copies of the referenced dynamic table entries, which might be evicted by the next headers.
+    hpack::header_storage_t pinned;
+
+    // NOTE: All the containers are cleared but never shrunk between messages, so that decoding
+    // doesn't allocate in the steady state, unless somebody asks for owned headers.
+    mutable hpack::header_storage_t metadata;
+};
+
+// Resumable MessagePack frame boundary scanner. It walks only the structure of the incoming
+// object, i.e. type tags and length prefixes, without touching raw payloads, and keeps its state
+// between calls, so every byte of a partially received frame is inspected at most once no matter
+// how many pieces the frame arrives in.
+
+struct frame_scanner_t {
+    frame_scanner_t();
+
+    // Continues scanning the frame prefix of the given size. The data pointer must always point to
+    // the beginning of the same frame, but might change between calls, e.g. when the ring buffer
+    // is compactified. Returns the frame size if it's complete or zero otherwise.
+    size_t
+    scan(const char* data, size_t size, std::error_code& ec);
+
+    // The number of frame bytes known to be required so far.
+    auto
+    required() const -> size_t;
+
+    void
+    reset();
+
+private:
+    // Number of frame bytes processed so far.
+    size_t offset;
+
+    // Number of bytes required to complete the next object, if it's known.
+    size_t pending;
+
+    // Stack of object counts left to scan in every nested container.
+    std::vector<size_t> stack;
 };
 
 } // namespace aux
@@ -72,9 +127,17 @@ struct decoder_t {
     size_t
     decode(const char* data, size_t size, message_type& message, std::error_code& ec);
 
+    // Hint for the underlying stream on how many bytes of the current frame are known to be needed
+    // to be able to decode it, so that the buffer can be grown once instead of doubling it.
+    auto
+    required() const -> size_t;
+
 private:
     msgpack::zone zone;
 
+    // Partially received frame state, preserved between decoding attempts.
+    aux::frame_scanner_t scanner;
+
     // HPACK HTTP/2.0 tables.
     hpack::header_table_t hpack_context;
 };
@@ -26,6 +26,8 @@
 #include "cocaine/rpc/protocol.hpp"
 #include "cocaine/traits/tuple.hpp"
 
+#include <array>
+
 namespace cocaine { namespace io {
 
 template<class Event>
@@ -35,55 +37,219 @@ struct encoder_t;
 
 namespace aux {
 
+// Thread-local pool of encoding buffers, segregated into power-of-two size classes starting with
+// the initial encoding buffer size. Buffers are drawn from the pool when messages are encoded and
+// returned back to it once they have been written out, so that most messages don't hit the system
+// allocator at all.
+//
+// NOTE: Buffers are released to the pool of the thread which releases them, not the one they were
+// drawn from. Messages are usually packed on one thread and written out on the reactor's, so the
+// reactor's pool collects the buffers while the packing threads keep missing. This is deliberate:
+// the pools are never locked, every pool retains at most kMaxRetainedSize bytes per size class no
+// matter where the buffers come from, and the idle buffers are freed once the thread exits.
+
+class encoded_buffers_pool_t {
+    COCAINE_DECLARE_NONCOPYABLE(encoded_buffers_pool_t)
+
+public:
+    typedef std::vector<char, uninitialized<char>> buffer_type;
+
+    static const size_t kMinBufferSize = 2048;
+    static const size_t kMaxBufferSize = 65536;
+
+    // Maximum total size of idle buffers retained per size class.
+    static const size_t kMaxRetainedSize = 1048576;
+
+    struct stats_t {
+        // Number of buffers served from the pool and allocated from scratch.
+        std::uint64_t hits;
+        std::uint64_t misses;
+
+        // Total size of all the idle buffers retained in the pool.
+        size_t retained;
+    };
+
+    encoded_buffers_pool_t();
+
+    // Pool of the calling thread.
+    static
+    encoded_buffers_pool_t&
+    current();
+
+    auto
+    stats() const -> stats_t;
+
+    // Returns a buffer at least the specified size.
+    auto
+    acquire(size_t size) -> buffer_type;
+
+    // Takes the buffer's memory back, leaving the buffer empty.
+    void
+    release(buffer_type& buffer);
+
+private:
+    static const size_t kClassCount = 6;
+
+    std::array<std::vector<buffer_type>, kClassCount> m_classes;
+    stats_t m_stats;
+};
+
 struct encoded_buffers_t {
     friend struct encoded_message_t;
 
-    static const size_t kInitialBufferSize = 2048;
+    static const size_t kInitialBufferSize = encoded_buffers_pool_t::kMinBufferSize;
+
+    // Pinned raw bodies at least this large are referenced by the encoded message instead of being
+    // copied into the buffer. Smaller ones are cheaper to copy than to send as separate iovecs.
+    static const size_t kMinReferencedSize = 16384;
 
     encoded_buffers_t();
+   ~encoded_buffers_t();
 
     // Movable
     encoded_buffers_t(encoded_buffers_t&&) = default;
 
+    // Releases the buffer being replaced back to the pool.
     encoded_buffers_t&
-    operator=(encoded_buffers_t&&) = default;
+    operator=(encoded_buffers_t&& other);
 
     COCAINE_DECLARE_NONCOPYABLE(encoded_buffers_t)
 
+    // Marks the memory region as the one which will outlive the encoded message, so that when it's
+    // written later on as a whole, it's referenced instead.
+    void
+    pin(const char* data, size_t size);
+
     void
     write(const char* data, size_t size);
 
+    // Inline part of the encoded data and its size, which is all of it unless some pinned regions
+    // were written. Use gather() to get to the whole of it.
     auto
-    data() const -> const char*;
+    inline_data() const -> const char*;
 
+    size_t
+    inline_size() const;
+
+    // Total size of the encoded data, including referenced regions.
     size_t
     size() const;
 
+    // Appends the encoded data to the buffer sequence as a chain of (pointer, size) pairs and returns
+    // the number of pairs appended.
+    template<class Sequence>
+    size_t
+    gather(Sequence& target) const;
+
 private:
+    struct segment_t {
+        // Position in the inline buffer where the referenced region is spliced.
+        size_t offset;
+
+        const char* data;
+        size_t size;
+    };
+
     std::vector<char, uninitialized<char>> vector;
     std::vector<char, uninitialized<char>>::size_type offset;
+
+    std::vector<std::pair<const char*, size_t>> pinned;
+    std::vector<segment_t> segments;
 };
 
+template<class Sequence>
+size_t
+encoded_buffers_t::gather(Sequence& target) const {
+    size_t count = 0;
+    size_t cursor = 0;
+
+    for(auto it = segments.begin(); it != segments.end(); ++it) {
+        if(it->offset > cursor) {
+            target.emplace_back(vector.data() + cursor, it->offset - cursor);
+            count++;
+        }
+
+        target.emplace_back(it->data, it->size);
+        count++;
+
+        cursor = it->offset;
+    }
+
+    if(offset > cursor) {
+        target.emplace_back(vector.data() + cursor, offset - cursor);
+        count++;
+    }
+
+    return count;
+}
+
 struct encoded_message_t {
     void
     write(const char* data, size_t size);
 
     auto
-    data() const -> const char*;
+    inline_data() const -> const char*;
+
+    size_t
+    inline_size() const;
 
     size_t
     size() const;
 
+    template<class Sequence>
+    size_t
+    gather(Sequence& target) const {
+        return buffer.gather(target);
+    }
+
     encoded_buffers_t buffer;
+
+    // Keeps the regions referenced by the buffer alive.
+    std::vector<std::shared_ptr<const void>> owners;
 };
 
+// Large string arguments passed by rvalue are moved into the message and sent directly from there,
+// everything else is passed to the packer as is.
+
+template<class T>
+inline
+auto
+retain(encoded_message_t& COCAINE_UNUSED_(message), T&& argument) -> T&& {
+    return std::forward<T>(argument);
+}
+
+inline
+auto
+retain(encoded_message_t& message, std::string&& argument) -> const std::string& {
+    if(argument.size() < encoded_buffers_t::kMinReferencedSize) {
+        return argument;
+    }
+
+    const auto owned = std::make_shared<const std::string>(std::move(argument));
+
+    message.buffer.pin(owned->data(), owned->size());
+    message.owners.push_back(owned);
+
+    return *owned;
+}
+
 struct unbound_message_t {
-    typedef std::function<aux::encoded_message_t(encoder_t&)> function_type;
+    explicit
+    unbound_message_t(hpack::header_storage_t&& headers_);
+
+    // Movable
+    unbound_message_t(unbound_message_t&&) = default;
+
+    unbound_message_t&
+    operator=(unbound_message_t&&) = default;
 
-    // Partially applied message encoding function.
-    const function_type bind;
+    COCAINE_DECLARE_NONCOPYABLE(unbound_message_t)
 
-    unbound_message_t(function_type&& bind_);
+    // Frame prefix with the channel ID, the message ID and the message arguments, which is packed
+    // right away. Only the headers are left for the encoder, because they depend on its HPACK state.
+    encoded_message_t body;
+
+    hpack::header_storage_t headers;
 };
 
 } // namespace aux
@@ -91,47 +257,49 @@ struct unbound_message_t {
 struct encoder_t {
     COCAINE_DECLARE_NONCOPYABLE(encoder_t)
 
-    encoder_t() = default;
+    encoder_t();
    ~encoder_t() = default;
 
     typedef aux::unbound_message_t message_type;
     typedef aux::encoded_message_t encoded_message_type;
     typedef msgpack::packer<aux::encoded_buffers_t> packer_type;
 
-    // TODO: Do we really need owning header storage?
-    template<class Event, class... Args>
-    static inline
-    aux::encoded_message_t
-    tether(encoder_t& encoder, uint64_t channel_id, const hpack::header_storage_t& headers, Args&... args) {
-        aux::encoded_message_t message;
-
-        packer_type packer(message.buffer);
+    struct stats_t {
+        // Size of the headers as if they were packed uncompressed and their actual size.
+        std::uint64_t plain;
+        std::uint64_t packed;
+    };
 
-        packer.pack_array(4);
-
-        // Channel ID & Message ID
-
-        packer.pack(channel_id);
-        packer.pack(static_cast<uint64_t>(event_traits<Event>::id));
+    aux::encoded_message_t
+    encode(message_type&& message);
 
-        // Message arguments
+    void
+    pack_headers(packer_type& packer, const hpack::header_storage_t& headers);
 
-        type_traits<typename event_traits<Event>::argument_type>::pack(packer,
-            std::forward<Args>(args)...);
+    // Enables HPACK dynamic table indexing of outgoing headers. Must only be enabled once the peer
+    // has announced that it maintains the dynamic table of at least this table's capacity.
+    void
+    compress(bool enable);
 
-        encoder.pack_headers(packer, headers);
-        return message;
-    }
+    bool
+    compressed() const;
 
-    aux::encoded_message_t
-    encode(const message_type& message);
+    // Returns header statistics accumulated since the previous call.
+    auto
+    drain() -> stats_t;
 
+private:
+    // Unique headers are never indexed, even if the compression is enabled.
     void
-    pack_headers(packer_type& packer, const hpack::header_storage_t& headers);
+    pack_header(packer_type& packer, const hpack::header_t& header, bool unique = false);
 
 private:
     // HPACK HTTP/2.0 tables.
     hpack::header_table_t hpack_context;
+
+    bool compression;
+
+    stats_t stats;
 };
 
 template<class Event>
@@ -139,22 +307,37 @@ struct encoded:
     public aux::unbound_message_t
 {
     template<class... Args>
-    encoded(uint64_t channel_id, Args&&... args): unbound_message_t(
-    std::bind(&encoder_t::tether<Event, typename std::decay<Args>::type...>,
-              std::placeholders::_1,
-              channel_id,
-              hpack::header_storage_t(),
-              std::forward<Args>(args)...))
-    { }
+    encoded(uint64_t channel_id, Args&&... args):
+        unbound_message_t(hpack::header_storage_t())
+    {
+        pack(channel_id, std::forward<Args>(args)...);
+    }
+
+    template<class... Args>
+    encoded(uint64_t channel_id, hpack::header_storage_t headers, Args&&... args):
+        unbound_message_t(std::move(headers))
+    {
+        pack(channel_id, std::forward<Args>(args)...);
+    }
 
+private:
     template<class... Args>
-    encoded(uint64_t channel_id, hpack::header_storage_t headers, Args&&... args): unbound_message_t(
-        std::bind(&encoder_t::tether<Event, typename std::decay<Args>::type...>,
-            std::placeholders::_1,
-            channel_id,
-            std::move(headers),
-            std::forward<Args>(args)...))
-    { }
+    void
+    pack(uint64_t channel_id, Args&&... args) {
+        encoder_t::packer_type packer(body.buffer);
+
+        packer.pack_array(4);
+
+        // Channel ID & Message ID
+
+        packer.pack(channel_id);
+        packer.pack(static_cast<uint64_t>(event_traits<Event>::id));
+
+        // Message arguments
+
+        type_traits<typename event_traits<Event>::argument_type>::pack(packer,
+            aux::retain(body, std::forward<Args>(args))...);
+    }
 };
 
 }} // namespace cocaine::io
@@ -23,13 +23,17 @@
 
 #include "cocaine/errors.hpp"
 #include "cocaine/memory.hpp"
+#include "cocaine/rpc/asio/buffer_pool.hpp"
+#include "cocaine/rpc/asio/uring.hpp"
 
 #include <functional>
 
 #include <asio/io_service.hpp>
 #include <asio/basic_stream_socket.hpp>
 
+#include <algorithm>
 #include <cstring>
+#include <vector>
 
 namespace cocaine { namespace io {
 
@@ -39,7 +43,16 @@ class readable_stream:
 {
     COCAINE_DECLARE_NONCOPYABLE(readable_stream)
 
-    static const size_t kInitialBufferSize = 65536;
+    static const size_t kInitialBufferSize = buffer_pool_t::kBufferSize;
+
+    // Frames larger than this are not preallocated upfront based on their header, instead the ring
+    // grows gradually as the data arrives, so that peers can't make us allocate arbitrary amounts
+    // of memory by just sending a frame header.
+    static const size_t kMaxPreallocationSize = 64 * 1024 * 1024;
+
+    // Multishot receives don't stop on their own while nobody reads the stream, so they are cancelled
+    // once this much data is buffered, to let the socket buffer fill up and the peer slow down.
+    static const size_t kMaxBufferedSize = 16 * kInitialBufferSize;
 
     typedef typename Protocol::socket socket_type;
 
@@ -50,22 +63,75 @@ class readable_stream:
 
     typedef std::function<void(const std::error_code&)> handler_type;
 
-    std::vector<char, uninitialized<char>> m_ring;
-    std::vector<char, uninitialized<char>>::size_type m_rd_offset, m_rx_offset;
+    typedef buffer_pool_t::buffer_type buffer_type;
+
+    buffer_type m_ring;
+    buffer_type::size_type m_rd_offset, m_rx_offset;
+
+    // Per-reactor pool to borrow the ring from, if the stream is lazy.
+    buffer_pool_t& m_pool;
 
     decoder_type m_decoder;
 
+    // Per-reactor ring to receive via instead of the reactor itself, if it's enabled.
+    uring_service_t* m_uring;
+
+    // The multishot receive is armed once and then only re-armed after it's been cancelled, so the
+    // pending read is stashed until the next chunk of data arrives.
+    bool m_receiving;
+    std::uint64_t m_receive;
+
+    message_type* m_message;
+    handler_type m_handle;
+
+    // The receive failure which happened while there was no read pending.
+    std::error_code m_error;
+
+    // Data received while there was no read pending, which doesn't fit into the tail of the ring. The
+    // last decoded message might still refer to the ring, so it can't be compacted or grown until the
+    // next read, and the data is spliced into it then.
+    std::vector<char> m_overflow;
+
 public:
     explicit
     readable_stream(const std::shared_ptr<socket_type>& socket):
-        m_socket(socket)
+        m_socket(socket),
+        m_pool(asio::use_service<buffer_pool_t>(socket->get_io_service())),
+        m_uring(nullptr),
+        m_receiving(false),
+        m_receive(0),
+        m_message(nullptr)
     {
-        m_ring.resize(kInitialBufferSize);
+        auto& uring = asio::use_service<uring_service_t>(socket->get_io_service());
+
+        if(uring.enabled()) {
+            m_uring = &uring;
+        }
+
+        if(!m_pool.lazy()) {
+            m_ring.resize(kInitialBufferSize);
+        } else {
+            std::error_code ec;
+
+            // Otherwise synchronous reads on spurious wakeups would block in poll().
+            m_socket->non_blocking(true, ec);
+        }
+
         m_rd_offset = m_rx_offset = 0;
     }
 
+   ~readable_stream() {
+        if(!m_ring.empty()) {
+            m_pool.release(m_ring);
+        }
+    }
+
     void
     read(message_type& message, handler_type handle) {
+        if(!m_overflow.empty()) {
+            splice();
+        }
+
         std::error_code ec;
 
         const size_t
@@ -80,6 +146,32 @@ public:
             return m_socket->get_io_service().post(std::bind(handle, ec));
         }
 
+        namespace ph = std::placeholders;
+
+        if(!bytes_pending) {
+            m_rd_offset = m_rx_offset = 0;
+
+            if(m_pool.lazy()) {
+                // Nothing is pending, so give the ring back to the pool and wait for the socket to
+                // become readable without holding any memory.
+                m_pool.release(m_ring);
+
+                if(m_uring) {
+                    return receive(message, handle);
+                }
+
+                return m_socket->async_read_some(
+                    asio::null_buffers(),
+                    std::bind(&readable_stream::wake, this->shared_from_this(), std::ref(message), handle, ph::_1)
+                );
+            }
+
+            if(m_ring.size() > kInitialBufferSize) {
+                // Trim the ring which has grown to accomodate some large frame.
+                m_ring = buffer_type(kInitialBufferSize);
+            }
+        }
+
         if(m_rx_offset) {
             // Compactify the ring before the asynchronous read operation.
             std::memmove(m_ring.data(), m_ring.data() + m_rx_offset, bytes_pending);
@@ -88,13 +180,19 @@ public:
             m_rx_offset = 0;
         }
 
-        if(bytes_pending * 2 >= m_ring.size()) {
-            // The total size of unprocessed data in larger than half the size of the ring, so grow
-            // the ring in order to accomodate more data.
-            m_ring.resize(m_ring.size() * 2);
+        const size_t bytes_required = m_decoder.required() <= kMaxPreallocationSize ?
+            m_decoder.required() : 0;
+
+        if(bytes_pending * 2 >= m_ring.size() || bytes_required > m_ring.size()) {
+            // The total size of unprocessed data in larger than half the size of the ring or the
+            // frame is known to be larger than the ring, so grow the ring in order to accomodate
+            // more data.
+            m_ring.resize(std::max(m_ring.size() * 2, bytes_required));
         }
 
-        namespace ph = std::placeholders;
+        if(m_uring) {
+            return receive(message, handle);
+        }
 
         m_socket->async_read_some(
             asio::buffer(m_ring.data() + m_rd_offset, m_ring.size() - m_rd_offset),
@@ -102,12 +200,189 @@ public:
         );
     }
 
+    // Decodes the next message if it has been received already, without touching the socket. Returns
+    // false if there's not enough data buffered or on errors.
+    bool
+    read_buffered(message_type& message, std::error_code& ec) {
+        if(!m_overflow.empty()) {
+            splice();
+        }
+
+        std::error_code result;
+
+        const size_t
+            bytes_pending = m_rd_offset - m_rx_offset,
+            bytes_decoded = m_decoder.decode(m_ring.data() + m_rx_offset, bytes_pending, message, result);
+
+        if(result) {
+            if(result != error::insufficient_bytes) {
+                ec = result;
+            }
+
+            return false;
+        }
+
+        m_rx_offset += bytes_decoded;
+
+        return true;
+    }
+
     auto
     pressure() const -> size_t {
         return m_ring.size();
     }
 
 private:
+    void
+    receive(message_type& message, handler_type handle) {
+        if(m_error) {
+            const auto ec = m_error;
+
+            m_error.clear();
+
+            return m_socket->get_io_service().post(std::bind(handle, ec));
+        }
+
+        m_message = &message;
+        m_handle  = std::move(handle);
+
+        if(m_receiving) {
+            return;
+        }
+
+        namespace ph = std::placeholders;
+
+        m_receiving = true;
+        m_receive   = m_uring->receive(m_socket->native_handle(),
+            std::bind(&readable_stream::received, this->shared_from_this(), ph::_1, ph::_2, ph::_3));
+    }
+
+    void
+    received(const std::error_code& ec, const char* data, size_t size) {
+        if(ec) {
+            m_receiving = false;
+
+            if(ec == asio::error::operation_aborted) {
+                // Cancelled to apply the backpressure, so resume if there's a read pending again.
+                if(m_handle) {
+                    handler_type handle;
+
+                    std::swap(handle, m_handle);
+
+                    receive(*m_message, std::move(handle));
+                }
+
+                return;
+            }
+
+            if(!m_handle) {
+                m_error = ec;
+                return;
+            }
+
+            handler_type handle;
+
+            std::swap(handle, m_handle);
+
+            return m_socket->get_io_service().post(std::bind(handle, ec));
+        }
+
+        if(m_ring.empty()) {
+            m_ring = m_pool.acquire();
+        }
+
+        if(!m_handle && (!m_overflow.empty() || m_ring.size() - m_rd_offset < size)) {
+            // The last decoded message might still be in use, so the ring is left intact for now.
+            m_overflow.insert(m_overflow.end(), data, data + size);
+
+            if(m_rd_offset - m_rx_offset + m_overflow.size() > kMaxBufferedSize) {
+                m_uring->cancel(m_receive);
+            }
+
+            return;
+        }
+
+        if(m_ring.size() - m_rd_offset < size) {
+            const size_t bytes_pending = m_rd_offset - m_rx_offset;
+
+            std::memmove(m_ring.data(), m_ring.data() + m_rx_offset, bytes_pending);
+
+            m_rd_offset = bytes_pending;
+            m_rx_offset = 0;
+
+            if(m_ring.size() - m_rd_offset < size) {
+                m_ring.resize(std::max(m_ring.size() * 2, m_rd_offset + size));
+            }
+        }
+
+        std::memcpy(m_ring.data() + m_rd_offset, data, size);
+
+        m_rd_offset += size;
+
+        if(!m_handle) {
+            if(m_rd_offset - m_rx_offset > kMaxBufferedSize) {
+                m_uring->cancel(m_receive);
+            }
+
+            return;
+        }
+
+        handler_type handle;
+
+        std::swap(handle, m_handle);
+
+        read(*m_message, std::move(handle));
+    }
+
+    // Moves the data received while there was no read pending into the ring. Must only be called once
+    // the last decoded message is no longer in use.
+    void
+    splice() {
+        if(m_ring.empty()) {
+            m_ring = m_pool.acquire();
+        }
+
+        const size_t bytes_pending = m_rd_offset - m_rx_offset;
+
+        std::memmove(m_ring.data(), m_ring.data() + m_rx_offset, bytes_pending);
+
+        m_rd_offset = bytes_pending;
+        m_rx_offset = 0;
+
+        if(m_ring.size() - m_rd_offset < m_overflow.size()) {
+            m_ring.resize(std::max(m_ring.size() * 2, m_rd_offset + m_overflow.size()));
+        }
+
+        std::memcpy(m_ring.data() + m_rd_offset, m_overflow.data(), m_overflow.size());
+
+        m_rd_offset += m_overflow.size();
+        m_overflow.clear();
+    }
+
+    void
+    wake(message_type& message, handler_type handle, const std::error_code& ec) {
+        if(ec) {
+            if(ec == asio::error::operation_aborted) {
+                return;
+            }
+
+            return m_socket->get_io_service().post(std::bind(handle, ec));
+        }
+
+        m_ring = m_pool.acquire();
+
+        std::error_code error;
+
+        // The socket is in non-blocking mode, so this won't block even on spurious wakeups.
+        const size_t bytes_read = m_socket->read_some(asio::buffer(m_ring.data(), m_ring.size()), error);
+
+        if(error == asio::error::would_block) {
+            return read(std::ref(message), handle);
+        }
+
+        fill(std::ref(message), handle, error, bytes_read);
+    }
+
     void
     fill(message_type& message, handler_type handle, const std::error_code& ec, size_t bytes_read) {
         if(ec) {
@@ -57,6 +57,8 @@ struct transport {
 
    ~transport() {
         try {
+            // NOTE: Shutting the socket down also stops the reader's multishot receive, if any, which
+            // otherwise keeps it alive, since closing the socket doesn't cancel io_uring operations.
             socket->shutdown(socket_type::shutdown_both);
             socket->close();
         } catch(...) {
@@ -0,0 +1,107 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COCAINE_IO_URING_HPP
+#define COCAINE_IO_URING_HPP
+
+#include "cocaine/common.hpp"
+
+#include <asio/io_service.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <system_error>
+
+struct msghdr;
+
+namespace cocaine { namespace io {
+
+// Per-reactor io_uring instance, which readable and writable streams use instead of the reactor
+// itself when enabled. Registered as an asio service, so every execution unit gets its own ring
+// without any additional plumbing.
+//
+// Receives are multishot and land in buffers registered with the kernel, so that a connection costs
+// a single submission for as long as it's alive. Submissions are batched and flushed once per reactor
+// loop iteration, and completions are reaped when the ring's eventfd becomes readable. Every method
+// must only be called from the reactor's thread.
+
+class uring_service_t:
+    public asio::io_service::service
+{
+public:
+    // Called for every chunk of received data, which is only valid during the call. The last call
+    // carries an error instead: asio::error::eof if the peer has shut the connection down, or
+    // asio::error::operation_aborted if the receive has been cancelled.
+    typedef std::function<void(const std::error_code&, const char*, size_t)> receive_handler_type;
+    typedef std::function<void(const std::error_code&, size_t)> send_handler_type;
+
+    // Registered buffers shared by all the receives of the reactor.
+    static const size_t kBufferSize  = 16384;
+    static const size_t kBufferCount = 256;
+
+    static asio::io_service::id id;
+
+    explicit
+    uring_service_t(asio::io_service& asio);
+
+   ~uring_service_t();
+
+    // Whether the running kernel supports io_uring with multishot receives. Checked only once.
+    static
+    bool
+    supported();
+
+    // Sets the ring up if enabled and supported. Returns whether the ring is used.
+    bool
+    configure(bool enable);
+
+    // Observers
+
+    bool
+    enabled() const;
+
+    // Operations
+
+    // Keeps receiving from the socket until the receive is cancelled or fails. Returns the receive id
+    // to cancel it with.
+    auto
+    receive(int fd, receive_handler_type handler) -> std::uint64_t;
+
+    // The header, along with the buffers it refers to, must be valid until the handler is called.
+    void
+    send(int fd, const msghdr* header, send_handler_type handler);
+
+    void
+    cancel(std::uint64_t operation);
+
+private:
+    void
+    shutdown_service();
+
+private:
+    class ring_t;
+
+    std::unique_ptr<ring_t> m_ring;
+};
+
+}} // namespace cocaine::io
+
+#endif
@@ -22,6 +22,7 @@
 #define COCAINE_IO_BUFFERED_WRITABLE_STREAM_HPP
 
 #include "cocaine/errors.hpp"
+#include "cocaine/rpc/asio/uring.hpp"
 #include "cocaine/trace/trace.hpp"
 
 #include <functional>
@@ -29,7 +30,15 @@
 #include <asio/io_service.hpp>
 #include <asio/basic_stream_socket.hpp>
 
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
 #include <deque>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 namespace cocaine { namespace io {
 
@@ -39,6 +48,12 @@ class writable_stream:
 {
     COCAINE_DECLARE_NONCOPYABLE(writable_stream)
 
+#if defined(IOV_MAX)
+    static const size_t kMaxBuffersPerWrite = IOV_MAX;
+#else
+    static const size_t kMaxBuffersPerWrite = 1024;
+#endif
+
     typedef typename Protocol::socket socket_type;
 
     typedef Encoder encoder_type;
@@ -47,115 +62,367 @@ class writable_stream:
     const std::shared_ptr<socket_type> m_socket;
 
     typedef std::function<void(const std::error_code&)> handler_type;
+    typedef std::function<void(size_t)> observer_type;
+    typedef std::function<void()> drain_handler_type;
+
+    // Messages are queued as chains of buffers, the handler is notified once the whole chain is sent.
+    struct pending_t {
+        handler_type handle;
+        size_t segments;
+    };
 
     std::deque<asio::const_buffer> m_messages;
     std::deque<typename Encoder::encoded_message_type> m_encoded_messages;
-    std::deque<handler_type> m_handlers;
+    std::deque<pending_t> m_handlers;
 
     enum class states { idle, flushing } m_state;
 
-    encoder_type encoder;
+    // Total size of the queued messages which are not yet written.
+    size_t m_queued;
+
+    // The stream is congested above the high watermark until it drains down to the low one. Zero high
+    // watermark means that the queue is unbounded.
+    size_t m_high_watermark;
+    size_t m_low_watermark;
+
+    // Notified once the congested stream drains and once it's completely flushed.
+    drain_handler_type m_drained;
+    drain_handler_type m_flushed;
+
+    // Notified after every write syscall with the number of messages it has completed.
+    observer_type m_observer;
+
+    encoder_type m_encoder;
+
+    // Per-reactor ring to send via instead of raw syscalls, if it's enabled.
+    uring_service_t* m_uring;
+
+    // The message header of the send in flight, which must outlive its submission.
+    std::vector<iovec> m_buffers;
+    msghdr m_header;
 
 public:
     explicit
     writable_stream(const std::shared_ptr<socket_type>& socket):
         m_socket(socket),
-        m_state(states::idle)
-    { }
+        m_state(states::idle),
+        m_queued(0),
+        m_high_watermark(0),
+        m_low_watermark(0),
+        m_uring(nullptr)
+    {
+        std::error_code ec;
 
-    void
-    write(const message_type& message, handler_type handle) {
-        size_t bytes_written = 0;
+        // Messages are written with raw vectored syscalls, which must never block the reactor.
+        m_socket->non_blocking(true, ec);
 
-        auto encoded = encoder.encode(message);
+        auto& uring = asio::use_service<uring_service_t>(socket->get_io_service());
 
-        if(m_state == states::idle) {
-            std::error_code ec;
+        if(uring.enabled()) {
+            m_uring = &uring;
+        }
+    }
 
-            // Try to write some data right away, as we don't have anything pending.
-            bytes_written = m_socket->write_some(asio::buffer(encoded.data(), encoded.size()), ec);
+    void
+    write(message_type&& message, handler_type handle) {
+        auto encoded = m_encoder.encode(std::move(message));
 
-            if(!ec && bytes_written == encoded.size()) {
-                return m_socket->get_io_service().post(trace_t::bind(handle, ec));
-            }
-        }
+        const size_t segments = encoded.gather(m_messages);
 
-        m_messages.emplace_back(encoded.data() + bytes_written, encoded.size() - bytes_written);
-        m_handlers.emplace_back(handle);
+        // NOTE: Completions are notified in batches, so every handler carries its own trace along.
+        m_handlers.push_back({trace_t::bind(std::move(handle)), segments});
+        m_queued += encoded.size();
         m_encoded_messages.emplace_back(std::move(encoded));
 
         if(m_state == states::flushing) {
+            // Some write is already pending, so this message is coalesced with the rest of the queue
+            // and goes out along with it in a single syscall once the socket becomes writable.
             return;
         } else {
             m_state = states::flushing;
         }
 
-        namespace ph = std::placeholders;
+        // Nothing is queued, so try to write the message right away. Completions are still posted to
+        // the reactor, so the handler is never called from within this function.
+        flush(std::error_code());
+    }
 
-        m_socket->async_write_some(
-            m_messages,
-            std::bind(&writable_stream::flush, this->shared_from_this(), ph::_1, ph::_2)
-        );
+    void
+    observe(observer_type observer) {
+        m_observer = std::move(observer);
+    }
+
+    // NOTE: The encoder is not synchronized, so it must only be used from the stream's reactor.
+    auto
+    encoder() -> encoder_type& {
+        return m_encoder;
     }
 
     auto
     pressure() const -> size_t {
-        return asio::buffer_size(m_messages);
+        return m_queued;
+    }
+
+    void
+    watermarks(size_t high, size_t low) {
+        m_high_watermark = high;
+        m_low_watermark  = std::min(low, high);
+    }
+
+    bool
+    congested() const {
+        return m_high_watermark && m_queued > m_high_watermark;
+    }
+
+    // Calls the handler once the queue drains down to the low watermark or the stream fails. Only one
+    // handler might be waiting at a time.
+    void
+    wait_drained(drain_handler_type handler) {
+        m_drained = std::move(handler);
+
+        if(m_queued <= m_low_watermark) {
+            drain();
+        }
+    }
+
+    // Calls the handler once everything queued so far is written or the stream fails.
+    void
+    wait_flushed(drain_handler_type handler) {
+        m_flushed = std::move(handler);
+
+        if(m_queued == 0) {
+            flushed();
+        }
     }
 
 private:
     void
-    flush(const std::error_code& ec, size_t bytes_written) {
+    flush(const std::error_code& ec) {
         if(ec) {
             if(ec == asio::error::operation_aborted) {
                 return;
             }
 
-            while(!m_handlers.empty()) {
-                m_socket->get_io_service().post(std::bind(m_handlers.front(), ec));
+            return fail(ec);
+        }
+
+        if(m_uring) {
+            return submit();
+        }
+
+        while(!m_messages.empty()) {
+            iovec buffers[kMaxBuffersPerWrite];
+
+            const size_t count = std::min(m_messages.size(), kMaxBuffersPerWrite);
+
+            for(size_t i = 0; i < count; ++i) {
+                buffers[i].iov_base = const_cast<char*>(asio::buffer_cast<const char*>(m_messages[i]));
+                buffers[i].iov_len  = asio::buffer_size(m_messages[i]);
+            }
+
+            msghdr header;
+
+            std::memset(&header, 0, sizeof(header));
+
+            header.msg_iov    = buffers;
+            header.msg_iovlen = count;
+
+#if defined(MSG_NOSIGNAL)
+            const ssize_t rv = ::sendmsg(m_socket->native_handle(), &header, MSG_NOSIGNAL);
+#else
+            const ssize_t rv = ::sendmsg(m_socket->native_handle(), &header, 0);
+#endif
+
+            if(rv < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+
+                if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
 
-                m_messages.pop_front();
-                m_handlers.pop_front();
-                m_encoded_messages.pop_front();
+                return fail(std::error_code(errno, std::system_category()));
             }
 
+            consume(static_cast<size_t>(rv));
+        }
+
+        if(m_messages.empty()) {
+            m_state = states::idle;
             return;
         }
 
+        namespace ph = std::placeholders;
+
+        // The socket buffer is full, wait until it becomes writable again.
+        m_socket->async_write_some(
+            asio::null_buffers(),
+            std::bind(&writable_stream::flush, this->shared_from_this(), ph::_1)
+        );
+    }
+
+    void
+    submit() {
+        const size_t count = std::min(m_messages.size(), kMaxBuffersPerWrite);
+
+        m_buffers.resize(count);
+
+        for(size_t i = 0; i < count; ++i) {
+            m_buffers[i].iov_base = const_cast<char*>(asio::buffer_cast<const char*>(m_messages[i]));
+            m_buffers[i].iov_len  = asio::buffer_size(m_messages[i]);
+        }
+
+        std::memset(&m_header, 0, sizeof(m_header));
+
+        m_header.msg_iov    = m_buffers.data();
+        m_header.msg_iovlen = count;
+
+        namespace ph = std::placeholders;
+
+        // NOTE: Messages queued while the send is in flight are picked up once it completes, so
+        // there's at most one send per stream in the ring at any time.
+        m_uring->send(m_socket->native_handle(), &m_header,
+            std::bind(&writable_stream::sent, this->shared_from_this(), ph::_1, ph::_2));
+    }
+
+    void
+    sent(const std::error_code& ec, size_t bytes_written) {
+        if(ec) {
+            if(ec == asio::error::operation_aborted) {
+                return;
+            }
+
+            if(ec == std::errc::resource_unavailable_try_again) {
+                namespace ph = std::placeholders;
+
+                // Non-blocking sockets might still report a full socket buffer on some kernels.
+                return m_socket->async_write_some(
+                    asio::null_buffers(),
+                    std::bind(&writable_stream::flush, this->shared_from_this(), ph::_1)
+                );
+            }
+
+            return fail(ec);
+        }
+
+        consume(bytes_written);
+
+        if(m_messages.empty()) {
+            m_state = states::idle;
+            return;
+        }
+
+        submit();
+    }
+
+    void
+    consume(size_t bytes_written) {
+        std::vector<handler_type> completed;
+
         while(bytes_written) {
             BOOST_ASSERT(!m_messages.empty() && !m_handlers.empty());
 
-            const size_t message_size = asio::buffer_size(m_messages.front());
+            const size_t segment_size = asio::buffer_size(m_messages.front());
 
-            if(message_size > bytes_written) {
+            if(segment_size > bytes_written) {
                 m_messages.front() = m_messages.front() + bytes_written;
+                m_queued -= bytes_written;
                 break;
             }
 
-            bytes_written -= message_size;
-
-            // Queue this block's handler for invocation.
-            m_socket->get_io_service().post(std::bind(m_handlers.front(), ec));
+            bytes_written -= segment_size;
+            m_queued -= segment_size;
 
             m_messages.pop_front();
+
+            if(--m_handlers.front().segments) {
+                continue;
+            }
+
+            completed.push_back(std::move(m_handlers.front().handle));
+
             m_handlers.pop_front();
             m_encoded_messages.pop_front();
         }
 
-        if(m_messages.empty() && m_state == states::flushing) {
-            m_state = states::idle;
-            return;
+        if(m_observer) {
+            m_observer(completed.size());
         }
 
-        namespace ph = std::placeholders;
+        if(m_drained && m_queued <= m_low_watermark) {
+            drain();
+        }
 
-        m_socket->async_write_some(
-            m_messages,
-            std::bind(&writable_stream::flush, this->shared_from_this(), ph::_1, ph::_2)
-        );
+        if(m_flushed && m_queued == 0) {
+            flushed();
+        }
+
+        if(!completed.empty()) {
+            // Acknowledge all the messages completed by this write in one go.
+            m_socket->get_io_service().post(std::bind(&writable_stream::notify,
+                std::move(completed),
+                std::error_code()
+            ));
+        }
+    }
+
+    void
+    fail(const std::error_code& ec) {
+        std::vector<handler_type> failed;
+
+        for(auto it = m_handlers.begin(); it != m_handlers.end(); ++it) {
+            failed.push_back(std::move(it->handle));
+        }
+
+        m_messages.clear();
+        m_handlers.clear();
+        m_encoded_messages.clear();
+
+        m_queued = 0;
+
+        m_socket->get_io_service().post(std::bind(&writable_stream::notify, std::move(failed), ec));
+
+        // Let the waiting parties find out about the failure by themselves.
+        if(m_drained) {
+            drain();
+        }
+
+        if(m_flushed) {
+            flushed();
+        }
+    }
+
+    void
+    drain() {
+        drain_handler_type handler;
+
+        std::swap(handler, m_drained);
+
+        m_socket->get_io_service().post(std::move(handler));
+    }
+
+    void
+    flushed() {
+        drain_handler_type handler;
+
+        std::swap(handler, m_flushed);
+
+        m_socket->get_io_service().post(std::move(handler));
+    }
+
+    static
+    void
+    notify(const std::vector<handler_type>& handlers, const std::error_code& ec) {
+        for(auto it = handlers.begin(); it != handlers.end(); ++it) {
+            (*it)(ec);
+        }
     }
 };
 
+template<class Protocol, class Encoder>
+const size_t writable_stream<Protocol, Encoder>::kMaxBuffersPerWrite;
+
 }} // namespace cocaine::io
 
 #endif
@@ -24,6 +24,7 @@
 #include "cocaine/common.hpp"
 #include "cocaine/rpc/asio/decoder.hpp"
 #include "cocaine/rpc/graph.hpp"
+#include "cocaine/utility/sharded.hpp"
 
 #include <boost/optional/optional_fwd.hpp>
 
@@ -80,6 +81,25 @@ public:
     virtual
     int
     version() const = 0;
+
+protected:
+    // Number of messages being processed by all the dispatches. Slot tables replaced while it's not
+    // zero might be still in use, so they're only destroyed once it drops to zero, see dispatch<Tag>.
+    static utility::sharded_counter processing;
+
+    // Accounts a message as being processed for the lifetime of the scope.
+    class processing_scope_t {
+    public:
+        processing_scope_t() {
+            // NOTE: Sequentially consistent, so that either the message is seen by the update which
+            // replaces the slot table, or the message sees the new table.
+            processing.add(1, std::memory_order_seq_cst);
+        }
+
+       ~processing_scope_t() {
+            processing.add(-1, std::memory_order_release);
+        }
+    };
 };
 
 } // namespace io
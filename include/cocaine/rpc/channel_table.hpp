@@ -0,0 +1,217 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COCAINE_IO_CHANNEL_TABLE_HPP
+#define COCAINE_IO_CHANNEL_TABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <boost/assert.hpp>
+
+namespace cocaine { namespace io {
+
+// Open addressing hash table of virtual channels keyed by their ids, with linear probing. Channel
+// ids are allocated sequentially, so the channels alive at the same time mostly form a dense window.
+// Masking the ids as is would pack this window into a single long probe sequence, which every erase
+// has to shift back, so the ids are scattered with Fibonacci hashing instead.
+//
+// NOTE: The id zero is reserved for the connection-wide control messages and marks empty slots.
+
+template<class T>
+class channel_table {
+public:
+    typedef std::uint64_t key_type;
+    typedef T mapped_type;
+
+private:
+    struct slot_t {
+        key_type    id;
+        mapped_type value;
+    };
+
+    // Hash bits used to index the slots, i.e. binary logarithm of the capacity.
+    static const unsigned int initial_bits = 4;
+
+    std::vector<slot_t> m_slots;
+    size_t m_size;
+    unsigned int m_bits;
+
+public:
+    channel_table():
+        m_slots(size_t(1) << initial_bits),
+        m_size(0),
+        m_bits(initial_bits)
+    { }
+
+    // Observers
+
+    auto
+    find(key_type id) -> mapped_type* {
+        const auto index = locate(id);
+        return m_slots[index].id ? &m_slots[index].value : nullptr;
+    }
+
+    auto
+    find(key_type id) const -> const mapped_type* {
+        const auto index = locate(id);
+        return m_slots[index].id ? &m_slots[index].value : nullptr;
+    }
+
+    size_t
+    size() const {
+        return m_size;
+    }
+
+    bool
+    empty() const {
+        return m_size == 0;
+    }
+
+    // Visits every channel in no particular order.
+    template<class F>
+    void
+    each(F&& visitor) const {
+        for(auto it = m_slots.begin(); it != m_slots.end(); ++it) {
+            if(it->id) visitor(it->id, it->value);
+        }
+    }
+
+    // Modifiers
+
+    // Returns false without touching the table if there's already a channel with the same id.
+    bool
+    insert(key_type id, mapped_type value) {
+        BOOST_ASSERT(id != 0);
+
+        // Keep at least a half of the slots empty, so that the probe sequences stay short.
+        if((m_size + 1) * 2 > m_slots.size()) {
+            grow();
+        }
+
+        const auto index = locate(id);
+
+        if(m_slots[index].id) {
+            return false;
+        }
+
+        m_slots[index].id    = id;
+        m_slots[index].value = std::move(value);
+
+        ++m_size;
+
+        return true;
+    }
+
+    // Returns false if there's no channel with this id.
+    bool
+    erase(key_type id) {
+        const size_t mask = m_slots.size() - 1;
+
+        auto hole = locate(id);
+
+        if(!m_slots[hole].id) {
+            return false;
+        }
+
+        // Instead of leaving tombstones behind, shift the following entries of the same probe
+        // sequence back, so that lookups never have to skip over erased slots.
+        for(auto index = (hole + 1) & mask; m_slots[index].id; index = (index + 1) & mask) {
+            const auto home = slot_of(m_slots[index].id, m_bits);
+
+            if(((index - home) & mask) >= ((index - hole) & mask)) {
+                m_slots[hole] = std::move(m_slots[index]);
+                hole = index;
+            }
+        }
+
+        m_slots[hole].id    = 0;
+        m_slots[hole].value = mapped_type();
+
+        --m_size;
+
+        return true;
+    }
+
+    void
+    clear() {
+        for(auto it = m_slots.begin(); it != m_slots.end(); ++it) {
+            it->id    = 0;
+            it->value = mapped_type();
+        }
+
+        m_size = 0;
+    }
+
+private:
+    // Returns the index of the slot holding the id, or of the empty slot where it would be placed.
+    size_t
+    locate(key_type id) const {
+        const size_t mask = m_slots.size() - 1;
+
+        auto index = slot_of(id, m_bits);
+
+        while(m_slots[index].id && m_slots[index].id != id) {
+            index = (index + 1) & mask;
+        }
+
+        return index;
+    }
+
+    // Takes the topmost bits of the id multiplied by 2^64 divided by the golden ratio.
+    static
+    size_t
+    slot_of(key_type id, unsigned int bits) {
+        return static_cast<size_t>((id * 0x9E3779B97F4A7C15ull) >> (64 - bits));
+    }
+
+    // Doubles the capacity.
+    void
+    grow() {
+        const auto bits = m_bits + 1;
+
+        std::vector<slot_t> slots(size_t(1) << bits);
+
+        const size_t mask = slots.size() - 1;
+
+        for(auto it = m_slots.begin(); it != m_slots.end(); ++it) {
+            if(!it->id) {
+                continue;
+            }
+
+            auto index = slot_of(it->id, bits);
+
+            while(slots[index].id) {
+                index = (index + 1) & mask;
+            }
+
+            slots[index] = std::move(*it);
+        }
+
+        m_slots.swap(slots);
+        m_bits = bits;
+    }
+};
+
+}} // namespace cocaine::io
+
+#endif
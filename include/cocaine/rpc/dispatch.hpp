@@ -28,18 +28,26 @@
 #include "cocaine/rpc/slot/blocking.hpp"
 #include "cocaine/rpc/slot/deferred.hpp"
 #include "cocaine/rpc/slot/generic.hpp"
+#include "cocaine/rpc/slot/offloaded.hpp"
 #include "cocaine/rpc/slot/streamed.hpp"
 #include "cocaine/rpc/traversal.hpp"
 #include "cocaine/traits/tuple.hpp"
 #include "cocaine/utility/exchange.hpp"
 
+#include <boost/mpl/front.hpp>
+#include <boost/mpl/size.hpp>
 #include <boost/mpl/transform.hpp>
 #include <boost/mpl/lambda.hpp>
 
+#include <boost/optional/optional.hpp>
+
 #include <boost/variant/apply_visitor.hpp>
 #include <boost/variant/static_visitor.hpp>
 #include <boost/variant/variant.hpp>
 
+#include <array>
+#include <atomic>
+#include <limits>
 #include <type_traits>
 #include <vector>
 
@@ -63,12 +71,35 @@ class dispatch:
         >::type
     >::type slot_types;
 
-    typedef std::map<
-        int,
-        typename boost::make_variant_over<slot_types>::type
-    > slot_map_t;
+    typedef typename boost::make_variant_over<slot_types>::type slot_variant_t;
+
+    typedef std::array<
+        boost::optional<slot_variant_t>,
+        boost::mpl::size<typename io::messages<Tag>::type>::value
+    > slot_table_t;
 
-    synchronized<slot_map_t> m_slots;
+    // Event ids are the indices of the events in the protocol's message list, except for the control
+    // protocol, where they are counted backwards from the top of the id range. Either way, slots are
+    // stored in a table indexed by them.
+    static const bool kBackwards = io::event_traits<
+        typename boost::mpl::front<typename io::messages<Tag>::type>::type
+    >::id != 0;
+
+    static
+    auto
+    index_of(int id) -> std::size_t {
+        return static_cast<std::size_t>(kBackwards ? std::numeric_limits<std::uint16_t>::max() - id : id);
+    }
+
+    // Slot tables are copied on write and the current one is published atomically, so that process()
+    // looks slots up without locking. There's no telling whether some process() is still using the
+    // replaced tables, so they're retained along with their slots until an update finds that no
+    // dispatch is processing any message, or until the dispatch is destroyed.
+    std::atomic<const slot_table_t*> m_slots;
+    synchronized<std::vector<std::unique_ptr<const slot_table_t>>> m_tables;
+
+    // Executor to run blocking slots on, if they shouldn't run on the I/O threads.
+    api::executor_t* m_executor;
 
     // Slot traits
 
@@ -81,8 +112,22 @@ class dispatch:
 public:
     explicit
     dispatch(const std::string& name):
-        basic_dispatch_t(name)
-    {}
+        basic_dispatch_t(name),
+        m_slots(nullptr),
+        m_executor(nullptr)
+    {
+        update([](slot_table_t&) { });
+    }
+
+    // Blocking slots registered after this call are run on the given executor, e.g. on the context's
+    // worker pool, instead of the I/O threads. See also slot_builder::offload().
+    void
+    offload(api::executor_t& executor);
+
+    auto
+    executor() const -> api::executor_t* {
+        return m_executor;
+    }
 
     template<class Event>
     slot_builder<Event>
@@ -96,6 +141,9 @@ public:
     dispatch&
     on(const std::shared_ptr<io::basic_slot<Event>>& ptr);
 
+    // NOTE: Slots which are dropped are destroyed by some later update, once no message is being
+    // processed at the time, or along with the dispatch.
+
     template<class Event>
     void
     drop();
@@ -125,6 +173,12 @@ public:
     template<class Visitor>
     auto
     process(int id, const Visitor& visitor) -> typename Visitor::result_type;
+
+private:
+    // Publishes a copy of the current slot table modified by the given function.
+    template<class F>
+    void
+    update(F&& modify);
 };
 
 template<class Tag>
@@ -154,16 +208,35 @@ struct select<typename io::basic_slot<Event>::result_type, Event, ForwardMeta> {
     typedef io::generic_slot<Event> type;
 };
 
+// Slot offloading, only blocking slots are worth it
+
+template<class Event, class Slot>
+auto
+offload(std::shared_ptr<Slot> slot, api::executor_t*) -> std::shared_ptr<io::basic_slot<Event>> {
+    return slot;
+}
+
+template<class Event, class ForwardMeta, class R>
+auto
+offload(std::shared_ptr<io::blocking_slot<Event, ForwardMeta, R>> slot, api::executor_t* executor)
+    -> std::shared_ptr<io::basic_slot<Event>>
+{
+    typedef io::blocking_slot<Event, ForwardMeta, R> slot_type;
+
+    if(!executor) {
+        return slot;
+    }
+
+    return std::make_shared<io::offloaded_slot<Event, slot_type>>(std::move(slot), *executor);
+}
+
 // Slot invocation with arguments provided as a MessagePack object
 
 struct calling_visitor_t:
     public boost::static_visitor<boost::optional<io::dispatch_ptr_t>>
 {
-    calling_visitor_t(const std::vector<hpack::header_t>& headers_,
-                      const msgpack::object& unpacked_,
-                      const io::upstream_ptr_t& upstream_):
-        headers(headers_),
-        unpacked(unpacked_),
+    calling_visitor_t(const io::decoder_t::message_type& message_, const io::upstream_ptr_t& upstream_):
+        message(message_),
         upstream(upstream_)
     { }
 
@@ -178,18 +251,22 @@ struct calling_visitor_t:
         try {
             // NOTE: Unpacks the object into a tuple using the argument typelist unlike using plain
             // tuple type traits, in order to support parameter tags, like optional<T>.
-            io::type_traits<typename io::event_traits<Event>::argument_type>::unpack(unpacked, args);
+            io::type_traits<typename io::event_traits<Event>::argument_type>::unpack(message.args(), args);
         } catch(const msgpack::type_error& e) {
             throw std::system_error(error::invalid_argument, e.what());
         }
 
+        static const typename slot_type::meta_type empty;
+
+        // NOTE: Owned header copies are only made for the slots which actually want them.
+        const auto& headers = slot->forwards_headers() ? message.headers() : empty;
+
         // Call the slot with the upstream constrained with the event's upstream protocol type tag.
         return result_type((*slot)(headers, std::move(args), typename slot_type::upstream_type(upstream)));
     }
 
 private:
-    const std::vector<hpack::header_t>& headers;
-    const msgpack::object& unpacked;
+    const io::decoder_t::message_type& message;
     const io::upstream_ptr_t& upstream;
 };
 
@@ -250,8 +327,8 @@ struct composer<std::tuple<>, Event, R> {
     template<typename Dispatch, typename F>
     static
     auto
-    apply(Dispatch& dispatch, F fn, std::tuple<>) -> void {
-        dispatch.template on<Event>(std::make_shared<slot_type>(std::move(fn)));
+    apply(Dispatch& dispatch, F fn, std::tuple<>, api::executor_t* executor) -> void {
+        dispatch.template on<Event>(offload<Event>(std::make_shared<slot_type>(std::move(fn)), executor));
     }
 };
 
@@ -260,7 +337,7 @@ struct composer<std::tuple<H, T...>, Event, R> {
     template<typename Dispatch, typename F>
     static
     auto
-    apply(Dispatch& dispatch, F fn, std::tuple<H, T...> middlewares) -> void {
+    apply(Dispatch& dispatch, F fn, std::tuple<H, T...> middlewares, api::executor_t* executor) -> void {
         auto composed = make_composed<F, Event, R>(
             std::move(std::get<0>(middlewares)),
             std::move(fn)
@@ -269,7 +346,8 @@ struct composer<std::tuple<H, T...>, Event, R> {
         composer<std::tuple<T...>, Event, R>::apply(
             dispatch,
             std::move(composed),
-            tuple::pop_front(std::move(middlewares))
+            tuple::pop_front(std::move(middlewares)),
+            executor
         );
     }
 };
@@ -284,6 +362,9 @@ struct slot_builder<Event, std::tuple<M...>> {
     cocaine::dispatch<tag_type>& dispatch;
     std::tuple<M...> middlewares;
 
+    // Executor to run the event handler on if it's blocking, null to run it on the I/O thread.
+    api::executor_t* executor;
+
     /// Specifies a new middleware, that will be called both before any further registered
     /// middlewares and event handlers.
     ///
@@ -292,7 +373,14 @@ struct slot_builder<Event, std::tuple<M...>> {
     template<typename T>
     auto
     with_middleware(T middleware) && -> slot_builder<Event, std::tuple<T, M...>> {
-        return {dispatch, std::tuple_cat(std::make_tuple(middleware), middlewares)};
+        return {dispatch, std::tuple_cat(std::make_tuple(middleware), middlewares), executor};
+    }
+
+    /// Runs the event handler on the given executor, if it's blocking, so that it doesn't stall the
+    /// I/O thread. Overrides the dispatch-wide setting, see dispatch::offload().
+    auto
+    offload(api::executor_t& executor) && -> slot_builder {
+        return {dispatch, std::move(middlewares), &executor};
     }
 
     /// Consumes this builder, setting the event handler.
@@ -304,7 +392,8 @@ struct slot_builder<Event, std::tuple<M...>> {
         aux::composer<std::tuple<M...>, Event, typename result_of<F>::type>::apply(
             dispatch,
             std::move(fn),
-            std::move(middlewares)
+            std::move(middlewares),
+            executor
         );
     }
 };
@@ -319,7 +408,7 @@ dispatch<Tag>::on(F&& fn, typename boost::disable_if<is_slot<F, Event>>::type*)
         std::false_type
     >::type slot_type;
 
-    return on<Event>(std::make_shared<slot_type>(std::forward<F>(fn)));
+    return on<Event>(aux::offload<Event>(std::make_shared<slot_type>(std::forward<F>(fn)), m_executor));
 }
 
 template<class Tag>
@@ -328,9 +417,15 @@ dispatch<Tag>&
 dispatch<Tag>::on(const std::shared_ptr<io::basic_slot<Event>>& ptr) {
     typedef io::event_traits<Event> traits;
 
-    if(!m_slots->insert(std::make_pair(traits::id, ptr)).second) {
-        throw std::system_error(error::duplicate_slot, Event::alias());
-    }
+    update([&](slot_table_t& table) {
+        auto& slot = table[index_of(traits::id)];
+
+        if(slot) {
+            throw std::system_error(error::duplicate_slot, Event::alias());
+        }
+
+        slot = slot_variant_t(ptr);
+    });
 
     return *this;
 }
@@ -339,53 +434,89 @@ template<class Tag>
 template<class Event>
 slot_builder<Event>
 dispatch<Tag>::on() {
-    return slot_builder<Event>{*this, std::make_tuple()};
+    return slot_builder<Event>{*this, std::make_tuple(), m_executor};
+}
+
+template<class Tag>
+void
+dispatch<Tag>::offload(api::executor_t& executor) {
+    m_executor = &executor;
 }
 
 template<class Tag>
 template<class Event>
 void
 dispatch<Tag>::drop() {
-    if(!m_slots->erase(io::event_traits<Event>::id)) {
-        throw std::system_error(error::slot_not_found, Event::alias());
-    }
+    update([](slot_table_t& table) {
+        auto& slot = table[index_of(io::event_traits<Event>::id)];
+
+        if(!slot) {
+            throw std::system_error(error::slot_not_found, Event::alias());
+        }
+
+        slot = boost::none;
+    });
 }
 
 template<class Tag>
 void
 dispatch<Tag>::halt() {
-    m_slots->clear();
+    update([](slot_table_t& table) {
+        table = slot_table_t();
+    });
+}
+
+template<class Tag>
+template<class F>
+void
+dispatch<Tag>::update(F&& modify) {
+    // NOTE: Declared first, so that the reclaimed tables and their slots are destroyed after unlocking.
+    std::vector<std::unique_ptr<const slot_table_t>> reclaimed;
+
+    m_tables.apply([&](std::vector<std::unique_ptr<const slot_table_t>>& tables) {
+        std::unique_ptr<slot_table_t> table(tables.empty() ?
+            new slot_table_t() : new slot_table_t(*tables.back()));
+
+        modify(*table);
+
+        tables.push_back(std::move(table));
+
+        m_slots.store(tables.back().get(), std::memory_order_seq_cst);
+
+        // Messages processed from now on only see the new table, so none of the older ones are used
+        // once no message is being processed.
+        if(processing.load(std::memory_order_seq_cst) == 0) {
+            auto current = std::move(tables.back());
+
+            tables.pop_back();
+            tables.swap(reclaimed);
+            tables.push_back(std::move(current));
+        }
+    });
 }
 
 template<class Tag>
 boost::optional<io::dispatch_ptr_t>
 dispatch<Tag>::process(const io::decoder_t::message_type& message, const io::upstream_ptr_t& upstream) {
-    return process(message.type(), aux::calling_visitor_t(message.headers(), message.args(), upstream));
+    return process(message.type(), aux::calling_visitor_t(message, upstream));
 }
 
 template<class Tag>
 template<class Visitor>
 typename Visitor::result_type
 dispatch<Tag>::process(int id, const Visitor& visitor) {
-    typedef typename slot_map_t::mapped_type slot_ptr_type;
+    processing_scope_t scope;
 
-    const auto slot = m_slots.apply([&](const slot_map_t& mapping) -> slot_ptr_type {
-        typename slot_map_t::const_iterator lb, ub;
+    const slot_table_t& table = *m_slots.load(std::memory_order_seq_cst);
+    const std::size_t index = index_of(id);
 
-        // NOTE: Using equal_range() here, instead of find() to check for slot existence and get the
-        // slot pointer in one call instead of two.
-        std::tie(lb, ub) = mapping.equal_range(id);
-
-        if(lb != ub) {
-            // NOTE: The slot pointer is copied here, allowing the handling code to unregister slots
-            // via dispatch<T>::forget() without pulling the object from underneath itself.
-            return lb->second;
-        } else {
-            throw std::system_error(error::slot_not_found);
-        }
-    });
+    if(id < 0 || index >= table.size() || !table[index]) {
+        throw std::system_error(error::slot_not_found);
+    }
 
-    return boost::apply_visitor(visitor, slot);
+    // NOTE: The slot isn't copied, since the table is retained even if the handling code drops it via
+    // dispatch<T>::drop() while the message is being processed.
+    return boost::apply_visitor(visitor, *table[index]);
 }
 
 } // namespace cocaine
@@ -108,6 +108,34 @@ public:
         }
     }
 
+    /// Same as append(), but the message is subject to the channel's flow control, so it's rejected
+    /// if the peer hasn't granted enough credit for it. Messages queued before the upstream is
+    /// attached are not accounted.
+    template<class Event, class... Args>
+    std::error_code
+    append_credited(hpack::header_storage_t headers, Args&&... args) {
+        static_assert(std::is_same<typename Event::tag, Tag>::value,
+                      "message protocol is not compatible with this message queue");
+
+        if(!m_upstream) {
+            m_operations.emplace_back(std::move(headers), make_frozen<Event>(std::forward<Args>(args)...));
+            return {};
+        }
+
+        try {
+            return m_upstream->template send_credited<Event>(std::move(headers), std::forward<Args>(args)...);
+        } catch (const std::system_error& e) {
+            return e.code();
+        }
+    }
+
+    /// Keeps the handler to be called once the exhausted flow control window is replenished, see
+    /// basic_upstream_t::wait_window().
+    bool
+    wait_window(std::function<void()> handler) {
+        return m_upstream && m_upstream->wait_window(std::move(handler));
+    }
+
     /// This one can throw to propagate exception to session,
     /// as we mainly attach the queue in invocation slot.
     template<class OtherTag>
@@ -21,35 +21,50 @@
 #ifndef COCAINE_IO_SESSION_HPP
 #define COCAINE_IO_SESSION_HPP
 
+#include <asio/deadline_timer.hpp>
 #include <asio/generic/stream_protocol.hpp>
 
 #include "cocaine/common.hpp"
 #include "cocaine/locked_ptr.hpp"
 #include "cocaine/rpc/asio/decoder.hpp"
 #include "cocaine/rpc/asio/encoder.hpp"
+#include "cocaine/rpc/channel_table.hpp"
+#include "cocaine/trace/trace.hpp"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 namespace cocaine {
 
 class session_t:
     public std::enable_shared_from_this<session_t>
 {
+    friend class io::basic_upstream_t;
+
     typedef asio::generic::stream_protocol protocol_type;
     typedef protocol_type::endpoint endpoint_type;
 
     typedef io::transport<protocol_type> transport_type;
 
     class pull_action_t;
-    class push_action_t;
+    class ping_action_t;
 
     struct channel_t;
 
-    typedef std::map<uint64_t, std::shared_ptr<channel_t>> channel_map_t;
+    typedef io::channel_table<std::shared_ptr<channel_t>> channel_map_t;
+    typedef io::channel_table<std::weak_ptr<io::basic_upstream_t>> window_map_t;
 
     // Log of last resort.
     const std::unique_ptr<logging::logger_t> log;
 
+    // Shared by all the sessions of the same service.
     struct metrics_t;
-    std::unique_ptr<metrics_t> metrics;
+    std::shared_ptr<metrics_t> metrics;
+
+    struct pings_t;
+    std::unique_ptr<pings_t> pings;
 
     // The underlying connection.
 #if defined(__clang__)
@@ -58,18 +73,59 @@ class session_t:
     synchronized<std::shared_ptr<transport_type>> transport;
 #endif
 
+    // Messages pushed from any thread which are yet to be written on the transport's reactor, each in
+    // the trace it was pushed in. Only the push which finds the queue empty schedules the write, and
+    // the queue is swapped with a spare one on the reactor, so that both keep their capacity and
+    // pushing doesn't allocate anything once the session warms up.
+    struct outgoing_t {
+        trace_t trace;
+        io::encoder_t::message_type message;
+    };
+
+    synchronized<std::vector<outgoing_t>> outbox;
+    std::vector<outgoing_t> outbox_spare;
+
     // Initial dispatch. Internally synchronized.
     const io::dispatch_ptr_t prototype;
     io::dispatch_ptr_t service_dispatch;
 
-    // Virtual channels.
+    // Virtual channels. They're only ever modified on the transport's reactor, under the lock, so the
+    // reactor itself looks them up without locking, while other threads must hold the lock to read.
     synchronized<channel_map_t> channels;
 
+    // Flow controlled upstreams, which outlive their channels as long as the services use them, so
+    // the peer's window updates are routed to them separately. Upstreams might be created and
+    // destroyed on any thread.
+    synchronized<window_map_t> windows;
+
     // The maximum channel id processed by the session. Checking whether channel id is always higher
     // than the previous channel id is similar to an infinite TIME_WAIT timeout for TCP sockets. It
     // might be not the best approach, but since we have 2^64 possible channel ids, and not 2^16 TCP
     // ports available to us, it's good enough.
-    uint64_t max_channel_id;
+    std::atomic<std::uint64_t> max_channel_id;
+
+    // Only one in `sampling` invocations is timed. The invocations are counted on the reactor.
+    size_t sampling;
+    std::uint64_t invocations;
+
+    // Flow control window granted by the peer for every new channel, zero if it's disabled.
+    std::atomic<std::uint64_t> initial_window_size;
+
+    // Flow control window granted to the peer for every channel, zero if the peer is not limited.
+    std::uint64_t granted_window_size;
+
+    // Whether the session doesn't accept new channels from the peer, and whether the peer doesn't
+    // accept new channels from the session, after sending and receiving a goaway respectively.
+    std::atomic<bool> draining;
+    std::atomic<bool> peer_draining;
+
+    // The last channel the peer has tried to open after the session started draining, which has been
+    // revoked right away. Only used on the transport's reactor.
+    std::uint64_t refused_channel_id;
+
+    // Detaches the draining session once it runs out of time. Only used on the transport's reactor,
+    // and destroyed as soon as the session is detached, since it must not outlive the reactor.
+    std::unique_ptr<asio::deadline_timer> deadline;
 
 public:
     session_t(std::unique_ptr<logging::logger_t> log,
@@ -84,6 +140,20 @@ public:
     auto
     active_channels() const -> std::map<uint64_t, std::string>;
 
+    std::size_t
+    active_channels_count() const;
+
+    // Flow control window for new channels as negotiated with the peer. Zero means that the peer
+    // doesn't do flow control, so the channels are not limited.
+    auto
+    initial_window() const -> std::uint64_t;
+
+    // Whether the session has been detached from its transport, i.e. the connection is closed.
+    bool
+    is_detached() const;
+
+    // Memory actually held by the underlying transport buffers. Might be zero for idle sessions if
+    // read buffers are lazy.
     std::size_t
     memory_pressure() const;
 
@@ -98,12 +168,47 @@ public:
     auto
     fork(const io::dispatch_ptr_t& dispatch) -> io::upstream_ptr_t;
 
+    // Starts handling incoming messages, up to the given number of already received messages per
+    // wakeup before giving other sessions on the same reactor a chance to run.
+    void
+    pull(size_t budget = 1);
+
+    // Stops pulling new messages while more than `high` bytes are queued for writing, until the queue
+    // drains down to `low` bytes. Zero high watermark disables the limit. Must be set before pulling.
+    void
+    throttle(size_t high, size_t low);
+
+    // Times only one in every `rate` invocations. Must be set before pulling.
+    void
+    sample(size_t rate);
+
+    // Grants the peer a flow control window of the given size for every channel, zero disables flow
+    // control. The window is announced along with the other settings and replenished with window
+    // updates as messages are handled. Must be set before pulling.
     void
-    pull();
+    grant(std::uint64_t window);
 
     void
     push(io::encoder_t::message_type&& message);
 
+    // Sends the local connection settings to the peer on the channel zero. The side which establishes
+    // the connection is expected to announce its settings right away, and the peer answers with its
+    // own ones, so that both sides find out what the other supports.
+    void
+    announce();
+
+    // Starts sending pings to the peer on the channel zero every interval, measuring round-trip times,
+    // and detaches the session once it has sent `misses` pings in a row which are left unanswered.
+    void
+    keepalive(boost::posix_time::time_duration interval, size_t misses);
+
+    // Gracefully shuts the session down. The peer is asked not to open new channels via the goaway
+    // control message, and the session detaches once all the active channels are revoked and their
+    // messages are sent, or once the timeout expires, whichever comes first. Must be called on the
+    // transport's reactor.
+    void
+    drain(const std::error_code& ec, boost::posix_time::time_duration timeout);
+
     // NOTE: Detaching a session destroys the connection but not necessarily the session itself, as
     // it might be still in use by shared upstreams even in other threads. In other words, this does
     // not guarantee that the session will be actually deleted, but it's fine, since the connection
@@ -112,16 +217,44 @@ public:
     void
     detach(const std::error_code& ec);
 
+    // Publishes the per-service metrics accumulated by all the sessions since the last time. Load and
+    // request counters are updated per thread and are only added up here, so it has to be called
+    // periodically.
+    static
+    void
+    publish_metrics();
+
 private:
     void
     handle(const io::decoder_t::message_type& message);
 
+    // Writes out everything pushed so far. Called on the transport's reactor.
+    void
+    flush(const std::shared_ptr<transport_type>& ptr);
+
+    void
+    pushed(const std::error_code& ec);
+
     auto
     extract_trace(const io::decoder_t::message_type& message) const -> boost::optional<trace_t>;
 
     auto
     select_dispatch(const io::decoder_t::message_type& message) const -> io::dispatch_ptr_t;
 
+    typedef std::map<std::string, std::uint64_t> settings_type;
+
+    // Local connection settings, announced to the peer or sent in reply to the peer's ones.
+    auto
+    settings() const -> settings_type;
+
+    // Applies the peer's connection settings, returning the local ones as an acknowledgement.
+    auto
+    negotiate(const settings_type& settings) -> settings_type;
+
+    // Applies the peer's acknowledgement of the announced settings.
+    void
+    acknowledge(const io::decoder_t::message_type& message);
+
     // NOTE: The revocation happens to channel id only, not the upstream itself. It means that while
     // some channel might be revoked during message handling, it only prohibit new incoming messages
     // from being processed, but shared upstreams still can be used by services to send new outgoing
@@ -130,6 +263,30 @@ private:
     void
     revoke(uint64_t id);
 
+    // Grants more flow control credit to the channel's upstream.
+    void
+    replenish(uint64_t id, std::uint64_t increment);
+
+    // Keeps track of the upstream's flow control window, if it has one, until the upstream is gone.
+    void
+    enroll(const io::upstream_ptr_t& upstream);
+
+    // Called by flow controlled upstreams once they're destroyed.
+    void
+    withdraw(uint64_t id);
+
+    // Detaches the drained session once all its outgoing messages are sent.
+    void
+    close();
+
+    // Discards the dispatches of all the channels. Must be called on the transport's reactor.
+    void
+    discard(const std::error_code& ec);
+
+    // Accounts the peer's reply to the oldest unanswered keepalive ping, if the message is one.
+    void
+    pong(uint64_t type);
+
     void
     revoke(uint64_t id, std::error_code ec);
 };
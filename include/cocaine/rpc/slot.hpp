@@ -53,6 +53,14 @@ public:
     virtual
     boost::optional<std::shared_ptr<dispatch_type>>
     operator()(const meta_type& meta, tuple_type&& args, upstream_type&& upstream) = 0;
+
+    // Whether the slot looks at the message headers at all. Slots which don't are given an empty
+    // header list, so that the decoded headers are never copied for them.
+    virtual
+    bool
+    forwards_headers() const {
+        return true;
+    }
 };
 
 template<class Event>
@@ -129,6 +129,12 @@ struct function_slot:
         callable(std::move(callable_))
     {}
 
+    virtual
+    bool
+    forwards_headers() const {
+        return ForwardMeta::value;
+    }
+
     R
     call(const std::vector<hpack::header_t>& meta, tuple_type&& args) const {
         return aux::call_helper<R, ForwardMeta>::apply(callable, meta, std::move(args));
@@ -0,0 +1,125 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COCAINE_IO_OFFLOADED_SLOT_HPP
+#define COCAINE_IO_OFFLOADED_SLOT_HPP
+
+#include "cocaine/api/executor.hpp"
+#include "cocaine/rpc/slot/blocking.hpp"
+#include "cocaine/trace/trace.hpp"
+
+#include <boost/optional/optional.hpp>
+
+namespace cocaine { namespace io {
+
+// Runs a blocking slot on the given executor instead of the session's I/O thread, so that slow
+// handlers don't stall every other connection of the same execution unit. The reply is sent via the
+// upstream as usual, which marshals it back to the session's reactor. The slot runs in the trace of
+// the invocation, just like it would on the I/O thread.
+
+template<class Event, class Slot>
+struct offloaded_slot:
+    public basic_slot<Event>
+{
+    typedef basic_slot<Event> parent_type;
+
+    typedef typename parent_type::dispatch_type dispatch_type;
+    typedef typename parent_type::meta_type     meta_type;
+    typedef typename parent_type::tuple_type    tuple_type;
+    typedef typename parent_type::upstream_type upstream_type;
+
+    offloaded_slot(std::shared_ptr<Slot> slot_, api::executor_t& executor_):
+        slot(std::move(slot_)),
+        executor(executor_)
+    { }
+
+    virtual
+    boost::optional<std::shared_ptr<dispatch_type>>
+    operator()(const meta_type& headers, tuple_type&& args, upstream_type&& upstream) {
+        // NOTE: The upstream copy is kept to report the rejection, in case the executor is overloaded.
+        upstream_type reply = upstream;
+
+        try {
+            executor.spawn(task_t{slot, headers, std::move(args), std::move(upstream), trace_t::current()});
+        } catch(const std::system_error& e) {
+            reject(reply, e, std::is_same<typename event_traits<Event>::upstream_type, void>());
+        }
+
+        if(is_recursed<Event>::value) {
+            return boost::none;
+        } else {
+            return boost::make_optional<std::shared_ptr<dispatch_type>>(nullptr);
+        }
+    }
+
+    virtual
+    bool
+    forwards_headers() const {
+        return slot->forwards_headers();
+    }
+
+private:
+    struct task_t {
+        std::shared_ptr<Slot> slot;
+
+        // Headers are owned by the message, which is gone by the time the task is running.
+        meta_type   headers;
+        tuple_type  args;
+        upstream_type upstream;
+
+        // Worker threads know nothing about the trace the slot has been invoked in.
+        trace_t trace;
+
+        void
+        operator()() {
+            trace_t::restore_scope_t scope(trace);
+
+            try {
+                (*slot)(headers, std::move(args), std::move(upstream));
+            } catch(...) {
+                // Blocking slots report their errors to the client themselves, except for the mute
+                // ones, and there's nowhere to propagate them to from a worker thread.
+            }
+        }
+    };
+
+    static
+    void
+    reject(upstream_type& upstream, const std::system_error& e, std::false_type) {
+        typedef typename Slot::protocol protocol;
+        upstream.template send<typename protocol::error>(e.code(), std::string(e.what()));
+    }
+
+    static
+    void
+    reject(upstream_type&, const std::system_error&, std::true_type) {
+        // Mute slots have nowhere to report the error, so it's handled the same way as if the slot
+        // itself has failed.
+        throw;
+    }
+
+private:
+    const std::shared_ptr<Slot> slot;
+    api::executor_t& executor;
+};
+
+}} // namespace cocaine::io
+
+#endif
@@ -52,7 +52,10 @@ struct streamed {
             return make_error_code(error::protocol_errors::closed_upstream);
         }
 
-        return d->outbox.template append<chunk_type>(std::move(headers), std::forward<Args>(args)...);
+        // NOTE: Returns error::window_exhausted if the peer has enabled flow control and hasn't
+        // granted enough credit for this chunk, in which case the producer should wait for it to be
+        // replenished via on_window() and try again.
+        return d->outbox.template append_credited<chunk_type>(std::move(headers), std::forward<Args>(args)...);
     }
 
     template<class... Args>
@@ -96,6 +99,19 @@ struct streamed {
         return close({});
     }
 
+    // Calls the handler once the stream is allowed to write more chunks, either right away or later
+    // from the session's thread, when the peer replenishes the flow control window.
+    void
+    on_window(std::function<void()> handler) {
+        const bool waiting = data->apply([&](data_t& data) {
+            return data.outbox.wait_window(handler);
+        });
+
+        if(!waiting) {
+            handler();
+        }
+    }
+
     template<class UpstreamType>
     void
     attach(UpstreamType&& upstream) {
@@ -21,9 +21,13 @@
 #ifndef COCAINE_IO_UPSTREAM_HPP
 #define COCAINE_IO_UPSTREAM_HPP
 
+#include "cocaine/errors.hpp"
+#include "cocaine/locked_ptr.hpp"
 #include "cocaine/rpc/session.hpp"
 #include "cocaine/trace/trace.hpp"
 
+#include <functional>
+
 namespace cocaine {
 
 template<class Tag> class upstream;
@@ -34,12 +38,34 @@ class basic_upstream_t {
     const std::shared_ptr<session_t> m_session;
     const uint64_t m_channel_id;
 
+    // Flow control window, granted by the peer in bytes of encoded messages.
+    struct window_t {
+        // Whether the peer has asked for flow control at all.
+        bool limited;
+        std::uint64_t credit;
+
+        // Whether some message didn't fit into the window since it was last replenished.
+        bool exhausted;
+
+        // Called once the exhausted window is replenished.
+        std::function<void()> handler;
+    };
+
+    synchronized<window_t> m_window;
+
 public:
     basic_upstream_t(const std::shared_ptr<session_t>& session, uint64_t channel_id):
         m_session(session),
-        m_channel_id(channel_id)
+        m_channel_id(channel_id),
+        m_window(window_t{session->initial_window() != 0, session->initial_window(), false, nullptr})
     { }
 
+   ~basic_upstream_t() {
+        if(flow_controlled()) {
+            m_session->withdraw(m_channel_id);
+        }
+    }
+
     uint64_t
     channel_id() const {
         return m_channel_id;
@@ -50,6 +76,13 @@ public:
         return m_session;
     }
 
+    /// Whether the peer limits the messages sent via this upstream with a flow control window.
+    bool
+    flow_controlled() const {
+        // NOTE: The flag never changes once the upstream is created.
+        return m_window.unsafe().limited;
+    }
+
     /// Detaches underlying session and closes connection.
     ///
     /// This will discard all active chanels and close connecton to client,
@@ -76,6 +109,64 @@ public:
     send(hpack::header_storage_t headers, Args&&... args) {
         send(encoded<Event>(m_channel_id, std::move(headers), std::forward<Args>(args)...));
     }
+
+    /// Sends the message only if it fits into the channel's flow control window.
+    template<class Event, class... Args>
+    std::error_code
+    send_credited(hpack::header_storage_t headers, Args&&... args) {
+        encoder_t::message_type message = encoded<Event>(m_channel_id, std::move(headers),
+            std::forward<Args>(args)...);
+
+        const bool granted = m_window.apply([&](window_t& window) {
+            const std::uint64_t size = message.body.size();
+
+            if(!window.limited) {
+                return true;
+            } else if(window.credit < size) {
+                window.exhausted = true;
+                return false;
+            }
+
+            window.credit -= size;
+            return true;
+        });
+
+        if(!granted) {
+            return make_error_code(error::protocol_errors::window_exhausted);
+        }
+
+        send(std::move(message));
+        return std::error_code();
+    }
+
+    /// Keeps the handler to be called once the exhausted flow control window is replenished by the
+    /// peer. Returns false, dropping the handler, if the window isn't exhausted. Only the last
+    /// handler is kept.
+    bool
+    wait_window(std::function<void()> handler) {
+        return m_window.apply([&](window_t& window) {
+            if(window.exhausted) {
+                window.handler = std::move(handler);
+            }
+
+            return window.exhausted;
+        });
+    }
+
+    void
+    replenish(std::uint64_t increment) {
+        std::function<void()> handler;
+
+        m_window.apply([&](window_t& window) {
+            window.credit += increment;
+            window.exhausted = false;
+            std::swap(handler, window.handler);
+        });
+
+        if(handler) {
+            handler();
+        }
+    }
 };
 
 // Forwards for the upstream<T> class
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <random>
+
+namespace cocaine {
+namespace utility {
+
+/// Power of two choices: picks two distinct elements at random and returns the one with the lower
+/// cost. Unlike always picking the least loaded element, it doesn't make everyone pile on the same
+/// element while the costs lag behind, but still keeps the maximum load exponentially closer to the
+/// average than picking just one element at random.
+template<class Iterator, class Cost, class Random>
+Iterator
+least_of_two(Iterator begin, Iterator end, Cost cost, Random& random) {
+    const auto size = static_cast<std::size_t>(std::distance(begin, end));
+
+    if(size < 2) {
+        return begin;
+    }
+
+    // The second one is picked out of the rest, so that both are distinct.
+    const auto lhs = std::uniform_int_distribution<std::size_t>(0, size - 1)(random);
+    const auto rhs = (lhs + 1 + std::uniform_int_distribution<std::size_t>(0, size - 2)(random)) % size;
+
+    const auto a = std::next(begin, lhs);
+    const auto b = std::next(begin, rhs);
+
+    return cost(*b) < cost(*a) ? b : a;
+}
+
+}  // namespace utility
+}  // namespace cocaine
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+namespace cocaine {
+namespace utility {
+
+/// Counter split into shards, each one occupying its own cache line, so that threads updating it
+/// concurrently don't bounce a single cache line between each other. Threads are mapped to shards
+/// by their ids, and the shards are only summed up when the counter is read. Updates and reads are
+/// relaxed unless stronger ordering is asked for, e.g. to use the counter for synchronization.
+class sharded_counter {
+    static constexpr unsigned int bits = 4;
+    static constexpr std::size_t shards = std::size_t(1) << bits;
+    static constexpr std::size_t cache_line = 64;
+
+    struct shard_t {
+        std::atomic<std::int64_t> value;
+        char padding[cache_line - sizeof(std::atomic<std::int64_t>)];
+    };
+
+    std::array<shard_t, shards> m_shards;
+
+public:
+    sharded_counter() {
+        for(auto& shard : m_shards) {
+            shard.value.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    sharded_counter(const sharded_counter&) = delete;
+    sharded_counter& operator=(const sharded_counter&) = delete;
+
+    void
+    add(std::int64_t delta, std::memory_order order = std::memory_order_relaxed) {
+        m_shards[current()].value.fetch_add(delta, order);
+    }
+
+    /// Sum of all the shards. Not a snapshot: concurrent updates might be partially accounted.
+    std::int64_t
+    load(std::memory_order order = std::memory_order_relaxed) const {
+        std::int64_t result = 0;
+
+        for(const auto& shard : m_shards) {
+            result += shard.value.load(order);
+        }
+
+        return result;
+    }
+
+private:
+    static
+    std::size_t
+    current() {
+        // Thread ids are usually addresses of some aligned per-thread structures, so their low bits
+        // are mostly the same. Fibonacci hashing mixes the high bits in.
+        const std::uint64_t id = std::hash<std::thread::id>()(std::this_thread::get_id());
+        return static_cast<std::size_t>((id * 0x9E3779B97F4A7C15ull) >> (64 - bits));
+    }
+};
+
+}  // namespace utility
+}  // namespace cocaine
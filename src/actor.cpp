@@ -39,6 +39,8 @@
 
 #include <metrics/registry.hpp>
 
+#include <unistd.h>
+
 #include "chamber.hpp"
 
 using namespace cocaine;
@@ -77,7 +79,11 @@ private:
     context_t& context;
     // Reference to an event loop tasks are running on.
     asio::io_service& loop;
-    socket_type socket;
+    // Execution unit this acceptor belongs to, if the port is shared between the execution units.
+    execution_unit_t* const owner;
+    // Socket to accept the next connection into. It's bound to the owner's reactor right away, or to
+    // the acceptor's one otherwise, since the execution unit is chosen only once a client arrives.
+    std::unique_ptr<socket_type> socket;
     std::unique_ptr<acceptor_type> acceptor;
     endpoint_type m_local_endpoint;
     io::dispatch_ptr_t prototype;
@@ -85,10 +91,11 @@ private:
     std::unique_ptr<logging::logger_t> log;
 
 public:
-    accept_action_t(parent_type& parent, std::unique_ptr<acceptor_type> acceptor):
+    accept_action_t(parent_type& parent, std::unique_ptr<acceptor_type> acceptor,
+                    execution_unit_t* owner):
         context(parent.m_context),
         loop(acceptor->get_io_service()),
-        socket(loop),
+        owner(owner),
         acceptor(std::move(acceptor)),
         m_local_endpoint(this->acceptor->local_endpoint()),
         prototype(parent.m_prototype),
@@ -110,8 +117,10 @@ public:
 
     void
     run() {
+        socket = std::make_unique<socket_type>(owner ? owner->reactor() : loop);
+
         acceptor->async_accept(
-            socket,
+            *socket,
             std::bind(&accept_action_t::finalize, this->shared_from_this(), ph::_1)
         );
     }
@@ -119,9 +128,7 @@ public:
 private:
     void
     finalize(const std::error_code& ec) {
-        // Prepare the internal socket object for consequential operations by moving its contents
-        // to a heap-allocated object, which in turn might be attached to an engine.
-        auto ptr = std::make_unique<socket_type>(std::move(socket));
+        auto ptr = std::move(socket);
 
         switch(ec.value()) {
         case 0:
@@ -129,7 +136,12 @@ private:
             metrics.connections_accepted->fetch_add(1);
 
             try {
-                context.engine().attach(std::move(ptr), prototype);
+                // NOTE: The least loaded unit is chosen only once the connection is accepted, so that
+                // the choice is based on the load at the moment the client arrives, not when the
+                // previous one did.
+                auto& unit = owner ? *owner : context.engine();
+
+                unit.attach(adopt(std::move(ptr), unit.reactor()), prototype);
             } catch(const std::system_error& e) {
                 COCAINE_LOG_ERROR(log, "unable to attach connection to engine: {}",
                     error::to_string(e));
@@ -151,6 +163,30 @@ private:
         // Linux.
         run();
     }
+
+    // Moves the accepted socket into the execution unit's reactor. Unlike cloning it, which is what
+    // the execution unit would do otherwise, it doesn't cost an extra descriptor per connection.
+    static
+    std::unique_ptr<socket_type>
+    adopt(std::unique_ptr<socket_type> ptr, asio::io_service& reactor) {
+        if(&ptr->get_io_service() == &reactor) {
+            return ptr;
+        }
+
+        const auto protocol = ptr->local_endpoint().protocol();
+        const auto fd = ptr->release();
+
+        auto socket = std::make_unique<socket_type>(reactor);
+
+        std::error_code ec;
+
+        if(socket->assign(protocol, fd, ec)) {
+            ::close(fd);
+            throw std::system_error(ec, "unable to move client's socket into execution unit");
+        }
+
+        return socket;
+    }
 };
 
 // Actor
@@ -173,7 +209,7 @@ actor_base<Protocol>::~actor_base() = default;
 template<typename Protocol>
 bool
 actor_base<Protocol>::is_active() const {
-    return static_cast<bool>(*m_acceptor.synchronize());
+    return !m_acceptors->empty();
 }
 
 template<typename Protocol>
@@ -185,12 +221,23 @@ actor_base<Protocol>::prototype() const {
 template<typename Protocol>
 void
 actor_base<Protocol>::run() {
-    m_acceptor.apply([this](std::shared_ptr<accept_action_t>& action) {
+    m_acceptors.apply([this](std::vector<std::shared_ptr<accept_action_t>>& actions) {
         auto endpoint = make_endpoint();
 
-        std::unique_ptr<acceptor_type> acceptor;
+        // Either a single acceptor on the acceptor thread, or one per execution unit.
+        const auto units = shared() ? m_context.engines() : std::vector<execution_unit_t*>{nullptr};
+
+        std::vector<std::unique_ptr<acceptor_type>> acceptors;
         try {
-            acceptor = m_context.expose<Protocol>(endpoint);
+            for(auto unit : units) {
+                if(unit) {
+                    acceptors.push_back(m_context.expose<Protocol>(unit->reactor(), endpoint, true));
+                    // In case the port was chosen by the system, the rest have to share the same one.
+                    endpoint = acceptors.back()->local_endpoint();
+                } else {
+                    acceptors.push_back(m_context.expose<Protocol>(endpoint));
+                }
+            }
         } catch(const std::system_error& e) {
             COCAINE_LOG_ERROR(m_log, "unable to bind local endpoint {} for service: {}", endpoint, error::to_string(e));
             m_context.mapper().retain(m_prototype->name());
@@ -198,13 +245,17 @@ actor_base<Protocol>::run() {
         }
 
         std::error_code ec;
-        COCAINE_LOG_INFO(m_log, "exposing service on local endpoint {}", acceptor->local_endpoint(ec));
-
-        auto& loop = acceptor->get_io_service();
-        action = std::make_shared<accept_action_t>(*this, std::move(acceptor));
-        loop.post([=] {
-            action->run();
-        });
+        COCAINE_LOG_INFO(m_log, "exposing service on local endpoint {} with {:d} acceptor(s)",
+            acceptors.front()->local_endpoint(ec), acceptors.size());
+
+        for(size_t i = 0; i < acceptors.size(); ++i) {
+            auto& loop = acceptors[i]->get_io_service();
+            auto action = std::make_shared<accept_action_t>(*this, std::move(acceptors[i]), units[i]);
+            loop.post([=] {
+                action->run();
+            });
+            actions.push_back(std::move(action));
+        }
     });
 
     on_run();
@@ -213,13 +264,16 @@ actor_base<Protocol>::run() {
 template<typename Protocol>
 void
 actor_base<Protocol>::terminate() {
-    m_acceptor.apply([this](std::shared_ptr<accept_action_t>& action) {
-        const auto endpoint = action->local_endpoint();
+    m_acceptors.apply([this](std::vector<std::shared_ptr<accept_action_t>>& actions) {
+        const auto endpoint = actions.front()->local_endpoint();
 
         COCAINE_LOG_INFO(m_log, "removing service from local endpoint {}", endpoint);
 
-        action->cancel();
-        action = nullptr;
+        for(const auto& action : actions) {
+            action->cancel();
+        }
+
+        actions.clear();
     });
 
     on_terminate();
@@ -228,9 +282,9 @@ actor_base<Protocol>::terminate() {
 template<typename Protocol>
 auto
 actor_base<Protocol>::local_endpoint() const -> endpoint_type {
-    return m_acceptor.apply([&](const std::shared_ptr<accept_action_t>& action) {
-        if (action) {
-            return action->local_endpoint();
+    return m_acceptors.apply([&](const std::vector<std::shared_ptr<accept_action_t>>& actions) {
+        if (!actions.empty()) {
+            return actions.front()->local_endpoint();
         } else {
             throw std::system_error(std::make_error_code(std::errc::not_connected));
         }
@@ -312,6 +366,11 @@ tcp_actor_t::make_endpoint() const -> endpoint_type {
     }
 }
 
+auto
+tcp_actor_t::shared() const -> bool {
+    return context.config().network().reuse_port();
+}
+
 auto
 tcp_actor_t::on_terminate() -> void {
     // Mark this service's port as free.
@@ -0,0 +1,89 @@
+/*
+    Copyright (c) 2011-2016 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2016 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/rpc/asio/buffer_pool.hpp"
+
+using namespace cocaine::io;
+
+asio::io_service::id buffer_pool_t::id;
+
+buffer_pool_t::buffer_pool_t(asio::io_service& asio):
+    asio::io_service::service(asio),
+    m_lazy(false),
+    m_capacity(0)
+{ }
+
+void
+buffer_pool_t::configure(bool lazy, size_t capacity) {
+    m_lazy = lazy;
+    m_capacity = capacity;
+}
+
+bool
+buffer_pool_t::lazy() const {
+    return m_lazy;
+}
+
+size_t
+buffer_pool_t::retained() const {
+    return m_buffers->size() * kBufferSize;
+}
+
+auto
+buffer_pool_t::acquire() -> buffer_type {
+    buffer_type buffer;
+
+    m_buffers.apply([&](std::vector<buffer_type>& buffers) {
+        if(!buffers.empty()) {
+            buffer = std::move(buffers.back());
+            buffers.pop_back();
+        }
+    });
+
+    if(buffer.empty()) {
+        buffer.resize(kBufferSize);
+    }
+
+    return buffer;
+}
+
+void
+buffer_pool_t::release(buffer_type& buffer) {
+    buffer_type released;
+
+    // NOTE: Swapping to make sure the buffer is empty afterwards, no matter whether it's retained.
+    released.swap(buffer);
+
+    if(released.size() != kBufferSize) {
+        // Trim buffers that have grown to accomodate some large frame.
+        return;
+    }
+
+    m_buffers.apply([&](std::vector<buffer_type>& buffers) {
+        if(buffers.size() < m_capacity) {
+            buffers.push_back(std::move(released));
+        }
+    });
+}
+
+void
+buffer_pool_t::shutdown_service() {
+    m_buffers->clear();
+}
@@ -20,31 +20,143 @@
 
 #include "chamber.hpp"
 
+#include "cocaine/errors.hpp"
+#include "cocaine/format.hpp"
 #include "cocaine/memory.hpp"
 
+#include <boost/thread/tss.hpp>
+
+#include <metrics/accumulator/decaying/exponentially.hpp>
+#include <metrics/meter.hpp>
+#include <metrics/registry.hpp>
+#include <metrics/timer.hpp>
+
+#include <fstream>
 #include <iomanip>
 #include <sstream>
 
 #if defined(__linux__)
+    #include <linux/mempolicy.h>
+    #include <pthread.h>
+    #include <sched.h>
     #include <sys/prctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
 #elif defined(__APPLE__)
     #include <pthread.h>
 #endif
 
 #include <sys/resource.h>
 
+#include <time.h>
+
 using namespace cocaine::io;
 
+namespace {
+
+auto
+format_thread_id(boost::thread::native_handle_type handle) -> std::string {
+    std::ostringstream stream;
+
+    stream << std::hex << std::internal << std::showbase << std::setw(2) << std::setfill('0');
+    stream << handle;
+
+    return stream.str();
+}
+
+// The chamber running the calling thread, if any. Not owned.
+boost::thread_specific_ptr<chamber_t> current([](chamber_t*) { });
+
+#if defined(__linux__)
+
+auto
+make_cpuset(const std::vector<unsigned int>& cpus) -> cpu_set_t {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+
+    for(auto it = cpus.begin(); it != cpus.end(); ++it) {
+        CPU_SET(*it, &set);
+    }
+
+    return set;
+}
+
+// Scheduler statistics are only available if the kernel is built with scheduler debugging, which is
+// usually the case. Returns false otherwise.
+bool
+read_migrations(std::uint64_t& migrations) {
+    std::ifstream stream("/proc/thread-self/sched");
+    std::string line;
+
+    while(std::getline(stream, line)) {
+        if(line.compare(0, 16, "se.nr_migrations") != 0) {
+            continue;
+        }
+
+        std::istringstream(line.substr(line.find(':') + 1)) >> migrations;
+        return true;
+    }
+
+    return false;
+}
+
+#endif
+
+// CPU time consumed by the calling thread so far.
+auto
+thread_cpu_time() -> std::chrono::nanoseconds {
+    timespec ts;
+
+    if(::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return std::chrono::nanoseconds::zero();
+    }
+
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+} // namespace
+
 // Chamber internals
 
+struct chamber_t::metrics_t {
+    typedef metrics::timer<metrics::accumulator::decaying::exponentially_t> timer_type;
+
+    const std::string prefix;
+
+    // Time from posting a probe handler to its execution, sampled every kCollectionInterval seconds.
+    metrics::shared_metric<timer_type> lag;
+
+    metrics::shared_metric<metrics::meter_t> handlers;
+
+    // Share of the last kCollectionInterval seconds spent running handlers, in percent.
+    metrics::shared_metric<std::atomic<std::int64_t>> busy;
+
+    // Accumulated by the event loop between the snapshots.
+    std::uint64_t executed;
+    clock_type::duration running;
+    clock_type::duration waiting;
+
+    metrics_t(metrics::registry_t& metrics_hub, const std::string& prefix_):
+        prefix(prefix_),
+        lag(metrics_hub.timer<metrics::accumulator::decaying::exponentially_t>(
+            cocaine::format("{}.loop.lag", prefix))),
+        handlers(metrics_hub.meter(cocaine::format("{}.loop.handlers", prefix))),
+        busy(metrics_hub.counter<std::int64_t>(cocaine::format("{}.loop.busy", prefix))),
+        executed(0),
+        running(clock_type::duration::zero()),
+        waiting(clock_type::duration::zero())
+    { }
+};
+
 class chamber_t::named_runnable_t {
-    const std::string name;
-    const std::shared_ptr<asio::io_service>& asio;
+    chamber_t *const parent;
+    const std::vector<unsigned int> cpus;
 
 public:
-    named_runnable_t(const std::string& name_, const std::shared_ptr<asio::io_service>& asio_):
-        name(name_),
-        asio(asio_)
+    named_runnable_t(chamber_t *const parent_, const std::vector<unsigned int>& cpus_):
+        parent(parent_),
+        cpus(cpus_)
     { }
 
     void
@@ -53,6 +165,8 @@ public:
 
 void
 chamber_t::named_runnable_t::operator()() const {
+    const auto& name = parent->name;
+
 #if defined(__linux__)
     if(name.size() < 16) {
         ::prctl(PR_SET_NAME, name.c_str());
@@ -63,7 +177,21 @@ chamber_t::named_runnable_t::operator()() const {
     pthread_setname_np(name.c_str());
 #endif
 
-    asio->run();
+#if defined(__linux__)
+    if(!cpus.empty()) {
+        const auto set = make_cpuset(cpus);
+
+        // NOTE: The CPU set is checked against the allowed ones before the thread is started.
+        ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+
+        // Prefer the local NUMA node even if the whole process runs with some other memory policy,
+        // e.g. interleaved by numactl. The reactor's thread-local allocations, like encoder pools,
+        // and read buffers, which are touched for the first time while reading, come from there.
+        ::syscall(SYS_set_mempolicy, MPOL_PREFERRED, nullptr, 0);
+    }
+#endif
+
+    parent->run();
 }
 
 class chamber_t::stats_periodic_action_t:
@@ -126,6 +254,22 @@ chamber_t::stats_periodic_action_t::finalize(const std::error_code& ec) {
     // Store the snapshot for the next iteration.
     last_tick = this_tick;
 
+#if defined(__linux__)
+    const int cpu = ::sched_getcpu();
+    const int was = parent->last_cpu;
+
+    std::uint64_t migrations;
+
+    if(read_migrations(migrations)) {
+        parent->migrated = migrations;
+    } else if(was >= 0 && cpu != was) {
+        // Only the migrations observed between the snapshots are accounted then.
+        parent->migrated++;
+    }
+
+    parent->last_cpu = cpu;
+#endif
+
     // Sum up the user and system running time.
     timeradd(&tick_diff.ru_utime, &tick_diff.ru_stime, &real_time);
 
@@ -133,6 +277,26 @@ chamber_t::stats_periodic_action_t::finalize(const std::error_code& ec) {
         (real_time.tv_sec * 1e+6 + real_time.tv_usec) / interval.total_microseconds()
     );
 
+    auto& metrics = *parent->metrics;
+
+    metrics.handlers->mark(metrics.executed);
+
+    if(metrics.running + metrics.waiting > clock_type::duration::zero()) {
+        metrics.busy->store(metrics.running * 100 / (metrics.running + metrics.waiting));
+    }
+
+    metrics.executed = 0;
+    metrics.running  = clock_type::duration::zero();
+    metrics.waiting  = clock_type::duration::zero();
+
+    // The timer context records the time passed since now when the probe handler is destroyed right
+    // after its execution.
+    auto probe = std::make_shared<metrics_t::timer_type::context_t>(metrics.lag->context());
+
+    parent->asio->post([probe]() mutable {
+        probe.reset();
+    });
+
     operator()();
 }
 
@@ -140,12 +304,34 @@ chamber_t::stats_periodic_action_t::finalize(const std::error_code& ec) {
 
 namespace bpt = boost::posix_time;
 
-chamber_t::chamber_t(const std::string& name_, const std::shared_ptr<asio::io_service>& asio_):
+const unsigned int chamber_t::kSlowHandlerThreshold;
+
+chamber_t::chamber_t(const std::string& name_, const std::shared_ptr<asio::io_service>& asio_,
+                     metrics::registry_t& metrics_hub_, const std::vector<unsigned int>& cpus):
     name(name_),
     asio(asio_),
+    metrics_hub(metrics_hub_),
     cron(*asio_),
-    load_acc1(boost::accumulators::rolling_window_size = 60 / kCollectionInterval)
+    load_acc1(boost::accumulators::rolling_window_size = 60 / kCollectionInterval),
+    last_cpu(-1),
+    migrated(0)
 {
+#if defined(__linux__)
+    if(!cpus.empty()) {
+        cpu_set_t allowed;
+
+        if(::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            throw std::system_error(errno, std::system_category(), "unable to get the CPU affinity");
+        }
+
+        for(auto it = cpus.begin(); it != cpus.end(); ++it) {
+            if(*it >= CPU_SETSIZE || !CPU_ISSET(*it, &allowed)) {
+                throw cocaine::error_t("unable to pin '{}' thread to CPU {} - not available", name, *it);
+            }
+        }
+    }
+#endif
+
     asio->post(std::bind(&stats_periodic_action_t::operator(),
         std::make_shared<stats_periodic_action_t>(this, bpt::seconds(kCollectionInterval))
     ));
@@ -153,7 +339,7 @@ chamber_t::chamber_t(const std::string& name_, const std::shared_ptr<asio::io_se
     // Bootstrap the rolling mean to avoid showing NaNs to the first clients.
     (*load_acc1.synchronize())(0.0f);
 
-    thread = std::make_unique<boost::thread>(named_runnable_t(name, asio));
+    thread = std::make_unique<boost::thread>(named_runnable_t(this, cpus));
 }
 
 chamber_t::~chamber_t() {
@@ -169,10 +355,65 @@ chamber_t::~chamber_t() {
 
 std::string
 chamber_t::thread_id() const {
-    std::ostringstream stream;
+    return format_thread_id(thread->native_handle());
+}
 
-    stream << std::hex << std::internal << std::showbase << std::setw(2) << std::setfill('0');
-    stream << thread->native_handle();
+void
+chamber_t::account(const std::string& service, const std::string& slot, clock_type::duration elapsed) {
+    if(elapsed < std::chrono::milliseconds(kSlowHandlerThreshold)) {
+        return;
+    }
 
-    return stream.str();
+    chamber_t* chamber = current.get();
+
+    if(!chamber) {
+        return;
+    }
+
+    // NOTE: Histograms are looked up for every slow handler, which is fine as long as they are rare.
+    chamber->metrics_hub.timer<metrics::accumulator::decaying::exponentially_t>(
+        cocaine::format("{}.slow[{}.{}]", chamber->metrics->prefix, service, slot)
+    )->update(elapsed);
+}
+
+void
+chamber_t::run() {
+    // NOTE: The thread handle might not be stored yet, so the thread id is taken from within.
+    metrics = std::make_unique<metrics_t>(metrics_hub,
+        cocaine::format("core.chamber[{}:{}]", name, format_thread_id(::pthread_self())));
+
+    current.reset(this);
+
+    // The thread only goes off the CPU while the reactor waits for the next handler to become ready,
+    // so the CPU time consumed within run_one() is the time spent running handlers, and the rest of
+    // it is the time spent waiting. Handlers blocking the thread off the CPU are accounted as waiting
+    // then, but they show up in the slow handlers histogram anyway. The thread's CPU clock is only
+    // read about every millisecond, so that busy loops don't pay an extra syscall per handler.
+    const auto interval = std::chrono::milliseconds(1);
+
+    auto stamp = clock_type::now();
+    auto spent = thread_cpu_time();
+
+    // Stops once the reactor is either stopped or out of work.
+    while(asio->run_one() != 0) {
+        metrics->executed++;
+
+        const auto now = clock_type::now();
+
+        if(now - stamp < interval) {
+            continue;
+        }
+
+        const auto cpu = thread_cpu_time();
+        const auto elapsed = now - stamp;
+        const auto running = std::min<clock_type::duration>(cpu - spent, elapsed);
+
+        metrics->running += running;
+        metrics->waiting += elapsed - running;
+
+        stamp = now;
+        spent = cpu;
+    }
+
+    current.release();
 }
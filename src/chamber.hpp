@@ -32,17 +32,28 @@
 
 #include <boost/thread/thread.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <vector>
+
 namespace cocaine { namespace io {
 
 class chamber_t {
     class named_runnable_t;
     class stats_periodic_action_t;
+    struct metrics_t;
 
     static const unsigned int kCollectionInterval = 2;
 
     const std::string name;
     const std::shared_ptr<asio::io_service> asio;
 
+    metrics::registry_t& metrics_hub;
+
+    // Event loop metrics, published as "core.chamber[<name>:<thread id>].*". Only touched from within
+    // the thread, which is also where they are created, because the thread id isn't known before.
+    std::unique_ptr<metrics_t> metrics;
+
     // Takes resource usage snapshots every kCollectInterval seconds.
     asio::deadline_timer cron;
 
@@ -57,8 +68,22 @@ class chamber_t {
     // Rolling resource usage mean over last minute.
     synchronized<load_average_t> load_acc1;
 
+    // The CPU the thread was last seen running on, and the number of times it has been migrated
+    // between CPUs. Both are updated every kCollectionInterval seconds.
+    std::atomic<int> last_cpu;
+    std::atomic<std::uint64_t> migrated;
+
 public:
-    chamber_t(const std::string& name, const std::shared_ptr<asio::io_service>& asio);
+    typedef std::chrono::steady_clock clock_type;
+
+    // Handlers running longer than this are reported in the slow handlers histogram.
+    static const unsigned int kSlowHandlerThreshold = 10;
+
+    // Threads pinned to some CPUs also allocate their memory from the local NUMA node.
+    chamber_t(const std::string& name, const std::shared_ptr<asio::io_service>& asio,
+              metrics::registry_t& metrics_hub,
+              const std::vector<unsigned int>& cpus = std::vector<unsigned int>());
+
    ~chamber_t();
 
     auto
@@ -71,8 +96,31 @@ public:
         return boost::accumulators::rolling_mean(*load_acc1.synchronize());
     }
 
+    // Negative if unknown.
+    auto
+    cpu() const -> int {
+        return last_cpu;
+    }
+
+    auto
+    migrations() const -> std::uint64_t {
+        return migrated;
+    }
+
     std::string
     thread_id() const;
+
+    // Records a slow handler of the given service's slot in the histogram of the chamber running the
+    // calling thread, as "core.chamber[<name>:<thread id>].slow[<service>.<slot>]". No-op if called
+    // from some other thread or if the handler was fast enough.
+    static
+    void
+    account(const std::string& service, const std::string& slot, clock_type::duration elapsed);
+
+private:
+    // Runs the reactor's event loop, measuring the time spent in handlers and waiting for them.
+    void
+    run();
 };
 
 }} // namespace cocaine::io
@@ -28,16 +28,19 @@
 #include "cocaine/context/signal.hpp"
 #include "cocaine/detail/essentials.hpp"
 #include "cocaine/engine.hpp"
+#include "cocaine/executor/pool.hpp"
 #include "cocaine/format.hpp"
 #include "cocaine/idl/context.hpp"
 #include "cocaine/logging.hpp"
 #include "cocaine/rpc/actor.hpp"
 #include "cocaine/repository/service.hpp"
 #include "cocaine/trace/logger.hpp"
+#include "cocaine/utility/balance.hpp"
 #include "cocaine/format/vector.hpp"
 #include "cocaine/format/tuple.hpp"
 
 #include <boost/optional/optional.hpp>
+#include <boost/thread/tss.hpp>
 
 #include <blackhole/logger.hpp>
 #include <blackhole/scope/holder.hpp>
@@ -45,8 +48,11 @@
 
 #include <metrics/registry.hpp>
 
+#include <asio/deadline_timer.hpp>
+
 #include <deque>
 #include <exception>
+#include <random>
 
 #include "chamber.hpp"
 
@@ -74,6 +80,50 @@ struct match {
 
 using blackhole::scope::holder_t;
 
+namespace {
+
+// Publishes the utilization of a service thread in percents every second, on that thread itself, so
+// that the acceptor thread doesn't have to do it.
+class utilization_action_t:
+    public std::enable_shared_from_this<utilization_action_t>
+{
+    const io::chamber_t& chamber;
+    asio::deadline_timer timer;
+
+    const metrics::shared_metric<std::atomic<std::int64_t>> gauge;
+
+public:
+    utilization_action_t(const io::chamber_t& chamber_, metrics::registry_t& metrics_hub,
+                         const std::string& name):
+        chamber(chamber_),
+        timer(chamber_.get_io_service()),
+        gauge(metrics_hub.counter<std::int64_t>(cocaine::format("core.executor[{}].utilization", name)))
+    { }
+
+    void
+    operator()() {
+        timer.expires_from_now(boost::posix_time::seconds(1));
+        timer.async_wait(std::bind(&utilization_action_t::finalize,
+            shared_from_this(),
+            std::placeholders::_1
+        ));
+    }
+
+private:
+    void
+    finalize(const std::error_code& ec) {
+        if(ec == asio::error::operation_aborted) {
+            return;
+        }
+
+        gauge->store(static_cast<std::int64_t>(chamber.load_avg1() * 100));
+
+        operator()();
+    }
+};
+
+} // namespace
+
 class context_impl_t : public context_t {
     typedef std::deque<std::pair<std::string, std::unique_ptr<tcp_actor_t>>> service_list_t;
 
@@ -85,12 +135,19 @@ class context_impl_t : public context_t {
     // storages or isolates, have to be declared after this one.
     std::unique_ptr<api::repository_t> m_repository;
 
-    // An acceptor thread.
+    // An acceptor thread. It only accepts new connections, the services are run by their executors.
     std::unique_ptr<io::chamber_t> m_acceptor_thread;
 
+    // Threads running the services. The first ones are shared by the services, followed by the ones
+    // dedicated to some specific services.
+    std::vector<std::unique_ptr<io::chamber_t>> m_executors;
+
     // A pool of execution units - threads responsible for doing all the service invocations.
     std::vector<std::unique_ptr<execution_unit_t>> m_pool;
 
+    // A pool of worker threads for the blocking service invocations.
+    std::unique_ptr<executor::worker_pool_t> m_workers;
+
     // Services are stored as a vector of pairs to preserve the initialization order. Synchronized,
     // because services are allowed to start and stop other services during their lifetime.
     synchronized<service_list_t> m_services;
@@ -130,28 +187,54 @@ public:
         // Load the rest of plugins.
         m_repository->load(m_config->path().plugins());
 
-        m_acceptor_thread = std::make_unique<io::chamber_t>("acceptor", std::make_shared<io::io_service>());
+        const auto& affinity = m_config->network().affinity();
+
+        m_acceptor_thread = std::make_unique<io::chamber_t>("acceptor", std::make_shared<io::io_service>(),
+            m_metrics_registry, affinity.acceptor());
 
         // Spin up all the configured services, launch execution units.
         COCAINE_LOG_INFO(m_log, "starting {:d} execution unit(s)", m_config->network().pool());
 
         while (m_pool.size() != m_config->network().pool()) {
-            m_pool.emplace_back(std::make_unique<execution_unit_t>(*this));
+            if(affinity.units().empty()) {
+                m_pool.emplace_back(std::make_unique<execution_unit_t>(*this));
+            } else {
+                const auto& cpus = affinity.units()[m_pool.size() % affinity.units().size()];
+                m_pool.emplace_back(std::make_unique<execution_unit_t>(*this, cpus));
+            }
+        }
+
+        m_workers = std::make_unique<executor::worker_pool_t>(
+            m_config->network().workers(),
+            m_config->network().worker_queue(),
+            m_metrics_registry,
+            "core.workers"
+        );
+
+        const auto shared = m_config->network().service_pool();
+
+        while(m_executors.size() != shared) {
+            spawn_executor(format("services/{}", m_executors.size()));
         }
 
         COCAINE_LOG_INFO(m_log, "starting {:d} service(s)", m_config->services().size());
 
         try {
+            size_t index = 0;
+
             m_config->services().each([&](const std::string& name, const config_t::component_t& service) mutable {
                 const holder_t scoped(*m_log, {{"service", name}});
 
                 COCAINE_LOG_DEBUG(m_log, "starting service");
 
+                // Services are long-lived, so they're simply spread evenly across the shared threads.
+                auto& executor = service.dedicated() ? spawn_executor(name) : *m_executors[index++ % shared];
+
                 try {
                     insert(name, std::make_unique<tcp_actor_t>(*this, repository().get<api::service_t>(
                         service.type(),
                         *this,
-                        m_acceptor_thread->get_io_service(),
+                        executor.get_io_service(),
                         name,
                         service.args()
                     )));
@@ -299,6 +382,11 @@ public:
 
         service->terminate();
 
+        // Ask the connected clients to go elsewhere, letting them finish their current requests.
+        for(auto it = m_pool.begin(); it != m_pool.end(); ++it) {
+            (*it)->drain(name);
+        }
+
         COCAINE_LOG_DEBUG(m_log, "service has been stopped", {
             { "service", name }
         });
@@ -344,10 +432,42 @@ public:
     execution_unit_t&
     engine() override {
         typedef std::unique_ptr<execution_unit_t> unit_t;
-        auto comp = [](const unit_t& lhs, const unit_t& rhs) {
-            return lhs->utilization() < rhs->utilization();
+
+        if(m_config->network().balancer() == "utilization") {
+            auto comp = [](const unit_t& lhs, const unit_t& rhs) {
+                return lhs->utilization() < rhs->utilization();
+            };
+            return **std::min_element(m_pool.begin(), m_pool.end(), comp);
+        }
+
+        // Units are picked concurrently by the acceptor threads and by services attaching their own
+        // connections, so every thread gets its own random number generator.
+        static boost::thread_specific_ptr<std::minstd_rand> random;
+
+        if(!random.get()) {
+            random.reset(new std::minstd_rand(std::random_device()()));
+        }
+
+        auto cost = [](const unit_t& unit) {
+            return unit->pressure();
         };
-        return **std::min_element(m_pool.begin(), m_pool.end(), comp);
+        return **utility::least_of_two(m_pool.begin(), m_pool.end(), cost, *random);
+    }
+
+    auto
+    workers() -> api::executor_t& override {
+        return *m_workers;
+    }
+
+    auto
+    engines() -> std::vector<execution_unit_t*> override {
+        std::vector<execution_unit_t*> result;
+
+        for(const auto& unit : m_pool) {
+            result.push_back(unit.get());
+        }
+
+        return result;
     }
 
     void
@@ -372,24 +492,35 @@ public:
             }
         });
 
+        // Stop accepting new clients right away. Does not block, unlike the one in execution_unit_t's
+        // destructors.
+        m_acceptor_thread->get_io_service().stop();
+        m_acceptor_thread.reset();
+
+        // Drain the execution units first, while the service executors are still running, so that the
+        // requests which are still in flight get a chance to complete within the drain timeout.
+        COCAINE_LOG_INFO(m_log, "stopping {:d} execution unit(s)", m_pool.size());
+        m_pool.clear();
+
         // Do not wait for the service to finish all its stuff (like timers, etc). Graceful
         // termination happens only in engine chambers, because that's where client connections
         // are being handled.
-        m_acceptor_thread->get_io_service().stop();
+        for(auto it = m_executors.begin(); it != m_executors.end(); ++it) {
+            (*it)->get_io_service().stop();
+        }
 
-        // Does not block, unlike the one in execution_unit_t's destructors.
-        m_acceptor_thread.reset();
+        m_executors.clear();
 
         // There should be no outstanding services left. All the extra services spawned by others, like
         // app invocation services from the node service, should be dead by now.
         // TODO: Here's race by design. For example Node service listens `on_shutdown` signal, but
-        // its invocation occurs in the `m_acceptor_thread` thread and can be missed due to force
-        // I/O loop termination.
+        // its invocation occurs in the service executor threads and can be missed due to force I/O
+        // loop termination.
 
         // BOOST_ASSERT(m_services->empty());
 
-        COCAINE_LOG_INFO(m_log, "stopping {:d} execution unit(s)", m_pool.size());
-        m_pool.clear();
+        // Finish the offloaded invocations while the services are still alive.
+        m_workers.reset();
 
         // Destroy the service objects.
         actors.clear();
@@ -405,6 +536,20 @@ private:
         return m_acceptor_thread->get_io_service();
     }
 
+    auto
+    spawn_executor(const std::string& name) -> io::chamber_t& {
+        m_executors.push_back(std::make_unique<io::chamber_t>(name, std::make_shared<io::io_service>(),
+            m_metrics_registry, m_config->network().affinity().acceptor()));
+
+        auto& executor = *m_executors.back();
+
+        executor.get_io_service().post(std::bind(&utilization_action_t::operator(),
+            std::make_shared<utilization_action_t>(executor, m_metrics_registry, name)
+        ));
+
+        return executor;
+    }
+
     auto
     reset_logger_filter() -> void {
         auto config_severity = m_config->logging().severity();
@@ -415,6 +560,44 @@ private:
     }
 };
 
+namespace {
+
+// Not provided by Asio, because it's not portable.
+typedef asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+
+} // namespace
+
+template<typename Protocol>
+auto
+context_t::expose(asio::io_service& loop, typename Protocol::endpoint endpoint, bool shared)
+    -> std::unique_ptr<typename Protocol::acceptor>
+{
+    auto acceptor = std::make_unique<typename Protocol::acceptor>(loop);
+
+    acceptor->open(endpoint.protocol());
+    acceptor->set_option(typename Protocol::acceptor::reuse_address(true));
+
+    if(shared) {
+        acceptor->set_option(reuse_port(true));
+    }
+
+    acceptor->bind(endpoint);
+    acceptor->listen(config().network().backlog());
+
+    return acceptor;
+}
+
+template
+auto
+context_t::expose<asio::ip::tcp>(asio::io_service&, asio::ip::tcp::endpoint, bool)
+    -> std::unique_ptr<asio::ip::tcp::acceptor>;
+
+template
+auto
+context_t::expose<asio::local::stream_protocol>(asio::io_service&,
+    asio::local::stream_protocol::endpoint, bool)
+    -> std::unique_ptr<asio::local::stream_protocol::acceptor>;
+
 std::unique_ptr<context_t>
 make_context(std::unique_ptr<config_t> config, std::unique_ptr<logging::logger_t> log) {
     std::unique_ptr<logging::logger_t> repository_logger(new blackhole::wrapper_t(*log, {}));
@@ -27,9 +27,12 @@
 #include <asio/ip/host_name.hpp>
 #include <asio/ip/tcp.hpp>
 
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
 #include <boost/filesystem/convenience.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/filesystem/operations.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/optional/optional.hpp>
 #include <boost/thread/thread.hpp>
 
@@ -166,12 +169,86 @@ public:
             std::tuple<port_t, port_t> m_shared;
         };
 
+        struct affinity_t : public config_t::network_t::affinity_t {
+            virtual
+            const std::vector<cpuset_t>&
+            units() const {
+                return m_units;
+            }
+
+            virtual
+            const cpuset_t&
+            acceptor() const {
+                return m_acceptor;
+            }
+
+            affinity_t(const dynamic_t::object_t& source) {
+                auto units = source.at("units", dynamic_t::empty_array);
+                if(!units.is_array()) {
+                    throw cocaine::error_t("invalid configuration for \"affinity\" section - {}", boost::lexical_cast<std::string>(units));
+                }
+                for(const auto& cpus : units.as_array()) {
+                    m_units.push_back(parse(cpus));
+                }
+                m_acceptor = parse(source.at("acceptor", ""));
+            }
+
+            // Parses CPU lists like "0-3,8,10-11".
+            static
+            cpuset_t
+            parse(const dynamic_t& source) {
+                if(!source.is_string()) {
+                    throw cocaine::error_t("invalid CPU list - {}", boost::lexical_cast<std::string>(source));
+                }
+
+                std::vector<std::string> ranges;
+                boost::split(ranges, source.as_string(), boost::is_any_of(","));
+
+                cpuset_t cpus;
+                for(const auto& range : ranges) {
+                    if(range.empty()) {
+                        continue;
+                    }
+
+                    std::vector<std::string> bounds;
+                    boost::split(bounds, range, boost::is_any_of("-"));
+
+                    unsigned int first, last;
+                    try {
+                        first = boost::lexical_cast<unsigned int>(bounds.front());
+                        last  = boost::lexical_cast<unsigned int>(bounds.back());
+                    } catch(const boost::bad_lexical_cast&) {
+                        throw cocaine::error_t("invalid CPU list - {}", source.as_string());
+                    }
+
+                    if(bounds.size() > 2 || first > last) {
+                        throw cocaine::error_t("invalid CPU list - {}", source.as_string());
+                    }
+
+                    for(auto cpu = first; cpu <= last; ++cpu) {
+                        cpus.push_back(cpu);
+                    }
+                }
+
+                return cpus;
+            }
+
+            std::vector<cpuset_t> m_units;
+            cpuset_t m_acceptor;
+        };
+
         virtual
         const ports_t&
         ports() const {
             return m_ports;
         }
 
+        virtual
+        const affinity_t&
+        affinity() const {
+            return m_affinity;
+        }
+
         virtual
         const std::string&
         endpoint() const {
@@ -190,8 +267,111 @@ public:
             return m_pool;
         }
 
+        virtual
+        bool
+        lazy_buffers() const {
+            return m_lazy_buffers;
+        }
+
+        virtual
+        size_t
+        buffer_pool() const {
+            return m_buffer_pool;
+        }
+
+        virtual
+        const std::string&
+        backend() const {
+            return m_backend;
+        }
+
+        virtual
+        size_t
+        read_budget() const {
+            return m_read_budget;
+        }
+
+        virtual
+        size_t
+        high_watermark() const {
+            return m_high_watermark;
+        }
+
+        virtual
+        size_t
+        low_watermark() const {
+            return m_low_watermark;
+        }
+
+        virtual
+        size_t
+        initial_window() const {
+            return m_initial_window;
+        }
+
+        virtual
+        size_t
+        drain_timeout() const {
+            return m_drain_timeout;
+        }
+
+        virtual
+        size_t
+        ping_interval() const {
+            return m_ping_interval;
+        }
+
+        virtual
+        size_t
+        ping_misses() const {
+            return m_ping_misses;
+        }
+
+        virtual
+        size_t
+        timer_sampling() const {
+            return m_timer_sampling;
+        }
+
+        virtual
+        bool
+        reuse_port() const {
+            return m_reuse_port;
+        }
+
+        virtual
+        size_t
+        backlog() const {
+            return m_backlog;
+        }
+
+        virtual
+        const std::string&
+        balancer() const {
+            return m_balancer;
+        }
+
+        virtual
+        size_t
+        workers() const {
+            return m_workers;
+        }
+
+        virtual
+        size_t
+        worker_queue() const {
+            return m_worker_queue;
+        }
+
+        virtual
+        size_t
+        service_pool() const {
+            return m_service_pool;
+        }
+
         network_t(const dynamic_t::object_t& source) :
-            m_ports(source)
+            m_ports(source),
+            m_affinity(source.at("affinity", dynamic_t::empty_object).as_object())
         {
             m_endpoint = source.at("endpoint", defaults::endpoint).as_string();
 
@@ -215,12 +395,96 @@ public:
             if(m_pool <= 0) {
                 throw cocaine::error_t("network I/O pool size must be positive");
             }
+
+            m_lazy_buffers = source.at("lazy_buffers", false).as_bool();
+            m_buffer_pool  = source.at("buffer_pool", 256u).as_uint();
+            m_read_budget  = source.at("read_budget", 64u).as_uint();
+
+            if(m_read_budget <= 0) {
+                throw cocaine::error_t("network read budget must be positive");
+            }
+
+            m_backend = source.at("backend", "epoll").as_string();
+
+            if(m_backend != "epoll" && m_backend != "uring") {
+                throw cocaine::error_t("unknown network backend '{}'", m_backend);
+            }
+
+            m_high_watermark = source.at("high_watermark", 16u * 1024 * 1024).as_uint();
+            m_low_watermark  = source.at("low_watermark", 4u * 1024 * 1024).as_uint();
+
+            if(m_high_watermark == 0) {
+                // The write queues are unbounded, so the low watermark doesn't matter.
+                m_low_watermark = 0;
+            } else if(m_low_watermark > m_high_watermark) {
+                throw cocaine::error_t("network low watermark must not exceed the high watermark");
+            }
+
+            m_initial_window = source.at("initial_window", 0u).as_uint();
+            m_drain_timeout  = source.at("drain_timeout", 10u).as_uint();
+            m_ping_interval = source.at("ping_interval", 0u).as_uint();
+            m_ping_misses   = source.at("ping_misses", 3u).as_uint();
+
+            if(m_ping_misses <= 0) {
+                throw cocaine::error_t("network ping misses must be positive");
+            }
+
+            m_timer_sampling = source.at("timer_sampling", 1u).as_uint();
+
+            if(m_timer_sampling <= 0) {
+                throw cocaine::error_t("network timer sampling must be positive");
+            }
+
+            m_reuse_port = source.at("reuse_port", false).as_bool();
+            m_backlog    = source.at("backlog",
+                static_cast<unsigned int>(asio::socket_base::max_connections)).as_uint();
+
+            if(m_backlog <= 0) {
+                throw cocaine::error_t("network listen backlog must be positive");
+            }
+
+            m_balancer = source.at("balancer", "two-choices").as_string();
+
+            if(m_balancer != "two-choices" && m_balancer != "utilization") {
+                throw cocaine::error_t("unknown network balancer '{}'", m_balancer);
+            }
+
+            m_workers      = source.at("workers", boost::thread::hardware_concurrency()).as_uint();
+            m_worker_queue = source.at("worker_queue", 1024u).as_uint();
+
+            if(m_workers <= 0 || m_worker_queue <= 0) {
+                throw cocaine::error_t("worker pool size and queue capacity must be positive");
+            }
+
+            m_service_pool = source.at("service_pool", 1u).as_uint();
+
+            if(m_service_pool <= 0) {
+                throw cocaine::error_t("service pool size must be positive");
+            }
         }
 
         ports_t m_ports;
+        affinity_t m_affinity;
         std::string m_endpoint;
         std::string m_hostname;
         size_t m_pool;
+        bool m_lazy_buffers;
+        size_t m_buffer_pool;
+        std::string m_backend;
+        size_t m_read_budget;
+        size_t m_high_watermark;
+        size_t m_low_watermark;
+        size_t m_initial_window;
+        size_t m_drain_timeout;
+        size_t m_ping_interval;
+        size_t m_ping_misses;
+        size_t m_timer_sampling;
+        bool m_reuse_port;
+        size_t m_backlog;
+        std::string m_balancer;
+        size_t m_workers;
+        size_t m_worker_queue;
+        size_t m_service_pool;
     };
 
     struct logging_t : public config_t::logging_t {
@@ -274,15 +538,25 @@ public:
             return m_args;
         }
 
-        component_t() {}
+        virtual
+        bool
+        dedicated() const {
+            return m_dedicated;
+        }
+
+        component_t() :
+            m_dedicated(false)
+        {}
 
         component_t(const dynamic_t& source) :
             m_type(source.as_object().at("type", "unspecified").as_string()),
-            m_args(source.as_object().at("args", dynamic_t::empty_object))
+            m_args(source.as_object().at("args", dynamic_t::empty_object)),
+            m_dedicated(source.as_object().at("dedicated", false).as_bool())
         {}
 
         std::string m_type;
         dynamic_t   m_args;
+        bool        m_dedicated;
     };
 
     typedef std::map<std::string, component_t> component_map_t;
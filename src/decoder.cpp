@@ -34,6 +34,10 @@ namespace io {
 
 namespace aux {
 
+decoded_message_t::decoded_message_t():
+    length(0)
+{ }
+
 auto
 decoded_message_t::span() const -> uint64_t {
     return object.via.array.ptr[0].as<uint64_t>();
@@ -49,20 +53,194 @@ decoded_message_t::args() const -> const msgpack::object& {
     return object.via.array.ptr[2];
 }
 
+auto
+decoded_message_t::size() const -> size_t {
+    return length;
+}
+
+auto
+decoded_message_t::header_views() const -> const hpack::header_views_t& {
+    return views;
+}
+
 auto
 decoded_message_t::headers() const -> const hpack::headers_t& {
+    if(metadata.size() != views.size()) {
+        metadata.clear();
+        metadata.reserve(views.size());
+
+        for(const auto& view: views) {
+            metadata.push_back(view.materialize());
+        }
+    }
+
     return metadata;
 }
 
 void
 decoded_message_t::clear() {
+    length = 0;
+    views.clear();
+    pinned.clear();
     metadata.clear();
 }
 
+frame_scanner_t::frame_scanner_t() {
+    reset();
+}
+
+namespace {
+
+// Same as the default MSGPACK_EMBED_STACK_SIZE, deeper objects are rejected by the unpacker anyway.
+const size_t kMaxNestingDepth = 32;
+
+uint64_t
+load_big_endian(const unsigned char* data, size_t width) {
+    uint64_t value = 0;
+
+    for(size_t i = 0; i < width; ++i) {
+        value = (value << 8) | data[i];
+    }
+
+    return value;
+}
+
+} // namespace
+
+size_t
+frame_scanner_t::scan(const char* data, size_t size, std::error_code& ec) {
+    const auto bytes = reinterpret_cast<const unsigned char*>(data);
+
+    while(!stack.empty()) {
+        if(offset >= size) {
+            pending = offset + 1;
+            return 0;
+        }
+
+        const unsigned char tag = bytes[offset];
+
+        // Object header size, including the tag itself, raw payload size and the number of nested
+        // objects for containers. Variable-sized objects store their length prefix right after the
+        // tag byte, the width of the prefix is determined by the tag.
+        size_t header = 1, body = 0, width = 0;
+        uint64_t items = 0;
+
+        const bool container = (tag >= 0x80 && tag <= 0x9f) || (tag >= 0xdc && tag <= 0xdf);
+        const bool map = (tag >= 0x80 && tag <= 0x8f) || tag == 0xde || tag == 0xdf;
+
+        if(tag <= 0x7f || tag >= 0xe0) {
+            // Positive and negative fixints.
+        } else if(tag <= 0x9f) {
+            items = tag & 0x0f;
+        } else if(tag <= 0xbf) {
+            body = tag & 0x1f;
+        } else switch(tag) {
+        case 0xc0: case 0xc2: case 0xc3:
+            break;
+        case 0xc4: case 0xd9: width = 1; break;
+        case 0xc5: case 0xda: width = 2; break;
+        case 0xc6: case 0xdb: width = 4; break;
+        // Extension types have one more byte for the type after the length prefix.
+        case 0xc7: header = 2; width = 1; break;
+        case 0xc8: header = 2; width = 2; break;
+        case 0xc9: header = 2; width = 4; break;
+        case 0xcc: case 0xd0: header = 2; break;
+        case 0xcd: case 0xd1: header = 3; break;
+        case 0xca: case 0xce: case 0xd2: header = 5; break;
+        case 0xcb: case 0xcf: case 0xd3: header = 9; break;
+        case 0xd4: header = 3; break;
+        case 0xd5: header = 4; break;
+        case 0xd6: header = 6; break;
+        case 0xd7: header = 10; break;
+        case 0xd8: header = 18; break;
+        case 0xdc: case 0xde: width = 2; break;
+        case 0xdd: case 0xdf: width = 4; break;
+        default:
+            ec = error::parse_error;
+            return 0;
+        }
+
+        header += width;
+
+        if(size - offset < header) {
+            pending = offset + header;
+            return 0;
+        }
+
+        if(width) {
+            const auto length = load_big_endian(bytes + offset + 1, width);
+
+            if(container) {
+                items = length;
+            } else {
+                body = length;
+            }
+        }
+
+        if(map) {
+            // Every map entry is a pair of objects.
+            items *= 2;
+        }
+
+        if(size - offset - header < body) {
+            // NOTE: Raw payloads are never inspected, so waiting for a large body to arrive costs
+            // only a couple of comparisons per wakeup.
+            pending = offset + header + body;
+            return 0;
+        }
+
+        offset += header + body;
+        stack.back()--;
+
+        if(items) {
+            if(stack.size() > kMaxNestingDepth) {
+                ec = error::parse_error;
+                return 0;
+            }
+
+            stack.push_back(items);
+        }
+
+        while(!stack.empty() && stack.back() == 0) {
+            stack.pop_back();
+        }
+    }
+
+    return pending = offset;
+}
+
+auto
+frame_scanner_t::required() const -> size_t {
+    return pending;
+}
+
+void
+frame_scanner_t::reset() {
+    offset = 0;
+    pending = 0;
+
+    // Exactly one top-level object is expected per frame.
+    stack.assign(1, 1);
+}
+
 } // namespace aux
 
 size_t
 decoder_t::decode(const char* data, size_t size, message_type& message, std::error_code& ec) {
+    // Find out whether the whole frame has arrived without actually parsing it. The scanner picks up
+    // where it has stopped the last time, so partially received frames are never re-parsed.
+    const size_t frame_size = scanner.scan(data, size, ec);
+
+    if(ec) {
+        scanner.reset();
+        return 0;
+    } else if(!frame_size) {
+        ec = error::insufficient_bytes;
+        return 0;
+    }
+
+    scanner.reset();
+
     size_t offset = 0;
 
     // NOTE: We have to clear msgpack zone every decoding iteration to prevent memory leaking
@@ -70,7 +248,12 @@ decoder_t::decode(const char* data, size_t size, message_type& message, std::err
     // someday we migrate to v1.* and everything will be fine automatically.
     zone.clear();
 
-    msgpack::unpack_return rv = msgpack::unpack(data, size, &offset, &zone, &message.object);
+    // Headers left from the previous message would reference the discarded frame.
+    message.clear();
+
+    msgpack::unpack_return rv = msgpack::unpack(data, frame_size, &offset, &zone, &message.object);
+
+    message.length = offset;
 
     if(rv == msgpack::UNPACK_SUCCESS || rv == msgpack::UNPACK_EXTRA_BYTES) {
         if(message.object.type != msgpack::type::ARRAY || message.object.via.array.size < 3) {
@@ -83,19 +266,23 @@ decoder_t::decode(const char* data, size_t size, message_type& message, std::err
         } else if(message.object.via.array.size > 3) {
             if(message.object.via.array.ptr[3].type != msgpack::type::ARRAY) {
                 ec = error::frame_format_error;
-            } else if(!hpack::msgpack_traits::unpack_vector(
-                      message.object.via.array.ptr[3], hpack_context, message.metadata))
+            } else if(!hpack::msgpack_traits::unpack_views(
+                      message.object.via.array.ptr[3], hpack_context, message.views, message.pinned))
             {
                 ec = error::hpack_error;
             }
         }
-    } else if(rv == msgpack::UNPACK_CONTINUE) {
-        ec = error::insufficient_bytes;
-    } else if(rv == msgpack::UNPACK_PARSE_ERROR) {
+    } else {
+        // The scanner has already seen the whole frame, so the unpacker must not ask for more.
         ec = error::parse_error;
     }
 
     return offset;
 }
 
+auto
+decoder_t::required() const -> size_t {
+    return scanner.required();
+}
+
 }} // namespace cocaine::io
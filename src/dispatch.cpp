@@ -24,6 +24,8 @@
 
 using namespace cocaine::io;
 
+cocaine::utility::sharded_counter basic_dispatch_t::processing;
+
 basic_dispatch_t::basic_dispatch_t(const std::string& name):
     m_name(name)
 { }
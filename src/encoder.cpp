@@ -34,6 +34,9 @@
 #include "cocaine/traits.hpp"
 #include "cocaine/traits/tuple.hpp"
 
+#include <boost/thread/tss.hpp>
+
+#include <algorithm>
 #include <cstring>
 
 namespace cocaine {
@@ -41,18 +44,158 @@ namespace io {
 
 namespace aux {
 
-encoded_buffers_t::encoded_buffers_t() :
-offset(0) {
-    vector.resize(kInitialBufferSize);
+const size_t encoded_buffers_pool_t::kMinBufferSize;
+const size_t encoded_buffers_pool_t::kMaxBufferSize;
+const size_t encoded_buffers_pool_t::kMaxRetainedSize;
+const size_t encoded_buffers_pool_t::kClassCount;
+
+const size_t encoded_buffers_t::kInitialBufferSize;
+const size_t encoded_buffers_t::kMinReferencedSize;
+
+encoded_buffers_pool_t::encoded_buffers_pool_t():
+    m_stats()
+{ }
+
+encoded_buffers_pool_t&
+encoded_buffers_pool_t::current() {
+    static boost::thread_specific_ptr<encoded_buffers_pool_t> pool;
+    if(pool.get() == nullptr) {
+        pool.reset(new encoded_buffers_pool_t());
+    }
+    return *pool.get();
+}
+
+auto
+encoded_buffers_pool_t::stats() const -> stats_t {
+    return m_stats;
+}
+
+auto
+encoded_buffers_pool_t::acquire(size_t size) -> buffer_type {
+    size_t class_id = 0;
+    size_t class_size = kMinBufferSize;
+
+    while(class_size < size) {
+        class_id++;
+        class_size *= 2;
+    }
+
+    if(class_size > kMaxBufferSize) {
+        m_stats.misses++;
+        return buffer_type(size);
+    }
+
+    auto& buffers = m_classes[class_id];
+
+    if(buffers.empty()) {
+        m_stats.misses++;
+        return buffer_type(class_size);
+    }
+
+    buffer_type buffer = std::move(buffers.back());
+    buffers.pop_back();
+
+    m_stats.hits++;
+    m_stats.retained -= class_size;
+
+    return buffer;
+}
+
+void
+encoded_buffers_pool_t::release(buffer_type& buffer) {
+    buffer_type released;
+
+    // NOTE: Swapping to make sure the buffer is empty afterwards, no matter whether it's retained.
+    released.swap(buffer);
+
+    size_t class_id = 0;
+    size_t class_size = kMinBufferSize;
+
+    while(class_size < released.size()) {
+        class_id++;
+        class_size *= 2;
+    }
+
+    if(class_size != released.size() || class_size > kMaxBufferSize) {
+        return;
+    }
+
+    auto& buffers = m_classes[class_id];
+
+    if((buffers.size() + 1) * class_size > kMaxRetainedSize) {
+        return;
+    }
+
+    buffers.push_back(std::move(released));
+
+    m_stats.retained += class_size;
+}
+
+encoded_buffers_t::encoded_buffers_t():
+    vector(encoded_buffers_pool_t::current().acquire(kInitialBufferSize)),
+    offset(0)
+{ }
+
+encoded_buffers_t::~encoded_buffers_t() {
+    if(!vector.empty()) {
+        encoded_buffers_pool_t::current().release(vector);
+    }
+}
+
+encoded_buffers_t&
+encoded_buffers_t::operator=(encoded_buffers_t&& other) {
+    if(this == &other) {
+        return *this;
+    }
+
+    if(!vector.empty()) {
+        encoded_buffers_pool_t::current().release(vector);
+    }
+
+    // NOTE: Swapping to make sure the other buffer is left empty, since this one has just been
+    // released and must not be released again by the other's destructor.
+    vector.swap(other.vector);
+    offset = other.offset;
+    other.offset = 0;
+
+    pinned   = std::move(other.pinned);
+    segments = std::move(other.segments);
+
+    return *this;
+}
+
+void
+encoded_buffers_t::pin(const char* data, size_t size) {
+    if(size >= kMinReferencedSize) {
+        pinned.emplace_back(data, size);
+    }
 }
 
 void
 encoded_buffers_t::write(const char* data, size_t size) {
-    size_t new_size = vector.size();
-    while (size > new_size - offset) {
-        new_size *= 2;
+    if(size >= kMinReferencedSize && !pinned.empty()) {
+        const auto it = std::find(pinned.begin(), pinned.end(), std::make_pair(data, size));
+
+        if(it != pinned.end()) {
+            segments.push_back({offset, data, size});
+            return;
+        }
+    }
+
+    if(size > vector.size() - offset) {
+        size_t new_size = vector.size();
+        while (size > new_size - offset) {
+            new_size *= 2;
+        }
+
+        auto& pool = encoded_buffers_pool_t::current();
+        auto grown = pool.acquire(new_size);
+
+        std::memcpy(grown.data(), vector.data(), offset);
+
+        pool.release(vector);
+        vector = std::move(grown);
     }
-    vector.resize(new_size);
 
     std::memcpy(vector.data() + offset, data, size);
 
@@ -60,23 +203,39 @@ encoded_buffers_t::write(const char* data, size_t size) {
 }
 
 auto
-encoded_buffers_t::data() const -> const char* {
+encoded_buffers_t::inline_data() const -> const char* {
     return vector.data();
 }
 
 size_t
-encoded_buffers_t::size() const {
+encoded_buffers_t::inline_size() const {
     return offset;
 }
 
+size_t
+encoded_buffers_t::size() const {
+    size_t referenced = 0;
+
+    for(auto it = segments.begin(); it != segments.end(); ++it) {
+        referenced += it->size;
+    }
+
+    return offset + referenced;
+}
+
 void
 encoded_message_t::write(const char* data, size_t size) {
     return buffer.write(data, size);
 }
 
 auto
-encoded_message_t::data() const -> const char* {
-    return buffer.data();
+encoded_message_t::inline_data() const -> const char* {
+    return buffer.inline_data();
+}
+
+size_t
+encoded_message_t::inline_size() const {
+    return buffer.inline_size();
 }
 
 size_t
@@ -84,10 +243,17 @@ encoded_message_t::size() const {
     return buffer.size();
 }
 
-unbound_message_t::unbound_message_t(function_type&& bind_): bind(std::move(bind_)) { }
+unbound_message_t::unbound_message_t(hpack::header_storage_t&& headers_):
+    headers(std::move(headers_))
+{ }
 
 } //  namespace aux
 
+encoder_t::encoder_t():
+    compression(false),
+    stats()
+{ }
+
 void
 encoder_t::pack_headers(packer_type& packer, const hpack::header_storage_t& headers) {
 
@@ -100,15 +266,26 @@ encoder_t::pack_headers(packer_type& packer, const hpack::header_storage_t& head
             skip++;
         }
     }
-    packer.pack_array(headers.size() + 3 - skip);
+
+    const size_t count = headers.size() + 3 - skip;
+
+    packer.pack_array(count);
+
+    // Array tag is the same whether headers are compressed or not.
+    stats.plain += count < 16 ? 1 : count < 65536 ? 3 : 5;
 
     uint64_t trace_id  = trace_t::current().get_trace_id();
     uint64_t span_id   = trace_t::current().get_id();
     uint64_t parent_id = trace_t::current().get_parent_id();
 
-    hpack::msgpack_traits::pack<hpack::headers::trace_id<>>(packer, hpack_context, hpack::header::pack(trace_id));
-    hpack::msgpack_traits::pack<hpack::headers::span_id<>>(packer, hpack_context, hpack::header::pack(span_id));
-    hpack::msgpack_traits::pack<hpack::headers::parent_id<>>(packer, hpack_context, hpack::header::pack(parent_id));
+    // NOTE: Tracing ids are unique for every message, unless there's no trace at all.
+    const bool traced = !trace_t::current().empty();
+
+    typedef hpack::headers h;
+
+    pack_header(packer, hpack::header_t::create<h::trace_id<>>(hpack::header::pack(trace_id)), traced);
+    pack_header(packer, hpack::header_t::create<h::span_id<>>(hpack::header::pack(span_id)), traced);
+    pack_header(packer, hpack::header_t::create<h::parent_id<>>(hpack::header::pack(parent_id)), traced);
 
     for (const auto& header: headers) {
         // Skip packing outdated tracing headers. We use fresh ones (shifted on the tracing tree) from TLS.
@@ -117,13 +294,51 @@ encoder_t::pack_headers(packer_type& packer, const hpack::header_storage_t& head
         if(name == h::trace_id<>::name() || name == h::span_id<>::name() || name == h::parent_id<>::name()) {
             continue;
         }
+        pack_header(packer, header);
+    }
+}
+
+void
+encoder_t::pack_header(packer_type& packer, const hpack::header_t& header, bool unique) {
+    stats.plain += hpack::msgpack_traits::uncompressed_size(header);
+
+    if(compression && unique) {
+        hpack::msgpack_traits::pack_unindexed(packer, hpack_context, header);
+    } else if(compression) {
+        hpack::msgpack_traits::pack_compressed(packer, hpack_context, header);
+    } else {
         hpack::msgpack_traits::pack(packer, hpack_context, header);
     }
 }
 
+void
+encoder_t::compress(bool enable) {
+    compression = enable;
+}
+
+bool
+encoder_t::compressed() const {
+    return compression;
+}
+
+auto
+encoder_t::drain() -> stats_t {
+    const auto result = stats;
+    stats = stats_t();
+    return result;
+}
+
 aux::encoded_message_t
-encoder_t::encode(const message_type& message) {
-    return message.bind(*this);
+encoder_t::encode(message_type&& message) {
+    const size_t origin = message.body.buffer.size();
+
+    packer_type packer(message.body.buffer);
+
+    pack_headers(packer, message.headers);
+
+    stats.packed += message.body.buffer.size() - origin;
+
+    return std::move(message.body);
 }
 
 }} // namespace cocaine::io
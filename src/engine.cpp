@@ -21,21 +21,29 @@
 #include "cocaine/engine.hpp"
 
 #include "cocaine/context.hpp"
+#include "cocaine/context/config.hpp"
+#include "cocaine/errors.hpp"
+#include "cocaine/format.hpp"
 #include "cocaine/logging.hpp"
 
+#include "cocaine/rpc/asio/buffer_pool.hpp"
+#include "cocaine/rpc/asio/uring.hpp"
+#include "cocaine/rpc/asio/encoder.hpp"
 #include "cocaine/rpc/asio/transport.hpp"
 #include "cocaine/rpc/basic_dispatch.hpp"
 #include "cocaine/rpc/session.hpp"
 
+#include <blackhole/attribute.hpp>
 #include <blackhole/logger.hpp>
-#include <blackhole/wrapper.hpp>
-
-#include <boost/lexical_cast.hpp>
 
 #include <asio/io_service.hpp>
 #include <asio/ip/tcp.hpp>
 #include <asio/local/stream_protocol.hpp>
 
+#include <metrics/registry.hpp>
+
+#include <mutex>
+
 #include "chamber.hpp"
 
 using namespace cocaine;
@@ -43,6 +51,103 @@ using namespace cocaine::io;
 
 using namespace asio;
 
+namespace {
+
+// NOTE: Same as the stream output of endpoints, but without the overhead of iostreams.
+
+auto
+describe(const ip::tcp::endpoint& endpoint) -> std::string {
+    const auto address = endpoint.address();
+
+    if(address.is_v6()) {
+        return "[" + address.to_string() + "]:" + std::to_string(endpoint.port());
+    } else {
+        return address.to_string() + ":" + std::to_string(endpoint.port());
+    }
+}
+
+auto
+describe(const local::stream_protocol::endpoint& endpoint) -> std::string {
+    return endpoint.path();
+}
+
+// Client endpoint to identify the connection by in the logs. Peer addresses of local sockets are
+// usually unnamed, so the endpoint they were accepted on is used instead.
+
+auto
+endpoint_of(const ip::tcp::socket& socket) -> ip::tcp::endpoint {
+    return socket.remote_endpoint();
+}
+
+auto
+endpoint_of(const local::stream_protocol::socket& socket) -> local::stream_protocol::endpoint {
+    return socket.local_endpoint();
+}
+
+// Attaches the client endpoint and the service name to the session's log records. Unlike a generic
+// attribute wrapper, it doesn't build any attributes for every new connection: the endpoint is only
+// formatted once the session logs something for the first time.
+template<class Endpoint>
+class session_logger_t:
+    public blackhole::logger_t
+{
+    blackhole::logger_t& inner;
+
+    const Endpoint endpoint;
+    const std::string service;
+
+    std::once_flag formatted;
+    std::string endpoint_name;
+
+public:
+    session_logger_t(blackhole::logger_t& inner_, const Endpoint& endpoint_, std::string service_):
+        inner(inner_),
+        endpoint(endpoint_),
+        service(std::move(service_))
+    { }
+
+    auto
+    log(blackhole::severity_t severity, const blackhole::message_t& message) -> void {
+        blackhole::attribute_pack pack;
+        log(severity, message, pack);
+    }
+
+    auto
+    log(blackhole::severity_t severity, const blackhole::message_t& message,
+        blackhole::attribute_pack& pack) -> void
+    {
+        const auto attributes = this->attributes();
+        pack.push_back(attributes);
+        inner.log(severity, message, pack);
+    }
+
+    auto
+    log(blackhole::severity_t severity, const blackhole::lazy_message_t& message,
+        blackhole::attribute_pack& pack) -> void
+    {
+        const auto attributes = this->attributes();
+        pack.push_back(attributes);
+        inner.log(severity, message, pack);
+    }
+
+    auto
+    manager() -> blackhole::scope::manager_t& {
+        return inner.manager();
+    }
+
+private:
+    auto
+    attributes() -> blackhole::attribute_list {
+        std::call_once(formatted, [&] {
+            endpoint_name = describe(endpoint);
+        });
+
+        return blackhole::attribute_list{{"endpoint", endpoint_name}, {"service", service}};
+    }
+};
+
+} // namespace
+
 class execution_unit_t::gc_action_t:
     public std::enable_shared_from_this<gc_action_t>
 {
@@ -87,7 +192,7 @@ execution_unit_t::gc_action_t::finalize(const std::error_code& ec) {
     size_t recycled = 0;
 
     for(auto it = parent->m_sessions.begin(); it != parent->m_sessions.end();) {
-        if(!it->second->memory_pressure()) {
+        if(it->second->is_detached()) {
             recycled++;
             it = parent->m_sessions.erase(it);
             continue;
@@ -100,20 +205,182 @@ execution_unit_t::gc_action_t::finalize(const std::error_code& ec) {
         COCAINE_LOG_DEBUG(parent->m_log, "recycled {:d} session(s)", recycled);
     }
 
+    // NOTE: The encoding buffer pool is thread-local, so its statistics are published from here.
+    const auto stats = io::aux::encoded_buffers_pool_t::current().stats();
+    const auto prefix = format("core.asio[{}].encoder.pool", parent->m_chamber->thread_id());
+
+    parent->m_metrics.counter<std::int64_t>(format("{}.hits", prefix))->store(stats.hits);
+    parent->m_metrics.counter<std::int64_t>(format("{}.misses", prefix))->store(stats.misses);
+    parent->m_metrics.counter<std::int64_t>(format("{}.retained", prefix))->store(stats.retained);
+
+    operator()();
+}
+
+class execution_unit_t::publish_action_t:
+    public std::enable_shared_from_this<publish_action_t>
+{
+    execution_unit_t *const parent;
+
+public:
+    explicit
+    publish_action_t(execution_unit_t *const parent_):
+        parent(parent_)
+    { }
+
+    void
+    operator()();
+
+private:
+    void
+    finalize(const std::error_code& ec);
+};
+
+void
+execution_unit_t::publish_action_t::operator()() {
+    if(!parent->m_publisher) {
+        return;
+    }
+
+    parent->m_publisher->expires_from_now(boost::posix_time::seconds(kPublishInterval));
+
+    parent->m_publisher->async_wait(std::bind(&publish_action_t::finalize,
+        shared_from_this(),
+        std::placeholders::_1
+    ));
+}
+
+void
+execution_unit_t::publish_action_t::finalize(const std::error_code& ec) {
+    if(ec == asio::error::operation_aborted) {
+        return;
+    }
+
+    // NOTE: Every execution unit publishes the metrics of all the sessions, which is redundant, but
+    // harmless, while it keeps them published as long as at least one unit is alive.
+    session_t::publish_metrics();
+
+    const auto prefix = format("core.asio[{}]", parent->m_chamber->thread_id());
+
+    parent->m_metrics.counter<std::int64_t>(format("{}.cpu", prefix))->store(parent->m_chamber->cpu());
+    parent->m_metrics.counter<std::int64_t>(format("{}.migrations", prefix))->store(
+        parent->m_chamber->migrations());
+
+    operator()();
+}
+
+class execution_unit_t::probe_action_t:
+    public std::enable_shared_from_this<probe_action_t>
+{
+    execution_unit_t *const parent;
+
+public:
+    explicit
+    probe_action_t(execution_unit_t *const parent_):
+        parent(parent_)
+    { }
+
+    void
+    operator()();
+
+private:
+    void
+    finalize(const std::error_code& ec);
+};
+
+void
+execution_unit_t::probe_action_t::operator()() {
+    if(!parent->m_probe) {
+        return;
+    }
+
+    parent->m_probe->expires_from_now(boost::posix_time::milliseconds(kProbeInterval));
+
+    parent->m_probe->async_wait(std::bind(&probe_action_t::finalize,
+        shared_from_this(),
+        std::placeholders::_1
+    ));
+}
+
+void
+execution_unit_t::probe_action_t::finalize(const std::error_code& ec) {
+    if(ec == asio::error::operation_aborted || !parent->m_probe) {
+        return;
+    }
+
+    // The probe timer is the only one firing that often, so its lateness tells how long handlers
+    // wait in the reactor's queue.
+    const auto lag = asio::deadline_timer::traits_type::now() - parent->m_probe->expires_at();
+
+    std::int64_t active = 0;
+    std::int64_t channels = 0;
+
+    for(auto it = parent->m_sessions.begin(); it != parent->m_sessions.end(); ++it) {
+        if(!it->second->is_detached()) {
+            active++;
+            channels += it->second->active_channels_count();
+        }
+    }
+
+    parent->m_lag      = std::max<std::int64_t>(lag.total_microseconds(), 0);
+    parent->m_active   = active;
+    parent->m_channels = channels;
+
     operator()();
 }
 
 execution_unit_t::execution_unit_t(context_t& context):
+    execution_unit_t(context, std::vector<unsigned int>())
+{ }
+
+execution_unit_t::execution_unit_t(context_t& context, const std::vector<unsigned int>& cpus):
     m_asio(new io_service()),
-    m_chamber(new chamber_t("core/asio", m_asio)),
+    m_chamber(new chamber_t("core/asio", m_asio, context.metrics_hub(), cpus)),
     m_log(context.log("core/asio", {{"engine", m_chamber->thread_id()}})),
     m_metrics(context.metrics_hub()),
-    m_cron(new asio::deadline_timer(*m_asio))
+    m_read_budget(context.config().network().read_budget()),
+    m_high_watermark(context.config().network().high_watermark()),
+    m_low_watermark(context.config().network().low_watermark()),
+    m_initial_window(context.config().network().initial_window()),
+    m_drain_timeout(boost::posix_time::seconds(context.config().network().drain_timeout())),
+    m_ping_interval(boost::posix_time::seconds(context.config().network().ping_interval())),
+    m_ping_misses(context.config().network().ping_misses()),
+    m_timer_sampling(context.config().network().timer_sampling()),
+    m_cron(new asio::deadline_timer(*m_asio)),
+    m_publisher(new asio::deadline_timer(*m_asio)),
+    m_pending(0),
+    m_active(0),
+    m_channels(0),
+    m_lag(0),
+    m_probe(new asio::deadline_timer(*m_asio))
 {
+    asio::use_service<io::buffer_pool_t>(*m_asio).configure(
+        context.config().network().lazy_buffers(),
+        context.config().network().buffer_pool()
+    );
+
+    if(context.config().network().backend() == "uring") {
+        try {
+            if(!asio::use_service<io::uring_service_t>(*m_asio).configure(true)) {
+                COCAINE_LOG_WARNING(m_log, "io_uring is not supported by the kernel, falling back to epoll");
+            }
+        } catch(const std::system_error& e) {
+            COCAINE_LOG_WARNING(m_log, "unable to set up io_uring, falling back to epoll: {}",
+                error::to_string(e));
+        }
+    }
+
     m_asio->post(std::bind(&gc_action_t::operator(),
         std::make_shared<gc_action_t>(this, boost::posix_time::seconds(kCollectionInterval))
     ));
 
+    m_asio->post(std::bind(&publish_action_t::operator(),
+        std::make_shared<publish_action_t>(this)
+    ));
+
+    m_asio->post(std::bind(&probe_action_t::operator(),
+        std::make_shared<probe_action_t>(this)
+    ));
+
     COCAINE_LOG_DEBUG(m_log, "engine started");
 }
 
@@ -122,13 +389,16 @@ execution_unit_t::~execution_unit_t() {
         COCAINE_LOG_DEBUG(m_log, "stopping engine");
 
         for(auto it = m_sessions.begin(); it != m_sessions.end(); ++it) {
-            // Close the connections.
-            it->second->detach(std::error_code());
+            // Let the clients finish their requests and close the connections. Sessions which don't
+            // make it in time are detached by their own timers, which also keep the reactor running.
+            it->second->drain(std::error_code(), m_drain_timeout);
         }
 
-        // NOTE: It's okay to destroy deadline timer here, because garbage collector always performs
-        // existence check for timer.
+        // NOTE: It's okay to destroy deadline timers here, because the garbage collector, the metrics
+        // publisher and the load probe always perform existence check for their timers.
         m_cron.reset();
+        m_publisher.reset();
+        m_probe.reset();
     });
 
     // NOTE: This will block until all the outstanding operations are complete.
@@ -142,62 +412,85 @@ execution_unit_t::attach(std::unique_ptr<Socket> ptr, const dispatch_ptr_t& disp
     typedef typename socket_type::protocol_type protocol_type;
     typedef session<protocol_type> session_type;
 
-    int fd;
-
-    if((fd = ::dup(ptr->native_handle())) == -1) {
-        throw std::system_error(errno, std::system_category(), "unable to clone client's socket");
-    }
-
     std::shared_ptr<session_type> session_;
 
     try {
-        // Local endpoint address of the socket to be cloned.
-        const auto endpoint = ptr->local_endpoint();
+        std::unique_ptr<socket_type> socket;
 
-        // Copy the socket into the new reactor.
-        auto transport = std::make_unique<io::transport<protocol_type>>(
-            std::make_unique<socket_type>(*m_asio, endpoint.protocol(), fd)
-        );
+        if(&ptr->get_io_service() == m_asio.get()) {
+            // Connections accepted by actors are already bound to this unit's reactor, so they're
+            // used as is, without cloning and registering the socket once again.
+            socket = std::move(ptr);
+        } else {
+            int fd;
+
+            if((fd = ::dup(ptr->native_handle())) == -1) {
+                throw std::system_error(errno, std::system_category(), "unable to clone client's socket");
+            }
 
-        std::string remote_endpoint;
+            // Copy the socket into the new reactor.
+            socket = std::make_unique<socket_type>(*m_asio, ptr->local_endpoint().protocol(), fd);
+        }
 
         if(std::is_same<protocol_type, ip::tcp>::value) {
             // Disable Nagle's algorithm, since most of the service clients do not send or receive
             // more than a couple of kilobytes of data.
-            transport->socket->set_option(ip::tcp::no_delay(true));
+            socket->set_option(ip::tcp::no_delay(true));
 
             // Enabling keepalive for TCP socket is required to avoid weird IPVS behavior on erasing
             // a table record, which lead to infinite socket consuming and making us suffer from fd
             // leakage.
             // NOTE: There is another solution: with reading `null_buffers` every N seconds we can
             // check an error code received.
-            transport->socket->set_option(asio::socket_base::keep_alive(true));
-            remote_endpoint = boost::lexical_cast<std::string>(ptr->remote_endpoint());
-        } else if(std::is_same<protocol_type, local::stream_protocol>::value) {
-            remote_endpoint = boost::lexical_cast<std::string>(endpoint);
-        } else {
-            remote_endpoint = "<unknown>";
+            socket->set_option(asio::socket_base::keep_alive(true));
         }
 
-        std::unique_ptr<logging::logger_t> log(new blackhole::wrapper_t(*m_log, {
-            {"endpoint", remote_endpoint                       },
-            {"service",  dispatch ? dispatch->name() : "<none>"}
-        }));
+        std::unique_ptr<logging::logger_t> log(new session_logger_t<typename protocol_type::endpoint>(
+            *m_log,
+            endpoint_of(*socket),
+            dispatch ? dispatch->name() : "<none>"
+        ));
 
-        COCAINE_LOG_DEBUG(log, "attached connection to engine, load: {:.2f}%", utilization() * 100);
+        const int fd = socket->native_handle();
 
         // Create a new inactive session.
-        session_ = std::make_shared<session_type>(std::move(log), m_metrics, std::move(transport), dispatch);
-
-        // Start pulling right now to prevent race when session is detached before pull
-        session_->pull();
+        session_ = std::make_shared<session_type>(std::move(log), m_metrics,
+            std::make_unique<io::transport<protocol_type>>(std::move(socket)), dispatch);
+
+        session_->throttle(m_high_watermark, m_low_watermark);
+        session_->grant(m_initial_window);
+        session_->sample(m_timer_sampling);
+
+        // Accounted until the session is registered, so that a burst of new connections doesn't
+        // pile up on this unit before the probe notices them.
+        ++m_pending;
+
+        // NOTE: Registering the session and starting to pull it in a single reactor hop instead of a
+        // hop for each of them.
+        m_asio->dispatch([=]() mutable {
+            m_sessions[fd] = session_;
+
+            --m_pending;
+            ++m_active;
+
+            try {
+                session_->pull(m_read_budget);
+
+                if(dispatch && !m_ping_interval.is_zero()) {
+                    session_->keepalive(m_ping_interval, m_ping_misses);
+                }
+            } catch(const std::system_error& e) {
+                // The session has been detached before it was pulled, it will be recycled later.
+                COCAINE_LOG_DEBUG(m_log, "client has disappeared while creating session: {}",
+                    error::to_string(e));
+            }
+        });
     } catch(const std::system_error& e) {
         throw std::system_error(e.code(), "client has disappeared while creating session");
     }
 
-    m_asio->dispatch([=]() mutable {
-        m_sessions[fd] = std::move(session_);
-    });
+    COCAINE_LOG_DEBUG(m_log, "attached connection to engine, service: '{}', load: {:.2f}%",
+        dispatch ? dispatch->name() : "<none>", utilization() * 100);
 
     return session_;
 }
@@ -207,6 +500,27 @@ execution_unit_t::utilization() const {
     return m_chamber->load_avg1();
 }
 
+double
+execution_unit_t::pressure() const {
+    return m_pending + m_active + m_channels + m_lag / 1000.0;
+}
+
+asio::io_service&
+execution_unit_t::reactor() {
+    return *m_asio;
+}
+
+void
+execution_unit_t::drain(const std::string& service) {
+    m_asio->post([=] {
+        for(auto it = m_sessions.begin(); it != m_sessions.end(); ++it) {
+            if(it->second->name() == service) {
+                it->second->drain(std::error_code(), m_drain_timeout);
+            }
+        }
+    });
+}
+
 template
 std::shared_ptr<session<ip::tcp>>
 execution_unit_t::attach(std::unique_ptr<ip::tcp::socket>, const dispatch_ptr_t&);
@@ -89,6 +89,8 @@ class protocol_category_t:
         switch(code) {
             case cocaine::error::protocol_errors::closed_upstream:
                 return "protocol violation - upstream was already closed";
+            case cocaine::error::protocol_errors::window_exhausted:
+                return "flow control window of the stream is exhausted";
             default:
                 return "cocaine.rpc.protocol error";
         }
@@ -122,6 +124,10 @@ class dispatch_category_t:
             return "no dispatch has been assigned for channel";
         case cocaine::error::dispatch_errors::uncaught_error:
             return "uncaught invocation exception";
+        case cocaine::error::dispatch_errors::session_draining:
+            return "session is shutting down";
+        case cocaine::error::dispatch_errors::workers_overloaded:
+            return "worker pool queue is full";
         default:
             return "cocaine.rpc.dispatch error";
         }
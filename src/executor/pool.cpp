@@ -0,0 +1,140 @@
+#include "cocaine/executor/pool.hpp"
+
+#include "cocaine/errors.hpp"
+#include "cocaine/format.hpp"
+#include "cocaine/memory.hpp"
+
+#include <metrics/registry.hpp>
+
+namespace cocaine {
+namespace executor {
+
+struct worker_pool_t::task_t {
+    work_t work;
+
+    // Measures the time the task spends in the queue.
+    std::unique_ptr<metrics::timer_t::context_t> waiting;
+};
+
+struct worker_pool_t::metrics_t {
+    metrics::shared_metric<std::atomic<std::int64_t>> depth;
+    metrics::shared_metric<std::atomic<std::int64_t>> rejected;
+    metrics::shared_metric<metrics::timer<metrics::accumulator::decaying::exponentially_t>> wait;
+
+    metrics_t(metrics::registry_t& metrics_hub, const std::string& name):
+        depth(metrics_hub.counter<std::int64_t>(cocaine::format("{}.queue.depth", name))),
+        rejected(metrics_hub.counter<std::int64_t>(cocaine::format("{}.queue.rejected", name))),
+        wait(metrics_hub.timer<metrics::accumulator::decaying::exponentially_t>(
+            cocaine::format("{}.queue.wait", name)))
+    {}
+};
+
+worker_pool_t::worker_pool_t(std::size_t threads_, std::size_t capacity_,
+                             metrics::registry_t& metrics_hub, const std::string& name):
+    capacity(capacity_),
+    metrics(new metrics_t(metrics_hub, name)),
+    next(0),
+    stopped(false)
+{
+    for(std::size_t i = 0; i < threads_; ++i) {
+        queues.push_back(std::make_unique<queue_type>());
+    }
+
+    for(std::size_t i = 0; i < threads_; ++i) {
+        threads.create_thread(std::bind(&worker_pool_t::run, this, i));
+    }
+}
+
+worker_pool_t::~worker_pool_t() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+
+    wakeup.notify_all();
+    threads.join_all();
+}
+
+auto
+worker_pool_t::spawn(work_t work) -> void {
+    // The slot is reserved before the task is actually queued, so that the capacity is never exceeded
+    // by concurrent spawns.
+    if(static_cast<std::size_t>(metrics->depth->fetch_add(1)) >= capacity) {
+        metrics->depth->fetch_sub(1);
+        metrics->rejected->fetch_add(1);
+        throw std::system_error(error::workers_overloaded);
+    }
+
+    task_t task{std::move(work), std::make_unique<metrics::timer_t::context_t>(metrics->wait->context())};
+
+    queues[next++ % queues.size()]->synchronize()->push_back(std::move(task));
+
+    // NOTE: Idle workers check the depth under the lock before going to sleep, so taking the lock here
+    // guarantees that the notification is not lost.
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+
+    wakeup.notify_one();
+}
+
+auto
+worker_pool_t::depth() const -> std::size_t {
+    return metrics->depth->load();
+}
+
+auto
+worker_pool_t::take(std::size_t index, task_t& task) -> bool {
+    // Own queue first, in the FIFO order, then steal from the back of the others.
+    for(std::size_t i = 0; i < queues.size(); ++i) {
+        const auto own = i == 0;
+
+        auto queue = queues[(index + i) % queues.size()]->synchronize();
+
+        if(queue->empty()) {
+            continue;
+        }
+
+        if(own) {
+            task = std::move(queue->front());
+            queue->pop_front();
+        } else {
+            task = std::move(queue->back());
+            queue->pop_back();
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+auto
+worker_pool_t::run(std::size_t index) -> void {
+    while(true) {
+        task_t task;
+
+        if(take(index, task)) {
+            metrics->depth->fetch_sub(1);
+
+            task.waiting.reset();
+            task.work();
+
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // A reserved task might be not queued yet, in which case the worker just looks for it again.
+        wakeup.wait(lock, [&] {
+            return stopped || metrics->depth->load() > 0;
+        });
+
+        if(stopped && metrics->depth->load() == 0) {
+            return;
+        }
+    }
+}
+
+} // namespace executor
+} // namespace cocaine
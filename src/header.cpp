@@ -21,7 +21,10 @@
 #include "cocaine/hpack/header.hpp"
 #include "cocaine/hpack/static_table.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <functional>
 #include <sstream>
 
 namespace cocaine { namespace hpack {
@@ -44,6 +47,22 @@ find_first(const std::vector<header_t>& headers, const std::string& name) {
     return find_first(headers, name.c_str(), name.size());
 }
 
+boost::optional<const header_view_t&>
+find_first(const std::vector<header_view_t>& headers, const char* name, size_t sz) {
+    auto it = std::find_if(headers.begin(), headers.end(), [&](const header_view_t& h){
+        return h.name_equal(name, sz);
+    });
+    if(it != headers.end()) {
+        return boost::optional<const header_view_t&>(*it);
+    }
+    return boost::none;
+}
+
+boost::optional<const header_view_t&>
+find_first(const std::vector<header_view_t>& headers, const std::string& name) {
+    return find_first(headers, name.c_str(), name.size());
+}
+
 }
 
 struct init_header_t {
@@ -98,23 +117,124 @@ header_t::http2_size() const {
     return data.name.size() + data.value.size() + header_table_t::http2_header_overhead;
 }
 
+header_view_t::header_view_t(const char* name, size_t name_size, const char* value, size_t value_size) {
+    data.name = {name, name_size};
+    data.value = {value, value_size};
+}
+
+header_view_t::header_view_t(const header_t& header) :
+    header_view_t(header.name().data(), header.name().size(), header.value().data(), header.value().size())
+{}
+
+const header_view_t::slice_t&
+header_view_t::name() const {
+    return data.name;
+}
+
+const header_view_t::slice_t&
+header_view_t::value() const {
+    return data.value;
+}
+
+bool
+header_view_t::name_equal(const char* name, size_t size) const {
+    return data.name.size == size && std::memcmp(data.name.data, name, size) == 0;
+}
+
+header_t
+header_view_t::materialize() const {
+    return header_t(std::string(data.name.data, data.name.size), std::string(data.value.data, data.value.size));
+}
+
 const header_static_table_t::storage_t&
 header_static_table_t::get_headers() {
     static storage_t storage = init_data();
     return storage;
 }
 
+namespace {
+
+size_t
+name_hash(const header_t& header) {
+    return std::hash<std::string>()(header.name());
+}
+
+size_t
+full_hash(const header_t& header) {
+    const size_t seed = name_hash(header);
+    return seed ^ (std::hash<std::string>()(header.value()) + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+size_t
+bucket(size_t hash) {
+    return hash & (header_table_t::bucket_count - 1);
+}
+
+// Hash indexes over the static table. Chains are built in the reverse order, so that the lowest
+// matching index is always found first, same as with the linear search.
+struct static_index_t {
+    static_index_t() {
+        full_buckets.fill(0);
+        name_buckets.fill(0);
+
+        const auto& headers = header_static_table_t::get_headers();
+
+        for(size_t idx = header_static_table_t::size; idx-- > 0;) {
+            full_next[idx] = full_buckets[bucket(full_hash(headers[idx]))];
+            name_next[idx] = name_buckets[bucket(name_hash(headers[idx]))];
+
+            full_buckets[bucket(full_hash(headers[idx]))] = idx + 1;
+            name_buckets[bucket(name_hash(headers[idx]))] = idx + 1;
+        }
+    }
+
+    // Returns the static index plus one, or zero if nothing was found.
+    template<class Predicate>
+    size_t
+    find(const std::array<size_t, header_table_t::bucket_count>& buckets,
+         const std::array<size_t, header_static_table_t::size>& next,
+         size_t hash,
+         Predicate predicate) const
+    {
+        const auto& headers = header_static_table_t::get_headers();
+
+        for(size_t link = buckets[bucket(hash)]; link; link = next[link - 1]) {
+            if(predicate(headers[link - 1])) {
+                return link;
+            }
+        }
+
+        return 0;
+    }
+
+    std::array<size_t, header_table_t::bucket_count> full_buckets;
+    std::array<size_t, header_table_t::bucket_count> name_buckets;
+
+    std::array<size_t, header_static_table_t::size> full_next;
+    std::array<size_t, header_static_table_t::size> name_next;
+};
+
+const static_index_t&
+static_index() {
+    static const static_index_t index;
+    return index;
+}
+
+} // namespace
+
 header_table_t::header_table_t() :
+    head(0),
+    tail(0),
+    occupied(0),
     capacity(max_data_capacity)
-{}
+{
+    full_buckets.fill(0);
+    name_buckets.fill(0);
+}
 
 size_t
 header_table_t::data_size() const {
-    size_t total = 0;
-    for (const auto& h : headers) {
-        total += h.http2_size();
-    }
-    return total;
+    return occupied;
 }
 
 size_t
@@ -124,12 +244,12 @@ header_table_t::data_capacity() const {
 
 size_t
 header_table_t::size() const {
-    return header_static_table_t::size + headers.size();
+    return header_static_table_t::size + (head - tail);
 }
 
 bool
 header_table_t::empty() const {
-    return headers.empty();
+    return head == tail;
 }
 
 void
@@ -137,46 +257,122 @@ header_table_t::push(header_t header) {
     size_t header_size = header.http2_size();
 
     // Pop headers from table until there is enough room for new one or table is empty
-    auto sz = data_size();
-    while(sz + header_size > capacity && !empty()) {
-        sz -= headers.back().http2_size();
-        headers.pop_back();
+    while(occupied + header_size > capacity && !empty()) {
+        pop();
     }
 
     // Header does not fit in the table. According to RFC we just clean the table and do not put the header inside.
-    if(empty() && (data_size() + header_size > capacity)) {
+    if(empty() && header_size > capacity) {
         return;
     }
 
-    headers.push_front(std::move(header));
+    if(head - tail == ring.size()) {
+        grow();
+    }
+
+    auto& entry = ring[head & (ring.size() - 1)];
+
+    const size_t full = bucket(full_hash(header));
+    const size_t name = bucket(name_hash(header));
+
+    entry.header = std::move(header);
+    entry.next_full = full_buckets[full];
+    entry.next_name = name_buckets[name];
+
+    full_buckets[full] = name_buckets[name] = ++head;
+
+    occupied += header_size;
+}
+
+void
+header_table_t::pop() {
+    auto& entry = ring[tail & (ring.size() - 1)];
+
+    occupied -= entry.header.http2_size();
+
+    // Release the memory right away, as the slot might not be reused for quite a while.
+    entry.header = header_t();
+
+    tail++;
+}
+
+void
+header_table_t::grow() {
+    // Every entry takes at least the overhead bytes, so this is the upper bound of the table length.
+    static const size_t max_entries = max_data_capacity / http2_header_overhead;
+
+    std::vector<entry_t> grown(ring.empty() ? 8 : std::min(ring.size() * 2, max_entries));
+
+    for(uint64_t seq = tail; seq != head; ++seq) {
+        grown[seq & (grown.size() - 1)] = std::move(ring[seq & (ring.size() - 1)]);
+    }
+
+    ring.swap(grown);
 }
 
-std::size_t
-header_table_t::find(const std::function<bool(const header_t&)> fn) {
-    const auto& statics = header_static_table_t::get_headers();
+size_t
+header_table_t::find_by_full_match(const header_t& header) const {
+    const size_t hash = full_hash(header);
 
-    auto it = std::find_if(std::begin(statics), std::end(statics), fn);
+    const auto predicate = [&](const header_t& candidate) {
+        return candidate == header;
+    };
 
-    if(it != std::end(statics)) {
-        return std::distance(std::begin(statics), it);
+    if(const size_t link = static_index().find(static_index().full_buckets, static_index().full_next,
+        hash, predicate))
+    {
+        return link - 1;
     }
 
-    auto dynit = std::find_if(std::begin(headers), std::end(headers), fn);
-    if(dynit != std::end(headers)) {
-        return std::distance(headers.begin(), dynit) + header_static_table_t::size;
+    for(uint64_t link = full_buckets[bucket(hash)]; link > tail;) {
+        const auto& entry = ring[(link - 1) & (ring.size() - 1)];
+
+        if(predicate(entry.header)) {
+            return header_static_table_t::size + (head - link);
+        }
+
+        link = entry.next_full;
     }
+
+    return 0;
+}
+
+size_t
+header_table_t::find_by_name(const header_t& header) const {
+    const size_t hash = name_hash(header);
+
+    const auto predicate = [&](const header_t& candidate) {
+        return candidate.name_equal(header);
+    };
+
+    if(const size_t link = static_index().find(static_index().name_buckets, static_index().name_next,
+        hash, predicate))
+    {
+        return link - 1;
+    }
+
+    for(uint64_t link = name_buckets[bucket(hash)]; link > tail;) {
+        const auto& entry = ring[(link - 1) & (ring.size() - 1)];
+
+        if(predicate(entry.header)) {
+            return header_static_table_t::size + (head - link);
+        }
+
+        link = entry.next_name;
+    }
+
     return 0;
 }
 
 const header_t&
 header_table_t::operator[](size_t idx) {
-    if(idx == 0 || idx > headers.size() + header_static_table_t::size) {
+    if(idx == 0 || idx >= size()) {
         throw std::out_of_range("invalid index for header table");
     }
     if(idx < header_static_table_t::size) {
         return header_static_table_t::get_headers()[idx];
     }
-    return headers[idx - header_static_table_t::size];
+    return ring[(head - 1 - (idx - header_static_table_t::size)) & (ring.size() - 1)].header;
 }
 
 }} // namespace cocaine::hpack
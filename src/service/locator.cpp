@@ -302,6 +302,81 @@ private:
     }
 };
 
+namespace {
+
+// Service updates are incremental, so only the latest state of every updated service is kept.
+void
+coalesce(results::connect& pending, results::connect&& update) {
+    auto& services = std::get<1>(update);
+
+    for(auto it = services.begin(); it != services.end(); ++it) {
+        std::get<1>(pending)[it->first] = std::move(it->second);
+    }
+}
+
+// Routing updates are full dumps, so only the latest one matters.
+void
+coalesce(results::routing& pending, results::routing&& update) {
+    pending = std::move(update);
+}
+
+} // namespace
+
+template<class T>
+auto
+locator_t::outgoing_t<T>::write(T update) -> std::error_code {
+    std::error_code ec;
+
+    const bool held = state->pending.apply([&](boost::optional<T>& pending) {
+        if(pending) {
+            // Updates must not overtake the ones which are already held back.
+            coalesce(*pending, std::move(update));
+            return false;
+        }
+
+        if((ec = state->stream.write(update)) == error::window_exhausted) {
+            pending = std::move(update);
+            ec.clear();
+            return true;
+        }
+
+        return false;
+    });
+
+    if(held) {
+        // NOTE: The stream is referenced weakly, since the handler is kept by the stream itself.
+        const std::weak_ptr<state_t> weak = state;
+        state->stream.on_window([weak] { flush(weak); });
+    }
+
+    return ec;
+}
+
+template<class T>
+void
+locator_t::outgoing_t<T>::flush(const std::weak_ptr<state_t>& weak) {
+    const auto state = weak.lock();
+
+    if(!state) {
+        // The stream has been dropped meanwhile.
+        return;
+    }
+
+    const bool held = state->pending.apply([&](boost::optional<T>& pending) {
+        if(!pending || state->stream.write(*pending) == error::window_exhausted) {
+            return static_cast<bool>(pending);
+        }
+
+        // NOTE: The update is dropped on other errors as well, since the stream is closed then.
+        pending = boost::none;
+        return false;
+    });
+
+    if(held) {
+        state->stream.on_window([weak] { flush(weak); });
+    }
+}
+
 // Locator
 
 locator_cfg_t::locator_cfg_t(const std::string& name_, const dynamic_t& root):
@@ -443,6 +518,7 @@ locator_t::link_node(const std::string& uuid, const std::vector<tcp::endpoint>&
             std::shared_ptr<cocaine::session<tcp>> session;
             try {
                 session = m_context.engine().attach(std::move(ptr), nullptr);
+                session->announce();
                 mapping.at(uuid).ptr = session;
             } catch (const std::system_error& err) {
                 COCAINE_LOG_ERROR(m_log, "unable to set up remote client: {}", error::to_string(err));
@@ -567,14 +643,13 @@ locator_t::on_resolve(const std::string& name, const std::string& seed) const {
 
 auto
 locator_t::on_connect(const std::string& uuid) -> streamed<results::connect> {
-    streamed<results::connect> stream;
-
     const holder_t scoped(*m_log, {{"uuid", uuid}});
 
     auto mapping = m_remotes.synchronize();
 
     if(!m_cluster) {
         // No cluster means there are no streams.
+        streamed<results::connect> stream;
         stream.close();
         return stream;
     }
@@ -583,13 +658,15 @@ locator_t::on_connect(const std::string& uuid) -> streamed<results::connect> {
         COCAINE_LOG_INFO(m_log, "attaching outgoing stream for locator");
     }
 
+    outgoing_t<results::connect> outgoing;
+
     // Store the stream to synchronize future service updates with the remote node. Updates are
     // sent out on context service signals, and propagate to all nodes in the cluster.
-    mapping->insert({uuid, stream});
+    mapping->insert({uuid, outgoing});
 
     // NOTE: Even if there's nothing to return, still send out an empty update.
-    stream.write(m_cfg.uuid, m_snapshots);
-    return stream;
+    outgoing.write(results::connect{m_cfg.uuid, m_snapshots});
+    return outgoing.stream();
 }
 
 void
@@ -677,7 +754,7 @@ locator_t::on_routing(const std::string& ruid, bool replace) -> streamed<results
         return {value.first, value.second.all()};
     });
 
-    auto stream = m_routers.apply([&](router_map_t& mapping) -> streamed<results::routing> {
+    auto outgoing = m_routers.apply([&](router_map_t& mapping) -> outgoing_t<results::routing> {
         if(mapping.count(ruid) == 0 || (replace && mapping.erase(ruid))) {
             COCAINE_LOG_INFO(m_log, "attaching outgoing stream for router '{}'", ruid);
         }
@@ -686,10 +763,10 @@ locator_t::on_routing(const std::string& ruid, bool replace) -> streamed<results
     });
 
     // NOTE: Even if there's nothing to return, still send out an empty update.
-    if(auto ec = stream.write(results)) {
+    if(auto ec = outgoing.write(std::move(results))) {
         throw std::system_error(ec, format("failed to write to outgoing stream '{}'", ruid));
     }
-    return stream;
+    return outgoing.stream();
 }
 
 void
@@ -723,7 +800,9 @@ locator_t::on_service(const std::string& name, const results::resolve& meta, mod
     const auto response = results::connect{m_cfg.uuid, {{name, meta}}};
 
     for(auto it = mapping->begin(); it != mapping->end(); /***/) try {
-        it->second.write(response);
+        if(auto ec = it->second.write(response)) {
+            throw std::system_error(ec);
+        }
         it++;
     } catch(const std::system_error& e) {
         COCAINE_LOG_WARNING(m_log, "unable to enqueue service updates for locator '{}': {}",
@@ -758,7 +837,7 @@ locator_t::on_context_shutdown() {
             COCAINE_LOG_DEBUG(m_log, "closing {:d} outgoing locator streams", mapping.size());
         }
 
-        boost::for_each(mapping | boost::adaptors::map_values, [](streamed<results::connect>& s) {
+        boost::for_each(mapping | boost::adaptors::map_values, [](outgoing_t<results::connect>& s) {
             s.close();
         });
     });
@@ -770,7 +849,7 @@ locator_t::on_context_shutdown() {
             COCAINE_LOG_DEBUG(m_log, "closing {:d} outgoing routing streams", mapping.size());
         }
 
-        boost::for_each(mapping | boost::adaptors::map_values, [](streamed<results::routing>& s) {
+        boost::for_each(mapping | boost::adaptors::map_values, [](outgoing_t<results::routing>& s) {
             s.close();
         });
     });
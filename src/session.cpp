@@ -20,10 +20,12 @@
 
 #include "cocaine/rpc/session.hpp"
 
+#include <asio/deadline_timer.hpp>
 #include <asio/ip/tcp.hpp>
 #include <asio/local/stream_protocol.hpp>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/tss.hpp>
 
 #include <blackhole/logger.hpp>
 
@@ -33,12 +35,17 @@
 #include <metrics/registry.hpp>
 #include <metrics/timer.hpp>
 
+#include "chamber.hpp"
+
 #include "cocaine/hpack/static_table.hpp"
+#include "cocaine/idl/primitive.hpp"
 #include "cocaine/logging.hpp"
 #include "cocaine/rpc/asio/transport.hpp"
 #include "cocaine/rpc/basic_dispatch.hpp"
 #include "cocaine/rpc/dispatch.hpp"
 #include "cocaine/rpc/upstream.hpp"
+#include "cocaine/traits/map.hpp"
+#include "cocaine/utility/sharded.hpp"
 
 using namespace cocaine;
 using namespace cocaine::io;
@@ -55,19 +62,39 @@ class session_t::pull_action_t:
     // Keeps the session alive until all the operations are complete.
     const std::shared_ptr<session_t> session;
 
+    // The maximum number of messages handled per wakeup.
+    const size_t budget;
+
+    // Whether reading is suspended until the write queue drains.
+    bool paused;
+
 public:
-    pull_action_t(const std::shared_ptr<session_t>& session_):
-        session(session_)
+    pull_action_t(const std::shared_ptr<session_t>& session_, size_t budget_):
+        session(session_),
+        budget(budget_),
+        paused(false)
     { }
 
+   ~pull_action_t();
+
     void
     operator()(const std::shared_ptr<transport_type> ptr);
 
 private:
     void
     finalize(const std::error_code& ec);
+
+    void
+    resume();
 };
 
+session_t::pull_action_t::~pull_action_t() {
+    if(paused && session->metrics) {
+        // The session has been detached while waiting for its write queue to drain.
+        session->metrics->paused->fetch_sub(1);
+    }
+}
+
 void
 session_t::pull_action_t::operator()(const std::shared_ptr<transport_type> ptr) {
     ptr->reader->read(message, std::bind(&pull_action_t::finalize,
@@ -93,14 +120,21 @@ session_t::pull_action_t::finalize(const std::error_code& ec) {
 #else
     if(const auto ptr = *session->transport.synchronize()) {
 #endif
+        size_t frames = 0;
+        std::error_code result;
+
         try {
             // NOTE: In case the underlying slot has miserably failed to handle its exceptions, the
             // client will be disconnected to prevent any further damage to the service and himself.
 
-            // TODO: it seems that we can move it into and process message everywhere by value
-            // This can help to avoid unnecsesarry headers copy
-            session->handle(message);
-            message.clear();
+            // Pipelined messages which are already buffered are handled right away instead of going
+            // through the reactor queue one by one, but only up to the budget to stay fair to other
+            // sessions of the same execution unit. Detached sessions stop handling them immediately.
+            do {
+                session->handle(message);
+                message.clear();
+            } while(++frames < budget && !session->is_detached() &&
+                    ptr->reader->read_buffered(message, result));
         } catch(const std::system_error& e) {
             COCAINE_LOG_ERROR(session->log, "uncaught invocation exception: {}", error::to_string(e));
             return session->detach(e.code());
@@ -109,6 +143,30 @@ session_t::pull_action_t::finalize(const std::error_code& ec) {
             return session->detach(error::uncaught_error);
         }
 
+        if(session->metrics) {
+            session->metrics->wakeups->fetch_add(1);
+            session->metrics->frames->fetch_add(frames);
+        }
+
+        if(result) {
+            return finalize(result);
+        }
+
+        if(ptr->writer->congested()) {
+            // The peer doesn't read its replies fast enough, so stop reading its requests until the
+            // replies which are already queued are mostly sent.
+            COCAINE_LOG_DEBUG(session->log, "pausing reading, {:d} bytes queued for writing",
+                ptr->writer->pressure());
+
+            if(session->metrics) {
+                session->metrics->paused->fetch_add(1);
+            }
+
+            paused = true;
+
+            return ptr->writer->wait_drained(std::bind(&pull_action_t::resume, shared_from_this()));
+        }
+
         // Cycle the transport back into the message pump.
         operator()(std::move(ptr));
     } else {
@@ -116,79 +174,50 @@ session_t::pull_action_t::finalize(const std::error_code& ec) {
     }
 }
 
-class session_t::push_action_t:
-    public enable_shared_from_this<push_action_t>
-{
-    const encoder_t::message_type message;
-
-    // Keeps the session alive until all the operations are complete.
-    const std::shared_ptr<session_t> session;
-
-public:
-    push_action_t(encoder_t::message_type&& message, const std::shared_ptr<session_t>& session_):
-        message(std::move(message)),
-        session(session_)
-    { }
-
-    void
-    operator()(const std::shared_ptr<transport_type> ptr);
-
-private:
-    void
-    finalize(const std::error_code& ec);
-};
-
 void
-session_t::push_action_t::operator()(const std::shared_ptr<transport_type> ptr) {
-    if(!trace_t::current().empty()) {
-        if(trace_t::current().pushed()) {
-            COCAINE_LOG_DEBUG(session->log, "cs");
-        } else {
-            COCAINE_LOG_DEBUG(session->log, "ss");
-        }
+session_t::pull_action_t::resume() {
+    if(session->metrics) {
+        session->metrics->paused->fetch_sub(1);
     }
 
-    ptr->writer->write(message, trace_t::bind(&push_action_t::finalize,
-        shared_from_this(),
-        std::placeholders::_1
-    ));
-}
+    paused = false;
 
-void
-session_t::push_action_t::finalize(const std::error_code& ec) {
-    COCAINE_LOG_DEBUG(session->log, "after send");
-    if(ec.value() == 0) return;
+    // NOTE: The transport is not captured by the drain handler, since the handler is owned by the
+    // transport's writer itself.
+#if defined(__clang__)
+    if(const auto ptr = std::atomic_load(&session->transport)) {
+#else
+    if(const auto ptr = *session->transport.synchronize()) {
+#endif
+        COCAINE_LOG_DEBUG(session->log, "resuming reading, {:d} bytes queued for writing",
+            ptr->writer->pressure());
 
-    if(ec != asio::error::eof) {
-        COCAINE_LOG_ERROR(session->log, "client disconnected: [{:d}] {}", ec.value(), ec.message());
-    } else {
-        COCAINE_LOG_DEBUG(session->log, "client disconnected");
+        operator()(std::move(ptr));
     }
-
-    return session->detach(ec);
 }
 
 class load_watcher_t {
-    metrics::shared_metric<std::atomic<std::int64_t>> load;
+    utility::sharded_counter& load;
 
 public:
-    load_watcher_t(metrics::shared_metric<std::atomic<std::int64_t>> load) :
-        load(std::move(load))
+    load_watcher_t(utility::sharded_counter& load) :
+        load(load)
     {
-        this->load->fetch_add(1);
+        this->load.add(1);
     }
 
     ~load_watcher_t() {
-        this->load->fetch_add(-1);
+        this->load.add(-1);
     }
 };
 
 struct session_t::channel_t {
     dispatch_ptr_t dispatch;
     upstream_ptr_t upstream;
-    std::shared_ptr<load_watcher_t> load;
-    std::shared_ptr<metrics::timer_t::context_t> context;
     boost::optional<trace_t> trace;
+
+    // Bytes received on the channel since the last window update sent to the peer.
+    std::uint64_t consumed;
 };
 
 namespace {
@@ -202,6 +231,103 @@ dispatch_name(const dispatch_ptr_t& dispatch) -> std::string {
     }
 }
 
+// Accounts the write queue size of a single session in a gauge shared by all the sessions of the
+// same service, withdrawing it once the session's writer is destroyed.
+struct backlog_t {
+    typedef metrics::shared_metric<std::atomic<std::int64_t>> gauge_type;
+
+    explicit
+    backlog_t(gauge_type gauge_):
+        gauge(std::move(gauge_)),
+        reported(0)
+    { }
+
+   ~backlog_t() {
+        gauge->fetch_sub(reported);
+    }
+
+    void
+    update(std::int64_t size) {
+        gauge->fetch_add(size - reported);
+        reported = size;
+    }
+
+private:
+    const gauge_type gauge;
+    std::int64_t reported;
+};
+
+// Recycles the storage of destroyed channels, since a channel is allocated for every invocation. The
+// blocks are cached per thread, so that a channel destroyed in some other thread, e.g. by a shared
+// upstream, is handed out by that thread's pool next time.
+template<class T>
+struct pooled_t {
+    typedef T value_type;
+
+    static const size_t max_retained = 1024;
+
+    pooled_t() = default;
+
+    template<class U>
+    pooled_t(const pooled_t<U>&) { }
+
+    T*
+    allocate(size_t n) {
+        auto& blocks = pool();
+
+        if(n != 1 || blocks.empty()) {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+
+        auto block = blocks.back();
+        blocks.pop_back();
+
+        return static_cast<T*>(block);
+    }
+
+    void
+    deallocate(T* block, size_t n) {
+        auto& blocks = pool();
+
+        if(n != 1 || blocks.size() >= max_retained) {
+            return ::operator delete(block);
+        }
+
+        blocks.push_back(block);
+    }
+
+private:
+    struct blocks_t:
+        public std::vector<void*>
+    {
+       ~blocks_t() {
+            for(auto it = begin(); it != end(); ++it) ::operator delete(*it);
+        }
+    };
+
+    static
+    blocks_t&
+    pool() {
+        static boost::thread_specific_ptr<blocks_t> blocks;
+        if(blocks.get() == nullptr) {
+            blocks.reset(new blocks_t());
+        }
+        return *blocks.get();
+    }
+};
+
+template<class T, class U>
+bool
+operator==(const pooled_t<T>&, const pooled_t<U>&) {
+    return true;
+}
+
+template<class T, class U>
+bool
+operator!=(const pooled_t<T>&, const pooled_t<U>&) {
+    return false;
+}
+
 } // namespace
 
 // Session
@@ -216,23 +342,66 @@ struct session_t::metrics_t {
     /// Load gauge.
     metrics::shared_metric<std::atomic<std::int64_t>> load;
 
+    /// Read wakeups and messages handled during them. Their ratio shows how many pipelined messages
+    /// are handled per wakeup.
+    metrics::shared_metric<std::atomic<std::int64_t>> wakeups;
+    metrics::shared_metric<std::atomic<std::int64_t>> frames;
+
+    /// Number of sessions which don't read new messages because of their write queues being over
+    /// the high watermark, and the total size of messages queued for writing.
+    metrics::shared_metric<std::atomic<std::int64_t>> paused;
+    metrics::shared_metric<std::atomic<std::int64_t>> queued;
+
+    /// Write syscalls issued and messages completed by them. Their ratio shows how well outgoing
+    /// messages are coalesced.
+    metrics::shared_metric<std::atomic<std::int64_t>> syscalls;
+    metrics::shared_metric<std::atomic<std::int64_t>> messages;
+
+    /// Outgoing header bytes as if they were sent uncompressed and actually sent. Their ratio is the
+    /// achieved HPACK compression ratio.
+    metrics::shared_metric<std::atomic<std::int64_t>> headers_plain;
+    metrics::shared_metric<std::atomic<std::int64_t>> headers_packed;
+
+    /// Keepalive ping round-trip times and the number of sessions detached because of unanswered
+    /// pings.
+    timer_type rtt;
+    metrics::shared_metric<std::atomic<std::int64_t>> timeouts;
+
     /// Timers per slot.
     std::map<
         int,
         timer_type
     > timers;
 
-    metrics_t(metrics::registry_t& metrics_hub, session_t& session) :
-        summary(metrics_hub.meter(cocaine::format("{}.meter.summary", session.name()))),
+    /// Active and opened channels, updated for every invocation. These are sharded per thread and
+    /// are only added up into the load gauge and the RPS counter when published.
+    utility::sharded_counter active;
+    utility::sharded_counter opened;
+
+    metrics_t(metrics::registry_t& metrics_hub, const dispatch_ptr_t& prototype) :
+        summary(metrics_hub.meter(cocaine::format("{}.meter.summary", prototype->name()))),
         load{
-            metrics_hub.counter<std::int64_t>(cocaine::format("{}.load", session.name())),
-        }
+            metrics_hub.counter<std::int64_t>(cocaine::format("{}.load", prototype->name())),
+        },
+        wakeups(metrics_hub.counter<std::int64_t>(cocaine::format("{}.read.wakeups", prototype->name()))),
+        frames(metrics_hub.counter<std::int64_t>(cocaine::format("{}.read.frames", prototype->name()))),
+        paused(metrics_hub.counter<std::int64_t>(cocaine::format("{}.read.paused", prototype->name()))),
+        queued(metrics_hub.counter<std::int64_t>(cocaine::format("{}.write.queued", prototype->name()))),
+        syscalls(metrics_hub.counter<std::int64_t>(cocaine::format("{}.write.syscalls", prototype->name()))),
+        messages(metrics_hub.counter<std::int64_t>(cocaine::format("{}.write.messages", prototype->name()))),
+        headers_plain(metrics_hub.counter<std::int64_t>(cocaine::format("{}.hpack.plain", prototype->name()))),
+        headers_packed(metrics_hub.counter<std::int64_t>(cocaine::format("{}.hpack.packed", prototype->name()))),
+        rtt(metrics_hub.timer<metrics::accumulator::decaying::exponentially_t>(
+            cocaine::format("{}.ping.rtt", prototype->name()))),
+        timeouts(metrics_hub.counter<std::int64_t>(cocaine::format("{}.ping.timeouts", prototype->name()))),
+        published_active(0),
+        published_opened(0)
     {
-        for (auto& item : session.prototype->root()) {
+        for (auto& item : prototype->root()) {
             auto id = std::get<0>(item);
             auto& name = std::get<0>(std::get<1>(item));
 
-            auto metric_name = cocaine::format("{}.timer[{}]", session.prototype->name(), name);
+            auto metric_name = cocaine::format("{}.timer[{}]", prototype->name(), name);
             timers.emplace(
                 id,
                 metrics_hub.timer<metrics::accumulator::decaying::exponentially_t>(metric_name)
@@ -240,6 +409,11 @@ struct session_t::metrics_t {
         }
     }
 
+    ~metrics_t() {
+        // Withdraw whatever is left from the load gauge.
+        publish();
+    }
+
     auto
     timer(int id) const -> boost::optional<timer_type> {
         auto it = timers.find(id);
@@ -249,19 +423,164 @@ struct session_t::metrics_t {
 
         return it->second;
     }
+
+    /// Returns the metrics shared by all the sessions of the service. They are resolved in the
+    /// registry once, when the first session of the service is created.
+    static
+    auto
+    resolve(metrics::registry_t& metrics_hub, const dispatch_ptr_t& prototype) -> std::shared_ptr<metrics_t>;
+
+    /// Accounts the sharded counters changes since the last publication in the registry metrics.
+    void
+    publish();
+
+    struct entry_t {
+        std::weak_ptr<basic_dispatch_t> prototype;
+        std::weak_ptr<metrics_t> metrics;
+    };
+
+    /// Metrics of all the services with at least one alive session.
+    static
+    synchronized<std::vector<entry_t>>&
+    cache();
+
+private:
+    /// Sharded counter values already accounted in the registry metrics.
+    std::atomic<std::int64_t> published_active;
+    std::atomic<std::int64_t> published_opened;
 };
 
+synchronized<std::vector<session_t::metrics_t::entry_t>>&
+session_t::metrics_t::cache() {
+    static synchronized<std::vector<entry_t>> entries;
+    return entries;
+}
+
+auto
+session_t::metrics_t::resolve(metrics::registry_t& metrics_hub, const dispatch_ptr_t& prototype)
+    -> std::shared_ptr<metrics_t>
+{
+    return cache().apply([&](std::vector<entry_t>& entries) -> std::shared_ptr<metrics_t> {
+        for(auto it = entries.begin(); it != entries.end(); ++it) {
+            // NOTE: Checking the prototype itself as well, since a new service might be allocated
+            // at the same address after the old one is gone, while its sessions are still around.
+            if(it->prototype.lock() != prototype) {
+                continue;
+            }
+
+            if(auto ptr = it->metrics.lock()) {
+                return ptr;
+            }
+        }
+
+        auto ptr = std::make_shared<metrics_t>(metrics_hub, prototype);
+        entries.push_back(entry_t{prototype, ptr});
+
+        return ptr;
+    });
+}
+
+void
+session_t::metrics_t::publish() {
+    const auto now_active = active.load();
+
+    // NOTE: Adding up the differences instead of storing the value, so that the sessions of an old
+    // instance of the service which are still around are accounted in the same gauge as well.
+    load->fetch_add(now_active - published_active.exchange(now_active));
+
+    const auto now_opened = opened.load();
+
+    auto last = published_opened.load();
+
+    do {
+        if(now_opened <= last) {
+            // Someone else has already published it.
+            return;
+        }
+    } while(!published_opened.compare_exchange_weak(last, now_opened));
+
+    summary->mark(static_cast<std::uint64_t>(now_opened - last));
+}
+
+struct session_t::pings_t {
+    /// Round-trip time measurements of the unanswered keepalive pings of the session, oldest first.
+    /// Only used on the session's reactor.
+    std::deque<std::shared_ptr<metrics::timer_t::context_t>> contexts;
+};
+
+// NOTE: The upstream outlives its channel, so the invocation is accounted until the service drops
+// the upstream. The counters are safe to reference here, since the session owns the metrics.
 struct metered_upstream_t : public basic_upstream_t {
-    std::shared_ptr<load_watcher_t> load;
-    std::shared_ptr<metrics::timer_t::context_t> timer;
+    load_watcher_t load;
+    std::unique_ptr<metrics::timer_t::context_t> timer;
 
     metered_upstream_t(const std::shared_ptr<session_t>& session,
                        uint64_t channel_id,
-                       std::shared_ptr<load_watcher_t> load,
-                       std::shared_ptr<metrics::timer_t::context_t> timer)
-        : basic_upstream_t(session, channel_id), load(std::move(load)), timer(std::move(timer)) {}
+                       utility::sharded_counter& load,
+                       std::unique_ptr<metrics::timer_t::context_t> timer)
+        : basic_upstream_t(session, channel_id), load(load), timer(std::move(timer)) {}
+};
+
+class session_t::ping_action_t:
+    public std::enable_shared_from_this<ping_action_t>
+{
+    // Keeps the session alive until it's detached.
+    const std::shared_ptr<session_t> session;
+
+    asio::deadline_timer timer;
+
+    const boost::posix_time::time_duration interval;
+    const size_t misses;
+
+public:
+    ping_action_t(const std::shared_ptr<session_t>& session_,
+                  asio::io_service& asio,
+                  boost::posix_time::time_duration interval_,
+                  size_t misses_):
+        session(session_),
+        timer(asio),
+        interval(interval_),
+        misses(misses_)
+    { }
+
+    void
+    schedule();
+
+private:
+    void
+    finalize(const std::error_code& ec);
 };
 
+void
+session_t::ping_action_t::schedule() {
+    timer.expires_from_now(interval);
+    timer.async_wait(std::bind(&ping_action_t::finalize, shared_from_this(), std::placeholders::_1));
+}
+
+void
+session_t::ping_action_t::finalize(const std::error_code& ec) {
+    if(ec || session->is_detached()) {
+        return;
+    }
+
+    auto& pings = session->pings->contexts;
+
+    if(pings.size() >= misses) {
+        COCAINE_LOG_WARNING(session->log, "detaching session after {:d} unanswered ping(s)", pings.size());
+        session->metrics->timeouts->fetch_add(1);
+
+        // NOTE: The unanswered pings are still accounted as round trips lasting until now.
+        return session->detach(asio::error::timed_out);
+    }
+
+    pings.push_back(std::make_shared<metrics::timer_t::context_t>(session->metrics->rtt->context()));
+
+    // Channel zero is never opened by peers, so their replies can't be confused with anything else.
+    session->push(encoded<io::control::ping>(0));
+
+    schedule();
+}
+
 session_t::session_t(std::unique_ptr<logging::logger_t> log_,
                      metrics::registry_t& metrics_hub,
                      std::unique_ptr<transport_type> transport_,
@@ -269,10 +588,45 @@ session_t::session_t(std::unique_ptr<logging::logger_t> log_,
     : log(std::move(log_)),
       transport(std::shared_ptr<transport_type>(std::move(transport_))),
       prototype(prototype_),
-      max_channel_id(0)
+      max_channel_id(0),
+      sampling(1),
+      invocations(0),
+      initial_window_size(0),
+      granted_window_size(0),
+      draining(false),
+      peer_draining(false),
+      refused_channel_id(0)
 {
     if (prototype) {
-        metrics = std::make_unique<metrics_t>(metrics_hub, *this);
+        metrics = metrics_t::resolve(metrics_hub, prototype);
+        pings = std::make_unique<pings_t>();
+
+#if defined(__clang__)
+        const auto ptr = std::atomic_load(&transport);
+#else
+        const auto ptr = *transport.synchronize();
+#endif
+
+        auto syscalls = metrics->syscalls;
+        auto messages = metrics->messages;
+        auto plain    = metrics->headers_plain;
+        auto packed   = metrics->headers_packed;
+        auto backlog  = std::make_shared<backlog_t>(metrics->queued);
+
+        // NOTE: The observer is owned by the writer, so it's safe to capture a plain pointer here.
+        auto writer = ptr->writer.get();
+
+        ptr->writer->observe([=](size_t completed) {
+            syscalls->fetch_add(1);
+            messages->fetch_add(completed);
+
+            const auto stats = writer->encoder().drain();
+
+            plain->fetch_add(stats.plain);
+            packed->fetch_add(stats.packed);
+
+            backlog->update(writer->pressure());
+        });
     }
 
     auto dispatch = std::make_shared<cocaine::dispatch<io::control_tag>>("session");
@@ -283,6 +637,16 @@ session_t::session_t(std::unique_ptr<logging::logger_t> log_,
     dispatch->on<io::control::revoke>([&](std::uint64_t id, std::error_code ec) {
         revoke(id, ec);
     });
+    dispatch->on<io::control::settings>([&](const settings_type& settings) {
+        return negotiate(settings);
+    });
+    dispatch->on<io::control::goaway>([&](const std::error_code& ec) {
+        COCAINE_LOG_DEBUG(log, "peer is going away: [{:d}] {}", ec.value(), ec.message());
+        peer_draining = true;
+    });
+    dispatch->on<io::control::window_update>([&](std::uint64_t id, std::uint64_t increment) {
+        replenish(id, increment);
+    });
 
     service_dispatch = std::move(dispatch);
 }
@@ -296,48 +660,89 @@ session_t::handle(const decoder_t::message_type& message) {
     const channel_map_t::key_type channel_id = message.span();
     boost::optional<trace_t> trace;
 
-    const auto channel = channels.apply([&](channel_map_t& mapping) -> std::shared_ptr<channel_t> {
-        channel_map_t::const_iterator lb, ub;
+    if(channel_id == 0) {
+        // Connection-wide control channel, which is never opened by either side. Control events are
+        // handled right away, while anything else can only be a reply to a keepalive ping or to the
+        // announced settings. Only the latter carries any arguments.
+        const auto& args = message.args();
+
+        if(service_dispatch->root().count(message.type())) {
+            service_dispatch->process(message, std::make_shared<basic_upstream_t>(shared_from_this(), 0));
+        } else if(args.type == msgpack::type::ARRAY && args.via.array.size != 0) {
+            acknowledge(message);
+        } else {
+            pong(message.type());
+        }
+
+        return;
+    }
+
+    // NOTE: The virtual channel pointer is copied here to avoid data races.
+    std::shared_ptr<channel_t> channel;
+
+    // NOTE: Channels are only modified on this very reactor, so they're looked up without locking.
+    if(const auto ptr = channels.unsafe().find(channel_id)) {
+        channel = *ptr;
+        trace = channel->trace;
+    } else {
+        auto last = max_channel_id.load();
+
+        if(channel_id <= last) {
+            // NOTE: Checking whether channel number is always higher than the previous channel
+            // number is similar to an infinite TIME_WAIT timeout for TCP sockets. It might be not
+            // the best approach, but since we have 2^64 possible channels it's good enough.
+            throw std::system_error(error::revoked_channel, std::to_string(channel_id));
+        }
 
-        std::tie(lb, ub) = mapping.equal_range(channel_id);
+        if(draining && prototype && message.type() < prototype->root().size()) {
+            // NOTE: The peer has been told to go away, so it might retry the invocation elsewhere
+            // right away once the channel is revoked. Control messages are still handled as usual.
+            // Only the first message of every refused channel is answered, the rest of them are
+            // already covered by the revocation.
+            if(channel_id > refused_channel_id) {
+                COCAINE_LOG_DEBUG(log, "refusing new channel {:d} due to draining session", channel_id);
 
-        if(lb == ub) {
-            if(channel_id <= max_channel_id) {
-                // NOTE: Checking whether channel number is always higher than the previous channel
-                // number is similar to an infinite TIME_WAIT timeout for TCP sockets. It might be
-                // not the best approach, but since we have 2^64 possible channels it's good enough.
+                refused_channel_id = channel_id;
+                push(encoded<io::control::revoke>(0, channel_id, make_error_code(error::session_draining)));
+            }
+
+            return;
+        }
+
+        // Channel ids might be concurrently reserved by fork() as well.
+        while(!max_channel_id.compare_exchange_weak(last, channel_id)) {
+            if(channel_id <= last) {
                 throw std::system_error(error::revoked_channel, std::to_string(channel_id));
             }
+        }
 
-            trace = extract_trace(message);
-
-            auto timer = std::make_shared<metrics::timer_t::context_t>(metrics->timers.at(message.type())->context());
-            auto watcher = std::make_shared<load_watcher_t>(metrics->load);
-
-            std::tie(lb, std::ignore) = mapping.insert({channel_id, std::make_shared<channel_t>(
-                channel_t{
-                    select_dispatch(message),
-                    std::make_shared<metered_upstream_t>(
-                        shared_from_this(),
-                        channel_id,
-                        watcher,
-                        timer
-                    ),
-                    watcher,
-                    timer,
-                    trace
-                }
-            )});
-            metrics->summary->mark();
-
-            max_channel_id = channel_id;
-        } else {
-            trace = lb->second->trace;
+        trace = extract_trace(message);
+
+        std::unique_ptr<metrics::timer_t::context_t> timer;
+
+        if(invocations++ % sampling == 0) {
+            timer = std::make_unique<metrics::timer_t::context_t>(metrics->timers.at(message.type())->context());
         }
 
-        // NOTE: The virtual channel pointer is copied here to avoid data races.
-        return lb->second;
-    });
+        channel = std::allocate_shared<channel_t>(pooled_t<channel_t>(),
+            channel_t{
+                select_dispatch(message),
+                std::allocate_shared<metered_upstream_t>(pooled_t<metered_upstream_t>(),
+                    shared_from_this(),
+                    channel_id,
+                    metrics->active,
+                    std::move(timer)
+                ),
+                trace,
+                0
+            }
+        );
+
+        channels->insert(channel_id, channel);
+        metrics->opened.add(1);
+
+        enroll(channel->upstream);
+    }
 
     if(!channel->dispatch) {
         throw std::system_error(error::unbound_dispatch);
@@ -362,9 +767,34 @@ session_t::handle(const decoder_t::message_type& message) {
         }
     }
 
-    if((channel->dispatch = channel->dispatch->process(message, channel->upstream)
-        .get_value_or(channel->dispatch)) == nullptr)
-    {
+    // NOTE: The dispatch is kept alive to name the slot in case it turns out to be slow, even if
+    // the channel transitions away from it.
+    const auto dispatch = channel->dispatch;
+    const auto started = io::chamber_t::clock_type::now();
+
+    channel->dispatch = dispatch->process(message, channel->upstream).get_value_or(dispatch);
+
+    const auto elapsed = io::chamber_t::clock_type::now() - started;
+
+    if(elapsed >= std::chrono::milliseconds(io::chamber_t::kSlowHandlerThreshold)) {
+        const auto& root = dispatch->root();
+
+        io::chamber_t::account(dispatch->name(),
+            root.count(message.type()) ? std::get<0>(root.at(message.type())) : "<undefined>",
+            elapsed);
+    }
+
+    if(granted_window_size && channel->dispatch) {
+        channel->consumed += message.size();
+
+        // Replenish the peer's window once half of it is consumed, instead of after every message.
+        if(channel->consumed >= granted_window_size / 2) {
+            push(encoded<io::control::window_update>(0, channel_id, channel->consumed));
+            channel->consumed = 0;
+        }
+    }
+
+    if(channel->dispatch == nullptr) {
         // NOTE: If the client has sent us the last message according to our dispatch graph, revoke
         // the channel. No-op if the channel is no longer in the mapping, e.g., was discarded during
         // session::detach(), which was called during the dispatch::process().
@@ -376,7 +806,8 @@ session_t::handle(const decoder_t::message_type& message) {
 
 auto
 session_t::extract_trace(const io::decoder_t::message_type& message) const -> boost::optional<trace_t> {
-    auto& headers = message.headers();
+    // NOTE: Using header views here, so that the headers are never copied just to find the trace.
+    auto& headers = message.header_views();
 
     auto trace = hpack::header::find_first<hpack::headers::trace_id<>>(headers);
     auto span = hpack::header::find_first<hpack::headers::span_id<>>(headers);
@@ -384,13 +815,13 @@ session_t::extract_trace(const io::decoder_t::message_type& message) const -> bo
     if (trace && span && parent) {
         bool verbose = false;
         if (auto header = hpack::header::find_first(headers, "trace_bit")) {
-            verbose = boost::lexical_cast<bool>(header->value());
+            verbose = boost::lexical_cast<bool>(header->value().data, header->value().size);
         }
 
         return trace_t(
-            hpack::header::unpack<std::uint64_t>(trace->value()),
-            hpack::header::unpack<std::uint64_t>(span->value()),
-            hpack::header::unpack<std::uint64_t>(parent->value()),
+            hpack::header::unpack<std::uint64_t>(trace->value().data, trace->value().size),
+            hpack::header::unpack<std::uint64_t>(span->value().data, span->value().size),
+            hpack::header::unpack<std::uint64_t>(parent->value().data, parent->value().size),
             verbose,
             std::get<0>(prototype->root().at(message.type()))
         );
@@ -399,6 +830,73 @@ session_t::extract_trace(const io::decoder_t::message_type& message) const -> bo
     return boost::none;
 }
 
+auto
+session_t::negotiate(const settings_type& settings) -> settings_type {
+    const std::uint64_t capacity = hpack::header_table_t::max_data_capacity;
+
+    const auto it = settings.find("header_table_size");
+
+    // The peer's decoder must be able to hold every header this encoder might index.
+    const bool compress = it != settings.end() && it->second >= capacity;
+
+#if defined(__clang__)
+    if(const auto ptr = std::atomic_load(&transport)) {
+#else
+    if(const auto ptr = *transport.synchronize()) {
+#endif
+        // NOTE: Control messages are handled on the transport's reactor, same as the encoding.
+        ptr->writer->encoder().compress(compress);
+    }
+
+    const auto window = settings.find("initial_window_size");
+
+    if(window != settings.end()) {
+        // NOTE: Only the channels opened after that are flow controlled.
+        initial_window_size = window->second;
+    }
+
+    COCAINE_LOG_DEBUG(log, "negotiated session settings, header compression: {}, initial window: {}",
+        compress, initial_window_size.load());
+
+    return this->settings();
+}
+
+auto
+session_t::settings() const -> settings_type {
+    const std::uint64_t capacity = hpack::header_table_t::max_data_capacity;
+
+    settings_type result = {{"header_table_size", capacity}};
+
+    if(granted_window_size) {
+        result["initial_window_size"] = granted_window_size;
+    }
+
+    return result;
+}
+
+void
+session_t::acknowledge(const decoder_t::message_type& message) {
+    typedef io::protocol<io::event_traits<io::control::settings>::upstream_type>::sequence_type sequence_type;
+    typedef io::primitive<sequence_type>::value reply_type;
+
+    if(message.type() != static_cast<uint64_t>(io::event_traits<reply_type>::id)) {
+        COCAINE_LOG_DEBUG(log, "ignoring unexpected message type {} on channel 0", message.type());
+        return;
+    }
+
+    settings_type settings;
+
+    try {
+        io::type_traits<sequence_type>::unpack(message.args(), settings);
+    } catch(const msgpack::type_error& e) {
+        COCAINE_LOG_WARNING(log, "ignoring malformed settings acknowledgement: {}", e.what());
+        return;
+    }
+
+    // NOTE: The local settings have been already sent along with the announcement.
+    negotiate(settings);
+}
+
 auto
 session_t::select_dispatch(const io::decoder_t::message_type& message) const -> io::dispatch_ptr_t {
     // Hack to be able to properly dispatch control messages.
@@ -409,6 +907,36 @@ session_t::select_dispatch(const io::decoder_t::message_type& message) const ->
     }
 }
 
+void
+session_t::replenish(uint64_t id, std::uint64_t increment) {
+    // NOTE: The upstream is replenished outside of the lock, since it might be destroyed right after
+    // that, withdrawing its own window.
+    const auto upstream = windows.apply([&](const window_map_t& mapping) -> upstream_ptr_t {
+        const auto ptr = mapping.find(id);
+        return ptr ? ptr->lock() : nullptr;
+    });
+
+    if(!upstream) {
+        // The upstream might have been destroyed while the update was in flight.
+        COCAINE_LOG_DEBUG(log, "ignoring window update for unknown channel {:d}", id);
+        return;
+    }
+
+    upstream->replenish(increment);
+}
+
+void
+session_t::enroll(const upstream_ptr_t& upstream) {
+    if(upstream->flow_controlled()) {
+        windows->insert(upstream->channel_id(), upstream);
+    }
+}
+
+void
+session_t::withdraw(uint64_t id) {
+    windows->erase(id);
+}
+
 void
 session_t::revoke(uint64_t id) {
     revoke(id, std::error_code());
@@ -416,58 +944,189 @@ session_t::revoke(uint64_t id) {
 
 void
 session_t::revoke(uint64_t id, std::error_code ec) {
-    channels.apply([&](channel_map_t& mapping) {
-        auto it = mapping.find(id);
+    const bool drained = channels.apply([&](channel_map_t& mapping) {
+        const auto ptr = mapping.find(id);
 
-        if(it == mapping.end()) {
+        if(!ptr) {
             COCAINE_LOG_WARNING(log, "ignoring revoke request for channel {:d}", id);
-            return;
+            return false;
         }
 
-        if(it->second->dispatch) {
+        const auto& channel = *ptr;
+
+        if(channel->dispatch) {
             COCAINE_LOG_ERROR(log, "revoking channel {:d}, dispatch: '{}'", id,
-                it->second->dispatch->name());
-            it->second->dispatch->discard(ec);
+                channel->dispatch->name());
+            channel->dispatch->discard(ec);
         } else {
             COCAINE_LOG_DEBUG(log, "revoking channel {:d}", id);
         }
 
-        mapping.erase(it);
+        mapping.erase(id);
+
+        return draining && mapping.empty();
+    });
+
+    if(drained) {
+        close();
+    }
+}
+
+void
+session_t::drain(const std::error_code& ec, boost::posix_time::time_duration timeout) {
+#if defined(__clang__)
+    const auto ptr = std::atomic_load(&transport);
+#else
+    const auto ptr = *transport.synchronize();
+#endif
+
+    if(!ptr || draining.exchange(true)) {
+        return;
+    }
+
+    COCAINE_LOG_DEBUG(log, "draining session, {:d} active channel(s), timeout: {:d}s",
+        channels->size(), timeout.total_seconds());
+
+    // Channel zero is never opened by peers, so it's used for connection-wide control messages.
+    push(encoded<io::control::goaway>(0, ec));
+
+    const auto self = shared_from_this();
+
+    deadline = std::make_unique<asio::deadline_timer>(ptr->socket->get_io_service(), timeout);
+    deadline->async_wait([self](const std::error_code& code) {
+        if(code || self->is_detached()) {
+            return;
+        }
+
+        COCAINE_LOG_WARNING(self->log, "detaching session, which hasn't drained in time");
+        self->detach(asio::error::timed_out);
     });
+
+    if(channels->empty()) {
+        close();
+    }
+}
+
+void
+session_t::keepalive(boost::posix_time::time_duration interval, size_t misses) {
+#if defined(__clang__)
+    if(const auto ptr = std::atomic_load(&transport)) {
+#else
+    if(const auto ptr = *transport.synchronize()) {
+#endif
+        if(!metrics) {
+            // Round-trip times are accounted per service, so there's nowhere to put them.
+            return;
+        }
+
+        const auto action = std::make_shared<ping_action_t>(shared_from_this(),
+            ptr->socket->get_io_service(),
+            interval,
+            misses
+        );
+
+        ptr->socket->get_io_service().dispatch(std::bind(&ping_action_t::schedule, action));
+    } else {
+        throw std::system_error(error::not_connected);
+    }
+}
+
+void
+session_t::pong(uint64_t type) {
+    // Pings are answered with the value event of their primitive upstream protocol.
+    typedef io::protocol<io::event_traits<io::control::ping>::upstream_type>::sequence_type sequence_type;
+    typedef io::primitive<sequence_type>::value reply_type;
+
+    if(type != static_cast<uint64_t>(io::event_traits<reply_type>::id)) {
+        COCAINE_LOG_DEBUG(log, "ignoring unexpected message type {} on channel 0", type);
+        return;
+    }
+
+    if(!pings || pings->contexts.empty()) {
+        COCAINE_LOG_DEBUG(log, "ignoring unsolicited message on channel 0");
+        return;
+    }
+
+    // Destroying the measurement context accounts the round-trip time.
+    pings->contexts.pop_front();
+}
+
+void
+session_t::close() {
+#if defined(__clang__)
+    if(const auto ptr = std::atomic_load(&transport)) {
+#else
+    if(const auto ptr = *transport.synchronize()) {
+#endif
+        const auto self = shared_from_this();
+
+        // NOTE: The writer is only ever used on its reactor. The transport is not captured by the
+        // flush handler, since it's owned by the writer.
+        ptr->socket->get_io_service().dispatch([self, ptr]() {
+            ptr->writer->wait_flushed([self]() {
+                COCAINE_LOG_DEBUG(self->log, "session has been drained");
+                self->detach(std::error_code());
+            });
+        });
+    }
 }
 
 upstream_ptr_t
 session_t::fork(const dispatch_ptr_t& dispatch) {
-    return channels.apply([&](channel_map_t& mapping) -> upstream_ptr_t {
-        const auto channel_id = ++max_channel_id;
-        auto trace = trace_t::current();
-        trace.push(dispatch_name(dispatch));
-        const auto downstream = std::make_shared<basic_upstream_t>(shared_from_this(), channel_id);
-
-        COCAINE_LOG_DEBUG(log, "forking new channel {:d}, dispatch: '{}'", channel_id, dispatch_name(dispatch));
-
-        if(dispatch) {
-            // NOTE: For mute slots, creating a new channel will essentially leak memory, since no
-            // response will ever be sent back, therefore the channel will never be revoked at all.
-            mapping.insert({channel_id, std::make_shared<channel_t>(
-                channel_t{
-                    dispatch,
-                    downstream,
-                    nullptr,
-                    nullptr,
-                    trace
-                }
-            )});
-        }
+    if(peer_draining) {
+        throw std::system_error(error::session_draining);
+    }
 
+    const auto channel_id = ++max_channel_id;
+    auto trace = trace_t::current();
+    trace.push(dispatch_name(dispatch));
+    const auto downstream = std::make_shared<basic_upstream_t>(shared_from_this(), channel_id);
+
+    enroll(downstream);
+
+    COCAINE_LOG_DEBUG(log, "forking new channel {:d}, dispatch: '{}'", channel_id, dispatch_name(dispatch));
+
+    if(!dispatch) {
         return downstream;
-    });
+    }
+
+    // NOTE: For mute slots, creating a new channel will essentially leak memory, since no response
+    // will ever be sent back, therefore the channel will never be revoked at all.
+    const auto channel = std::allocate_shared<channel_t>(pooled_t<channel_t>(),
+        channel_t{
+            dispatch,
+            downstream,
+            trace,
+            0
+        }
+    );
+
+#if defined(__clang__)
+    if(const auto ptr = std::atomic_load(&transport)) {
+#else
+    if(const auto ptr = *transport.synchronize()) {
+#endif
+        const auto self = shared_from_this();
+
+        // NOTE: Channels are only modified on the reactor. The insertion is queued before any message
+        // can be pushed into the new channel, so it's always there by the time the peer replies.
+        ptr->socket->get_io_service().dispatch([self, channel_id, channel]() {
+            if(self->is_detached()) {
+                // Channels have been already discarded.
+                return;
+            }
+
+            self->channels->insert(channel_id, channel);
+        });
+    }
+
+    return downstream;
 }
 
 // Channel I/O
 
 void
-session_t::pull() {
+session_t::pull(size_t budget) {
 #if defined(__clang__)
     if(const auto ptr = std::atomic_load(&transport)) {
 #else
@@ -475,7 +1134,7 @@ session_t::pull() {
 #endif
         // Use dispatch() instead of a direct call for thread safety.
         ptr->socket->get_io_service().dispatch(std::bind(&pull_action_t::operator(),
-            std::make_shared<pull_action_t>(shared_from_this()),
+            std::make_shared<pull_action_t>(shared_from_this(), budget),
             ptr
         ));
     } else {
@@ -483,6 +1142,30 @@ session_t::pull() {
     }
 }
 
+void
+session_t::throttle(size_t high, size_t low) {
+#if defined(__clang__)
+    if(const auto ptr = std::atomic_load(&transport)) {
+#else
+    if(const auto ptr = *transport.synchronize()) {
+#endif
+        ptr->writer->watermarks(high, low);
+    } else {
+        throw std::system_error(error::not_connected);
+    }
+}
+
+void
+session_t::grant(std::uint64_t window) {
+    granted_window_size = window;
+}
+
+void
+session_t::sample(size_t rate) {
+    BOOST_ASSERT(rate > 0);
+    sampling = rate;
+}
+
 void
 session_t::push(encoder_t::message_type&& message) {
 #if defined(__clang__)
@@ -490,9 +1173,19 @@ session_t::push(encoder_t::message_type&& message) {
 #else
     if(const auto ptr = *transport.synchronize()) {
 #endif
+        const bool idle = outbox.apply([&](std::vector<outgoing_t>& queue) -> bool {
+            queue.push_back({trace_t::current(), std::move(message)});
+            return queue.size() == 1;
+        });
+
+        if(!idle) {
+            // The write is already scheduled and will pick this message up as well.
+            return;
+        }
+
         // Use dispatch() instead of a direct call for thread safety.
-        ptr->socket->get_io_service().dispatch(trace_t::bind(&push_action_t::operator(),
-            std::make_shared<push_action_t>(std::move(message), shared_from_this()),
+        ptr->socket->get_io_service().dispatch(std::bind(&session_t::flush,
+            shared_from_this(),
             ptr
         ));
     } else {
@@ -500,6 +1193,58 @@ session_t::push(encoder_t::message_type&& message) {
     }
 }
 
+void
+session_t::announce() {
+    push(encoded<io::control::settings>(0, settings()));
+}
+
+void
+session_t::flush(const std::shared_ptr<transport_type>& ptr) {
+    std::vector<outgoing_t> batch;
+
+    // NOTE: The spare queue is taken out first, so that this works even if some write ends up pushing
+    // more messages synchronously.
+    batch.swap(outbox_spare);
+
+    outbox.apply([&](std::vector<outgoing_t>& queue) {
+        queue.swap(batch);
+    });
+
+    for(auto it = batch.begin(); it != batch.end(); ++it) {
+        trace_t::restore_scope_t scope(it->trace);
+
+        if(!trace_t::current().empty()) {
+            if(trace_t::current().pushed()) {
+                COCAINE_LOG_DEBUG(log, "cs");
+            } else {
+                COCAINE_LOG_DEBUG(log, "ss");
+            }
+        }
+
+        ptr->writer->write(std::move(it->message), std::bind(&session_t::pushed,
+            shared_from_this(),
+            std::placeholders::_1
+        ));
+    }
+
+    batch.clear();
+    batch.swap(outbox_spare);
+}
+
+void
+session_t::pushed(const std::error_code& ec) {
+    COCAINE_LOG_DEBUG(log, "after send");
+    if(ec.value() == 0) return;
+
+    if(ec != asio::error::eof) {
+        COCAINE_LOG_ERROR(log, "client disconnected: [{:d}] {}", ec.value(), ec.message());
+    } else {
+        COCAINE_LOG_DEBUG(log, "client disconnected");
+    }
+
+    return detach(ec);
+}
+
 void
 session_t::detach(const std::error_code& ec) {
 #if defined(__clang__)
@@ -507,12 +1252,27 @@ session_t::detach(const std::error_code& ec) {
 #else
     if(auto swapped = std::move(*transport.synchronize())) {
 #endif
+        auto& reactor = swapped->socket->get_io_service();
+
         swapped = nullptr;
         COCAINE_LOG_DEBUG(log, "detached session from the transport");
+
+        const auto self = shared_from_this();
+
+        // NOTE: Channels are only modified on the reactor, which is still running, since it's owned
+        // by the execution unit and not by the session.
+        reactor.dispatch([self, ec]() {
+            self->discard(ec);
+        });
     } else {
         COCAINE_LOG_WARNING(log, "ignoring detach request for session");
-        return;
     }
+}
+
+void
+session_t::discard(const std::error_code& ec) {
+    // Destroying the timer cancels the wait, so that the reactor doesn't have to wait for it.
+    deadline.reset();
 
     channels.apply([&](channel_map_t& mapping) {
         if(mapping.empty()) {
@@ -521,14 +1281,35 @@ session_t::detach(const std::error_code& ec) {
             COCAINE_LOG_DEBUG(log, "discarding {:d} channel dispatch(es)", mapping.size());
         }
 
-        for(auto it = mapping.begin(); it != mapping.end(); ++it) {
-            if(it->second->dispatch) it->second->dispatch->discard(ec);
-        }
+        mapping.each([&](uint64_t, const std::shared_ptr<channel_t>& channel) {
+            if(channel->dispatch) channel->dispatch->discard(ec);
+        });
 
         mapping.clear();
     });
 }
 
+void
+session_t::publish_metrics() {
+    std::vector<std::shared_ptr<metrics_t>> alive;
+
+    metrics_t::cache().apply([&](std::vector<metrics_t::entry_t>& entries) {
+        for(auto it = entries.begin(); it != entries.end();) {
+            if(auto ptr = it->metrics.lock()) {
+                alive.push_back(std::move(ptr));
+                ++it;
+            } else {
+                it = entries.erase(it);
+            }
+        }
+    });
+
+    // NOTE: Publishing outside of the lock, since the metrics might be destroyed right here.
+    for(auto it = alive.begin(); it != alive.end(); ++it) {
+        (*it)->publish();
+    }
+}
+
 // Information
 
 std::map<uint64_t, std::string>
@@ -536,14 +1317,28 @@ session_t::active_channels() const {
     return channels.apply([](const channel_map_t& mapping) -> std::map<uint64_t, std::string> {
         std::map<uint64_t, std::string> result;
 
-        for(auto it = mapping.begin(); it != mapping.end(); ++it) {
-            result[it->first] = dispatch_name(it->second->dispatch);
-        }
+        mapping.each([&](uint64_t id, const std::shared_ptr<channel_t>& channel) {
+            result[id] = dispatch_name(channel->dispatch);
+        });
 
         return result;
     });
 }
 
+std::size_t
+session_t::active_channels_count() const {
+    return channels->size();
+}
+
+bool
+session_t::is_detached() const {
+#if defined(__clang__)
+    return !std::atomic_load(&transport);
+#else
+    return !*transport.synchronize();
+#endif
+}
+
 std::size_t
 session_t::memory_pressure() const {
 #if defined(__clang__)
@@ -557,6 +1352,11 @@ session_t::memory_pressure() const {
     }
 }
 
+std::uint64_t
+session_t::initial_window() const {
+    return initial_window_size;
+}
+
 std::string
 session_t::name() const {
     return dispatch_name(prototype);
@@ -0,0 +1,665 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/rpc/asio/uring.hpp"
+
+#include <asio/buffer.hpp>
+#include <asio/error.hpp>
+#include <asio/posix/stream_descriptor.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#if defined(COCAINE_HAVE_IO_URING)
+    #include <linux/io_uring.h>
+#endif
+
+// Multishot receives and buffer rings are only available since Linux 6.0.
+#if defined(IORING_RECV_MULTISHOT)
+    #define COCAINE_USE_IO_URING
+
+    #include <sys/eventfd.h>
+    #include <sys/mman.h>
+    #include <sys/socket.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+
+    #include <cerrno>
+    #include <cstring>
+#endif
+
+using namespace cocaine::io;
+
+#if defined(COCAINE_USE_IO_URING)
+
+namespace {
+
+const std::uint16_t kBufferGroup = 0;
+
+// Cancellations are submitted with this tag and their completions are ignored.
+const std::uint64_t kIgnored = 0;
+
+int
+setup(unsigned int entries, io_uring_params& params) {
+    return ::syscall(__NR_io_uring_setup, entries, &params);
+}
+
+int
+enter(int fd, unsigned int submit) {
+    return ::syscall(__NR_io_uring_enter, fd, submit, 0, 0, nullptr, 0);
+}
+
+int
+enroll(int fd, unsigned int opcode, void* arguments, unsigned int count) {
+    return ::syscall(__NR_io_uring_register, fd, opcode, arguments, count);
+}
+
+auto
+make_error(int error) -> std::error_code {
+    if(error == ECANCELED) {
+        return asio::error::operation_aborted;
+    }
+
+    return std::error_code(error, std::system_category());
+}
+
+} // namespace
+
+class uring_service_t::ring_t {
+    COCAINE_DECLARE_NONCOPYABLE(ring_t)
+
+    static const unsigned int kSubmissionEntries = 256;
+    static const unsigned int kCompletionEntries = 4096;
+
+    struct operation_t {
+        int fd;
+
+        receive_handler_type on_receive;
+        send_handler_type on_send;
+
+        // Cancelled receives are not resumed when the kernel stops them for some other reason.
+        bool cancelled;
+    };
+
+    asio::io_service& asio;
+
+    int fd;
+    io_uring_params params;
+
+    // Both the submission and the completion queues share the same mapping.
+    void*  queues;
+    size_t queues_size;
+
+    io_uring_sqe* sqes;
+
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int  sq_mask;
+
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int  cq_mask;
+
+    io_uring_cqe* cqes;
+
+    // Submissions are published to the kernel all at once by the deferred submit().
+    unsigned int prepared;
+    bool submitting;
+
+    // Submissions prepared while the submission queue is full. They are moved there in order, once the
+    // kernel consumes some of the queue, and nothing else is queued before them.
+    std::deque<io_uring_sqe> backlog;
+
+    // Buffers the multishot receives land in, along with the ring they are handed to the kernel by.
+    std::vector<char> storage;
+
+    io_uring_buf*  buffers;
+    std::uint16_t* buffers_tail;
+    std::uint16_t  recycled;
+
+    // Signalled by the kernel for every completion.
+    asio::posix::stream_descriptor notifier;
+    std::uint64_t notifications;
+
+    std::unordered_map<std::uint64_t, std::unique_ptr<operation_t>> operations;
+    std::uint64_t next;
+
+public:
+    explicit
+    ring_t(asio::io_service& asio);
+
+   ~ring_t();
+
+    auto
+    receive(int fd, receive_handler_type handler) -> std::uint64_t;
+
+    void
+    send(int fd, const msghdr* header, send_handler_type handler);
+
+    void
+    cancel(std::uint64_t operation);
+
+private:
+    // Number of entries the submission queue has room for.
+    auto
+    vacant() const -> unsigned int;
+
+    auto
+    prepare() -> io_uring_sqe*;
+
+    void
+    prepare_receive(std::uint64_t operation, int fd);
+
+    void
+    submit();
+
+    void
+    wait();
+
+    void
+    reap(const std::error_code& ec);
+
+    // Handles all the completions posted so far.
+    void
+    consume();
+
+    void
+    complete(const io_uring_cqe& cqe);
+
+    void
+    recycle(std::uint16_t buffer);
+
+    void
+    release();
+};
+
+uring_service_t::ring_t::ring_t(asio::io_service& asio_):
+    asio(asio_),
+    queues(MAP_FAILED),
+    queues_size(0),
+    sqes(static_cast<io_uring_sqe*>(MAP_FAILED)),
+    prepared(0),
+    submitting(false),
+    storage(kBufferCount * kBufferSize),
+    buffers(static_cast<io_uring_buf*>(MAP_FAILED)),
+    recycled(0),
+    notifier(asio_),
+    next(kIgnored + 1)
+{
+    std::memset(&params, 0, sizeof(params));
+
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = kCompletionEntries;
+
+    if((fd = setup(kSubmissionEntries, params)) < 0) {
+        throw std::system_error(errno, std::system_category(), "unable to set up the io_uring");
+    }
+
+    try {
+        queues_size = std::max(
+            params.sq_off.array + params.sq_entries * sizeof(unsigned int),
+            params.cq_off.cqes  + params.cq_entries * sizeof(io_uring_cqe)
+        );
+
+        queues = ::mmap(nullptr, queues_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+            IORING_OFF_SQ_RING);
+
+        if(queues == MAP_FAILED) {
+            throw std::system_error(errno, std::system_category(), "unable to map the io_uring queues");
+        }
+
+        sqes = static_cast<io_uring_sqe*>(::mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+
+        if(sqes == MAP_FAILED) {
+            throw std::system_error(errno, std::system_category(), "unable to map the io_uring entries");
+        }
+
+        char* base = static_cast<char*>(queues);
+
+        sq_head = reinterpret_cast<unsigned int*>(base + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned int*>(base + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned int*>(base + params.sq_off.ring_mask);
+
+        // Submission entries are always taken in order, so the indirection array is the identity.
+        unsigned int* array = reinterpret_cast<unsigned int*>(base + params.sq_off.array);
+
+        for(unsigned int i = 0; i < params.sq_entries; ++i) {
+            array[i] = i;
+        }
+
+        cq_head = reinterpret_cast<unsigned int*>(base + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned int*>(base + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned int*>(base + params.cq_off.ring_mask);
+
+        cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+
+        buffers = static_cast<io_uring_buf*>(::mmap(nullptr, kBufferCount * sizeof(io_uring_buf),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+
+        if(buffers == MAP_FAILED) {
+            throw std::system_error(errno, std::system_category(), "unable to map the buffer ring");
+        }
+
+        io_uring_buf_reg ring;
+
+        std::memset(&ring, 0, sizeof(ring));
+
+        ring.ring_addr    = reinterpret_cast<std::uintptr_t>(buffers);
+        ring.ring_entries = kBufferCount;
+        ring.bgid         = kBufferGroup;
+
+        if(enroll(fd, IORING_REGISTER_PBUF_RING, &ring, 1) < 0) {
+            throw std::system_error(errno, std::system_category(), "unable to register the buffer ring");
+        }
+
+        // NOTE: The tail of the buffer ring overlays the reserved field of its first entry.
+        buffers_tail = &buffers[0].resv;
+
+        for(size_t i = 0; i < kBufferCount; ++i) {
+            recycle(static_cast<std::uint16_t>(i));
+        }
+
+        int descriptor = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if(descriptor < 0) {
+            throw std::system_error(errno, std::system_category(), "unable to create the eventfd");
+        }
+
+        notifier.assign(descriptor);
+
+        if(enroll(fd, IORING_REGISTER_EVENTFD, &descriptor, 1) < 0) {
+            throw std::system_error(errno, std::system_category(), "unable to register the eventfd");
+        }
+    } catch(...) {
+        release();
+        throw;
+    }
+
+    wait();
+}
+
+uring_service_t::ring_t::~ring_t() {
+    release();
+}
+
+void
+uring_service_t::ring_t::release() {
+    std::error_code ec;
+
+    notifier.close(ec);
+
+    // NOTE: Closing the ring cancels all the operations still in flight.
+    ::close(fd);
+
+    if(buffers != MAP_FAILED) {
+        ::munmap(buffers, kBufferCount * sizeof(io_uring_buf));
+    }
+
+    if(sqes != MAP_FAILED) {
+        ::munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+    }
+
+    if(queues != MAP_FAILED) {
+        ::munmap(queues, queues_size);
+    }
+}
+
+auto
+uring_service_t::ring_t::receive(int fd, receive_handler_type handler) -> std::uint64_t {
+    const auto operation = next++;
+
+    operations[operation].reset(new operation_t{fd, std::move(handler), nullptr, false});
+
+    prepare_receive(operation, fd);
+
+    return operation;
+}
+
+void
+uring_service_t::ring_t::send(int fd, const msghdr* header, send_handler_type handler) {
+    const auto operation = next++;
+
+    operations[operation].reset(new operation_t{fd, nullptr, std::move(handler), false});
+
+    io_uring_sqe* sqe = prepare();
+
+    sqe->opcode    = IORING_OP_SENDMSG;
+    sqe->fd        = fd;
+    sqe->addr      = reinterpret_cast<std::uintptr_t>(header);
+    sqe->len       = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = operation;
+}
+
+void
+uring_service_t::ring_t::cancel(std::uint64_t operation) {
+    auto it = operations.find(operation);
+
+    if(it == operations.end() || it->second->cancelled) {
+        return;
+    }
+
+    it->second->cancelled = true;
+
+    io_uring_sqe* sqe = prepare();
+
+    sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+    sqe->fd        = -1;
+    sqe->addr      = operation;
+    sqe->user_data = kIgnored;
+}
+
+auto
+uring_service_t::ring_t::vacant() const -> unsigned int {
+    return params.sq_entries - (prepared - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE));
+}
+
+auto
+uring_service_t::ring_t::prepare() -> io_uring_sqe* {
+    io_uring_sqe* sqe;
+
+    if(backlog.empty() && vacant()) {
+        sqe = &sqes[prepared++ & sq_mask];
+    } else {
+        // NOTE: Entries of a deque stay in place while it grows at the back.
+        backlog.emplace_back();
+        sqe = &backlog.back();
+    }
+
+    std::memset(sqe, 0, sizeof(*sqe));
+
+    if(!submitting) {
+        submitting = true;
+
+        // Handlers which are already queued in the reactor might prepare more submissions, so they
+        // are all published with a single syscall after them.
+        asio.post(std::bind(&ring_t::submit, this));
+    }
+
+    return sqe;
+}
+
+void
+uring_service_t::ring_t::prepare_receive(std::uint64_t operation, int fd) {
+    io_uring_sqe* sqe = prepare();
+
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->fd        = fd;
+    sqe->buf_group = kBufferGroup;
+    sqe->user_data = operation;
+}
+
+void
+uring_service_t::ring_t::submit() {
+    bool reaped = false;
+
+    while(true) {
+        // Fill the space the kernel has consumed so far with the backlog.
+        while(!backlog.empty() && vacant()) {
+            sqes[prepared++ & sq_mask] = backlog.front();
+            backlog.pop_front();
+        }
+
+        __atomic_store_n(sq_tail, prepared, __ATOMIC_RELEASE);
+
+        const unsigned int pending = prepared - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+        if(!pending) {
+            break;
+        }
+
+        const int rv = enter(fd, pending);
+
+        if(rv > 0 || (rv < 0 && errno == EINTR)) {
+            continue;
+        }
+
+        if(reaped) {
+            // Still no progress, so the rest is submitted on the next loop iteration.
+            break;
+        }
+
+        // The kernel is short of resources or the completion queue is overflown, so the completions
+        // are reaped first to make some room. Their handlers might prepare more submissions, which
+        // are picked up right away.
+        consume();
+        reaped = true;
+    }
+
+    submitting = prepared != __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) || !backlog.empty();
+
+    if(submitting) {
+        asio.post(std::bind(&ring_t::submit, this));
+    }
+}
+
+void
+uring_service_t::ring_t::wait() {
+    namespace ph = std::placeholders;
+
+    notifier.async_read_some(asio::buffer(&notifications, sizeof(notifications)),
+        std::bind(&ring_t::reap, this, ph::_1));
+}
+
+void
+uring_service_t::ring_t::reap(const std::error_code& ec) {
+    if(ec == asio::error::operation_aborted) {
+        return;
+    }
+
+    // NOTE: The eventfd counter is reset before the completions are reaped, so that completions
+    // posted after that wake the reactor up again.
+    consume();
+
+    wait();
+}
+
+void
+uring_service_t::ring_t::consume() {
+    unsigned int head = *cq_head;
+
+    while(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        const io_uring_cqe cqe = cqes[head++ & cq_mask];
+
+        // The entry is copied, so it's given back to the kernel before the completion is handled.
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+        complete(cqe);
+    }
+}
+
+void
+uring_service_t::ring_t::complete(const io_uring_cqe& cqe) {
+    if(cqe.user_data == kIgnored) {
+        return;
+    }
+
+    auto it = operations.find(cqe.user_data);
+
+    if(it == operations.end()) {
+        return;
+    }
+
+    auto& operation = *it->second;
+
+    if(operation.on_send) {
+        auto handler = std::move(operation.on_send);
+
+        operations.erase(it);
+
+        if(cqe.res < 0) {
+            return handler(make_error(-cqe.res), 0);
+        } else {
+            return handler(std::error_code(), static_cast<size_t>(cqe.res));
+        }
+    }
+
+    if(cqe.res > 0) {
+        const auto buffer = static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+
+        operation.on_receive(std::error_code(), storage.data() + buffer * kBufferSize,
+            static_cast<size_t>(cqe.res));
+
+        recycle(buffer);
+    }
+
+    if(cqe.flags & IORING_CQE_F_MORE) {
+        return;
+    }
+
+    // The kernel stops multishot receives when it runs out of buffers, among other things. These are
+    // resumed transparently, unless cancelled.
+    if((cqe.res > 0 || cqe.res == -ENOBUFS) && !operation.cancelled) {
+        return prepare_receive(it->first, operation.fd);
+    }
+
+    std::error_code error;
+
+    if(cqe.res == 0) {
+        error = asio::error::eof;
+    } else if(cqe.res > 0 || operation.cancelled) {
+        error = asio::error::operation_aborted;
+    } else {
+        error = make_error(-cqe.res);
+    }
+
+    auto handler = std::move(operation.on_receive);
+
+    operations.erase(it);
+
+    handler(error, nullptr, 0);
+}
+
+void
+uring_service_t::ring_t::recycle(std::uint16_t buffer) {
+    io_uring_buf& entry = buffers[recycled & (kBufferCount - 1)];
+
+    entry.addr = reinterpret_cast<std::uintptr_t>(storage.data() + buffer * kBufferSize);
+    entry.len  = kBufferSize;
+    entry.bid  = buffer;
+
+    __atomic_store_n(buffers_tail, ++recycled, __ATOMIC_RELEASE);
+}
+
+#else
+
+// Stub for the platforms without io_uring, where the ring is never set up.
+class uring_service_t::ring_t {
+public:
+    auto
+    receive(int, receive_handler_type) -> std::uint64_t {
+        return 0;
+    }
+
+    void
+    send(int, const msghdr*, send_handler_type) { }
+
+    void
+    cancel(std::uint64_t) { }
+};
+
+#endif
+
+asio::io_service::id uring_service_t::id;
+
+uring_service_t::uring_service_t(asio::io_service& asio):
+    asio::io_service::service(asio)
+{ }
+
+uring_service_t::~uring_service_t() = default;
+
+bool
+uring_service_t::supported() {
+#if defined(COCAINE_USE_IO_URING)
+    static const bool result = [] {
+        io_uring_params params;
+
+        std::memset(&params, 0, sizeof(params));
+
+        const int fd = setup(1, params);
+
+        if(fd < 0) {
+            // Either not built into the kernel or disabled via sysctl or seccomp.
+            return false;
+        }
+
+        const unsigned int count = 256;
+
+        std::vector<char> storage(sizeof(io_uring_probe) + count * sizeof(io_uring_probe_op));
+        auto probe = reinterpret_cast<io_uring_probe*>(storage.data());
+
+        const bool probed = enroll(fd, IORING_REGISTER_PROBE, probe, count) == 0;
+
+        ::close(fd);
+
+        // Zero-copy sends were introduced by the same kernel release as multishot receives, which
+        // can't be probed for on their own.
+        return probed && probe->last_op >= IORING_OP_SEND_ZC &&
+            (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED);
+    }();
+
+    return result;
+#else
+    return false;
+#endif
+}
+
+bool
+uring_service_t::configure(bool enable) {
+    if(!enable || !supported()) {
+        m_ring.reset();
+    } else if(!m_ring) {
+#if defined(COCAINE_USE_IO_URING)
+        m_ring.reset(new ring_t(get_io_service()));
+#endif
+    }
+
+    return enabled();
+}
+
+bool
+uring_service_t::enabled() const {
+    return static_cast<bool>(m_ring);
+}
+
+auto
+uring_service_t::receive(int fd, receive_handler_type handler) -> std::uint64_t {
+    return m_ring->receive(fd, std::move(handler));
+}
+
+void
+uring_service_t::send(int fd, const msghdr* header, send_handler_type handler) {
+    m_ring->send(fd, header, std::move(handler));
+}
+
+void
+uring_service_t::cancel(std::uint64_t operation) {
+    m_ring->cancel(operation);
+}
+
+void
+uring_service_t::shutdown_service() {
+    m_ring.reset();
+}
@@ -215,4 +215,51 @@ BENCHMARK_F(ClientIoBenchmark65K, EchoSlot, test_fixture_t, 10, 100000) {
     service.invoke<cocaine::io::test::echo_slot>(nullptr, globals().data65K);
 }
 
+// Connections accepted per second, from the acceptor down to the session being attached to one of
+// the execution units. Connections are established by the kernel before they're accepted, so once
+// the listen backlog fills up, new connections are only established as fast as they are accepted.
+
+struct connection_fixture_t:
+    public celero::TestFixture
+{
+    std::unique_ptr<cocaine::context_t> context;
+    std::unique_ptr<asio::io_service> reactor;
+
+    std::vector<asio::ip::tcp::endpoint> endpoints;
+
+public:
+    virtual
+    void
+    setUp(int64_t) {
+        context.reset(new cocaine::context_t(cocaine::config_t("cocaine-benchmark.conf"), "core"));
+        reactor.reset(new asio::io_service());
+
+        context->insert("benchmark", std::make_unique<cocaine::actor_t>(
+           *context,
+            std::make_shared<asio::io_service>(),
+            std::make_unique<cocaine::test_service_t>()
+        ));
+
+        endpoints = context->locate("benchmark").get().endpoints();
+    }
+
+    virtual
+    void
+    tearDown() {
+        context->remove("benchmark");
+    }
+
+    void
+    connect() {
+        asio::ip::tcp::socket socket(*reactor);
+
+        asio::connect(socket, endpoints.begin(), endpoints.end());
+        socket.close();
+    }
+};
+
+BASELINE_F (AcceptBenchmark, ConnectClose, connection_fixture_t, 10, 10000) {
+    connect();
+}
+
 CELERO_MAIN
@@ -0,0 +1,150 @@
+/*
+    Copyright (c) 2011-2016 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2016 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/utility/balance.hpp"
+
+#include <celero/Celero.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Simulation of connection bursts spread across the execution units. Every iteration is a single
+// connection to be assigned to some unit. Unit utilization is only sampled once per burst, like the
+// thread resource usage is sampled once in a few seconds, while the live load is updated with every
+// connection. Half of the connections of every unit are closed between bursts.
+//
+// Besides the time needed to pick a unit, the fixture reports the mean share of each burst taken by
+// the most loaded unit as the "skew" measurement, relative to a perfectly even spread, i.e. 1.0 is
+// the best possible result.
+
+namespace {
+
+using namespace cocaine;
+
+struct skew_t:
+    public celero::UserDefinedMeasurementTemplate<double>
+{
+    virtual
+    std::string
+    getName() const {
+        return "skew";
+    }
+};
+
+struct balance_fixture_t:
+    public celero::TestFixture
+{
+    static const std::size_t units = 8;
+    static const std::size_t burst = 1024;
+
+    // Live number of connections of every unit, and its snapshot taken at the start of the burst.
+    std::vector<std::int64_t> live;
+    std::vector<std::int64_t> sampled;
+
+    // Connections assigned to every unit during the current burst.
+    std::vector<std::int64_t> assigned;
+
+    std::size_t connections;
+    std::size_t bursts;
+    double skew;
+
+    std::minstd_rand random;
+
+    std::shared_ptr<skew_t> measurement;
+
+public:
+    balance_fixture_t():
+        measurement(std::make_shared<skew_t>())
+    { }
+
+    virtual
+    std::vector<std::shared_ptr<celero::UserDefinedMeasurement>>
+    getUserDefinedMeasurements() const {
+        return {measurement};
+    }
+
+    virtual
+    void
+    setUp(int64_t) {
+        live.assign(units, 0);
+        sampled.assign(units, 0);
+        assigned.assign(units, 0);
+
+        connections = 0;
+        bursts = 0;
+        skew = 0;
+    }
+
+    virtual
+    void
+    tearDown() {
+        if(bursts) {
+            measurement->addValue(skew / bursts);
+        }
+    }
+
+    template<class Select>
+    void
+    connect(Select select) {
+        const auto unit = select();
+
+        ++live[unit];
+        ++assigned[unit];
+
+        if(++connections % burst == 0) {
+            sample();
+        }
+    }
+
+private:
+    void
+    sample() {
+        const auto max = *std::max_element(assigned.begin(), assigned.end());
+
+        skew += static_cast<double>(max) * units / burst;
+        bursts++;
+
+        for(auto& load : live) {
+            load /= 2;
+        }
+
+        sampled = live;
+        assigned.assign(units, 0);
+    }
+};
+
+} // namespace
+
+BASELINE_F (ConnectionBurst, LeastUtilized, balance_fixture_t, 10, 100000) {
+    connect([this] {
+        return std::min_element(sampled.begin(), sampled.end()) - sampled.begin();
+    });
+}
+
+BENCHMARK_F(ConnectionBurst, TwoChoices, balance_fixture_t, 10, 100000) {
+    connect([this] {
+        const auto load = [](std::int64_t load) { return load; };
+        return utility::least_of_two(live.begin(), live.end(), load, random) - live.begin();
+    });
+}
@@ -0,0 +1,224 @@
+/*
+    Copyright (c) 2011-2016 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2016 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/locked_ptr.hpp"
+#include "cocaine/memory.hpp"
+#include "cocaine/rpc/channel_table.hpp"
+
+#include <celero/Celero.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Cost of a channel lookup for every incoming frame, and of opening and closing a channel, while
+// another thread keeps forking new channels in the same session. The ordered map must be locked
+// for every frame, while the flat table is only modified on the reactor, so it's read lock-free and
+// the forked channels are inserted and revoked by the reactor itself, in between the frames.
+
+namespace {
+
+using namespace cocaine;
+
+struct channel_t {
+    uint64_t id;
+};
+
+typedef std::map<uint64_t, std::shared_ptr<channel_t>> channel_map_t;
+typedef io::channel_table<std::shared_ptr<channel_t>> channel_table_t;
+
+void
+insert(channel_map_t& mapping, uint64_t id) {
+    mapping.insert({id, std::make_shared<channel_t>(channel_t{id})});
+}
+
+void
+insert(channel_table_t& mapping, uint64_t id) {
+    mapping.insert(id, std::make_shared<channel_t>(channel_t{id}));
+}
+
+template<class Mapping>
+struct channels_fixture_t:
+    public celero::TestFixture
+{
+    // Number of simultaneously active channels.
+    static const uint64_t window = 64;
+
+    synchronized<Mapping> channels;
+    std::atomic<uint64_t> max_channel_id;
+
+    // The oldest active channel opened by the peer, and the next frame's channel offset from it.
+    uint64_t oldest;
+    uint64_t offset;
+
+    std::atomic<bool> stopped;
+    std::unique_ptr<std::thread> forker;
+
+public:
+    virtual
+    void
+    setUp(int64_t) {
+        channels.apply([](Mapping& mapping) {
+            mapping = Mapping();
+        });
+
+        oldest = 1;
+        offset = 0;
+
+        for(uint64_t id = oldest; id < oldest + window; ++id) {
+            insert(*channels.synchronize(), id);
+        }
+
+        // Forked channels are numbered apart from the ones opened by the peer to avoid clashes.
+        max_channel_id = uint64_t(1) << 40;
+        stopped = false;
+
+        forker = std::make_unique<std::thread>([this] {
+            while(!stopped) fork();
+        });
+    }
+
+    virtual
+    void
+    tearDown() {
+        stopped = true;
+        forker->join();
+        forker.reset();
+    }
+
+    // Opens a new channel and closes the oldest one, so that the window slides forward.
+    void
+    open() {
+        poll();
+
+        channels.apply([&](Mapping& mapping) {
+            insert(mapping, oldest + window);
+            mapping.erase(oldest++);
+        });
+    }
+
+protected:
+    virtual
+    void
+    fork() = 0;
+
+    // Runs whatever the forking thread has left for the reactor to do.
+    virtual
+    void
+    poll() { }
+};
+
+struct map_fixture_t:
+    public channels_fixture_t<channel_map_t>
+{
+    std::shared_ptr<channel_t>
+    lookup() {
+        const auto id = oldest + offset++ % window;
+
+        return channels.apply([&](const channel_map_t& mapping) {
+            return mapping.find(id)->second;
+        });
+    }
+
+protected:
+    virtual
+    void
+    fork() {
+        channels.apply([&](channel_map_t& mapping) {
+            const auto id = ++max_channel_id;
+
+            // Mute slots aside, forked channels are revoked once the response is received.
+            insert(mapping, id);
+            mapping.erase(id);
+        });
+    }
+};
+
+struct table_fixture_t:
+    public channels_fixture_t<channel_table_t>
+{
+    // Channels forked by the other thread, which are yet to be inserted by the reactor.
+    synchronized<std::vector<uint64_t>> queued;
+    std::vector<uint64_t> forked;
+
+    std::shared_ptr<channel_t>
+    lookup() {
+        poll();
+
+        return *channels.unsafe().find(oldest + offset++ % window);
+    }
+
+protected:
+    virtual
+    void
+    fork() {
+        const auto id = ++max_channel_id;
+
+        // Like the session, the forking thread hands the insertion over to the reactor, which keeps
+        // up with at most a window of forks between two frames.
+        const auto backlog = queued.apply([&](std::vector<uint64_t>& ids) {
+            ids.push_back(id);
+            return ids.size();
+        });
+
+        if(backlog >= window) {
+            std::this_thread::yield();
+        }
+    }
+
+    virtual
+    void
+    poll() {
+        forked.clear();
+
+        queued.apply([&](std::vector<uint64_t>& ids) {
+            ids.swap(forked);
+        });
+
+        for(auto it = forked.begin(); it != forked.end(); ++it) {
+            insert(*channels.synchronize(), *it);
+        }
+
+        // Mute slots aside, forked channels are revoked once the response is received.
+        for(auto it = forked.begin(); it != forked.end(); ++it) {
+            channels->erase(*it);
+        }
+    }
+};
+
+} // namespace
+
+BASELINE_F (ChannelLookup, Map, map_fixture_t, 10, 100000) {
+    celero::DoNotOptimizeAway(lookup());
+}
+
+BENCHMARK_F(ChannelLookup, Table, table_fixture_t, 10, 100000) {
+    celero::DoNotOptimizeAway(lookup());
+}
+
+BASELINE_F (ChannelOpen, Map, map_fixture_t, 10, 100000) {
+    open();
+}
+
+BENCHMARK_F(ChannelOpen, Table, table_fixture_t, 10, 100000) {
+    open();
+}
@@ -0,0 +1,94 @@
+/*
+    Copyright (c) 2011-2016 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2016 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/rpc/asio/decoder.hpp"
+
+#include <celero/Celero.h>
+
+#include <msgpack.hpp>
+
+// Decodes large frames arriving in 64K pieces, as they do from the socket. The cost is expected to
+// grow linearly with the frame size, i.e. 4M and 16M frames should be ~4 and ~16 times as slow as
+// the 1M baseline.
+
+namespace {
+
+struct frames_t {
+    frames_t():
+        frame1M(make(1 << 20)),
+        frame4M(make(1 << 22)),
+        frame16M(make(1 << 24))
+    { }
+
+    static
+    std::string
+    make(size_t size) {
+        msgpack::sbuffer buffer;
+        msgpack::packer<msgpack::sbuffer> packer(buffer);
+
+        packer.pack_array(4);
+        packer.pack(uint64_t(1));
+        packer.pack(uint64_t(0));
+        packer.pack_array(1);
+        packer.pack(std::string(size, 'x'));
+        packer.pack_array(0);
+
+        return std::string(buffer.data(), buffer.size());
+    }
+
+    std::string frame1M, frame4M, frame16M;
+};
+
+const frames_t&
+frames() {
+    static const frames_t instance;
+    return instance;
+}
+
+void
+decode_chunked(const std::string& frame) {
+    static const size_t kChunkSize = 65536;
+
+    cocaine::io::decoder_t decoder;
+    cocaine::io::decoder_t::message_type message;
+
+    size_t received = 0;
+
+    while(received != frame.size()) {
+        std::error_code ec;
+
+        received = std::min(received + kChunkSize, frame.size());
+        celero::DoNotOptimizeAway(decoder.decode(frame.data(), received, message, ec));
+    }
+}
+
+} // namespace
+
+BASELINE (DecoderChunked, Frame1M,  10, 10) {
+    decode_chunked(frames().frame1M);
+}
+
+BENCHMARK(DecoderChunked, Frame4M,  10, 10) {
+    decode_chunked(frames().frame4M);
+}
+
+BENCHMARK(DecoderChunked, Frame16M, 10, 10) {
+    decode_chunked(frames().frame16M);
+}
@@ -0,0 +1,309 @@
+/*
+    Copyright (c) 2011-2016 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2016 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/idl/control.hpp"
+#include "cocaine/idl/streaming.hpp"
+#include "cocaine/rpc/asio/encoder.hpp"
+#include "cocaine/rpc/asio/transport.hpp"
+#include "cocaine/rpc/dispatch.hpp"
+#include "cocaine/rpc/session.hpp"
+#include "cocaine/rpc/upstream.hpp"
+
+#include <asio/local/connect_pair.hpp>
+#include <asio/local/stream_protocol.hpp>
+
+#include <blackhole/handler.hpp>
+#include <blackhole/root.hpp>
+#include <blackhole/wrapper.hpp>
+
+#include <celero/Celero.h>
+
+#include <metrics/registry.hpp>
+
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// Measures heap allocations per outgoing message. The baseline mimics the former encoding scheme,
+// where the message arguments were bound into a type-erased function along with a shared argument
+// tuple and encoded lazily. Allocation counts per message are expected to be at least halved for the
+// eagerly packed messages. The upstream benchmarks cover the whole way of a message sent via an
+// upstream, from packing it to writing it out on the session's reactor.
+//
+// NOTE: The global allocation functions are replaced for this executable only, and allocations are
+// only counted on the benchmarking thread while a sample is running, see allocation_scope_t.
+
+namespace {
+
+thread_local bool counting = false;
+thread_local size_t allocations = 0;
+
+} // namespace
+
+void*
+operator new(size_t size) {
+    if(counting) {
+        allocations++;
+    }
+
+    if(void* ptr = std::malloc(size)) {
+        return ptr;
+    }
+
+    throw std::bad_alloc();
+}
+
+void
+operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+using namespace cocaine;
+using namespace cocaine::io;
+
+typedef streaming<boost::mpl::list<std::string>::type>::chunk event_type;
+
+const size_t kIterations = 100000;
+
+struct allocations_t:
+    public celero::UserDefinedMeasurementTemplate<double>
+{
+    virtual
+    std::string
+    getName() const {
+        return "allocations";
+    }
+};
+
+// Counts allocations made by the calling thread during its lifetime.
+class allocation_scope_t {
+    const size_t origin;
+
+public:
+    allocation_scope_t():
+        origin(allocations)
+    {
+        counting = true;
+    }
+
+   ~allocation_scope_t() {
+        counting = false;
+    }
+
+    size_t
+    count() const {
+        return allocations - origin;
+    }
+};
+
+// Reports the number of allocations per iteration as a user-defined measurement.
+struct allocation_fixture_t:
+    public celero::TestFixture
+{
+    std::shared_ptr<allocations_t> measurement;
+    std::unique_ptr<allocation_scope_t> scope;
+
+public:
+    allocation_fixture_t():
+        measurement(std::make_shared<allocations_t>())
+    { }
+
+    virtual
+    std::vector<std::shared_ptr<celero::UserDefinedMeasurement>>
+    getUserDefinedMeasurements() const {
+        return {measurement};
+    }
+
+    virtual
+    void
+    setUp(int64_t) {
+        scope.reset(new allocation_scope_t());
+    }
+
+    virtual
+    void
+    tearDown() {
+        const size_t count = scope->count();
+
+        scope.reset();
+        measurement->addValue(static_cast<double>(count) / kIterations);
+    }
+};
+
+struct encoder_fixture_t:
+    public allocation_fixture_t
+{
+    encoder_t encoder;
+};
+
+auto
+bound(encoder_t& encoder, uint64_t channel_id, const hpack::header_storage_t& headers,
+      const std::shared_ptr<const std::tuple<std::string>>& args) -> aux::encoded_message_t
+{
+    aux::encoded_message_t message;
+
+    encoder_t::packer_type packer(message.buffer);
+
+    packer.pack_array(4);
+    packer.pack(channel_id);
+    packer.pack(static_cast<uint64_t>(event_traits<event_type>::id));
+
+    type_traits<event_traits<event_type>::argument_type>::pack(packer, *args);
+
+    encoder.pack_headers(packer, headers);
+
+    return message;
+}
+
+void
+encode_bound(encoder_t& encoder, std::string payload) {
+    const std::function<aux::encoded_message_t(encoder_t&)> message = std::bind(&bound,
+        std::placeholders::_1,
+        1,
+        hpack::header_storage_t(),
+        std::make_shared<const std::tuple<std::string>>(std::move(payload))
+    );
+
+    celero::DoNotOptimizeAway(message(encoder).size());
+}
+
+void
+encode_packed(encoder_t& encoder, std::string payload) {
+    celero::DoNotOptimizeAway(encoder.encode(encoded<event_type>(1, std::move(payload))).size());
+}
+
+} // namespace
+
+BASELINE_F (EncoderAllocations, BoundSmall,  encoder_fixture_t, 10, kIterations) {
+    encode_bound(encoder, "le message");
+}
+
+BENCHMARK_F(EncoderAllocations, PackedSmall, encoder_fixture_t, 10, kIterations) {
+    encode_packed(encoder, "le message");
+}
+
+BENCHMARK_F(EncoderAllocations, BoundLarge,  encoder_fixture_t, 10, kIterations) {
+    encode_bound(encoder, std::string(65536, 'x'));
+}
+
+BENCHMARK_F(EncoderAllocations, PackedLarge, encoder_fixture_t, 10, kIterations) {
+    encode_packed(encoder, std::string(65536, 'x'));
+}
+
+namespace {
+
+typedef asio::local::stream_protocol protocol_type;
+
+// Session over a socket pair with a single channel. Sent messages are written out by polling the
+// session's reactor every `batch` messages, and the peer discards everything it receives.
+struct upstream_fixture_t:
+    public allocation_fixture_t
+{
+    asio::io_service loop;
+    metrics::registry_t registry;
+    blackhole::root_logger_t root;
+
+    std::unique_ptr<protocol_type::socket> peer;
+    std::shared_ptr<session<protocol_type>> server;
+    upstream_ptr_t upstream;
+
+    size_t sent;
+
+public:
+    upstream_fixture_t():
+        root(std::vector<std::unique_ptr<blackhole::handler_t>>())
+    { }
+
+    virtual
+    void
+    setUp(int64_t value) {
+        auto socket = std::make_unique<protocol_type::socket>(loop);
+
+        peer = std::make_unique<protocol_type::socket>(loop);
+        asio::local::connect_pair(*socket, *peer);
+        peer->non_blocking(true);
+
+        server = std::make_shared<session<protocol_type>>(
+            std::make_unique<blackhole::wrapper_t>(root, blackhole::attributes_t()),
+            registry,
+            std::make_unique<transport<protocol_type>>(std::move(socket)),
+            std::make_shared<dispatch<control_tag>>("benchmark")
+        );
+
+        upstream = server->fork(nullptr);
+        sent = 0;
+
+        // Warm up the pools and the queues, so that only the steady state is measured.
+        for(size_t i = 0; i < 64; ++i) {
+            send(1);
+        }
+
+        allocation_fixture_t::setUp(value);
+    }
+
+    virtual
+    void
+    tearDown() {
+        allocation_fixture_t::tearDown();
+
+        upstream.reset();
+        server->detach(std::error_code());
+        server.reset();
+
+        loop.poll();
+        loop.reset();
+    }
+
+    void
+    send(size_t batch) {
+        upstream->send<event_type>(std::string("le message"));
+
+        if(++sent % batch) {
+            return;
+        }
+
+        loop.poll();
+        loop.reset();
+
+        char buffer[65536];
+
+        while(::read(peer->native_handle(), buffer, sizeof(buffer)) > 0)
+            ;
+    }
+};
+
+} // namespace
+
+BASELINE_F (UpstreamAllocations, Single, upstream_fixture_t, 10, kIterations) {
+    send(1);
+}
+
+BENCHMARK_F(UpstreamAllocations, Batch,  upstream_fixture_t, 10, kIterations) {
+    send(16);
+}
+
+CELERO_MAIN
@@ -0,0 +1,77 @@
+/*
+    Copyright (c) 2011-2016 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2016 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/hpack/header.hpp"
+#include "cocaine/hpack/static_table.hpp"
+
+#include <celero/Celero.h>
+
+// Cost of a single header lookup in a dynamic table filled up to its capacity. Lookups are expected
+// to take roughly the same time no matter where the header is, or whether it's there at all.
+
+namespace {
+
+using namespace cocaine::hpack;
+
+struct table_fixture_t:
+    public celero::TestFixture
+{
+    header_table_t table;
+
+    header_t newest, oldest, missing, traced;
+
+public:
+    virtual
+    void
+    setUp(int64_t) {
+        table = header_table_t();
+
+        for(size_t i = 0; table.data_size() + 64 <= table.data_capacity(); ++i) {
+            table.push(header_t("x-name-" + std::to_string(i), "value-" + std::to_string(i)));
+        }
+
+        newest  = table[header_static_table_t::get_size()];
+        oldest  = table[table.size() - 1];
+        missing = header_t("x-name-missing", "value-missing");
+        traced  = header_t::create<headers::trace_id<>>(header::pack(uint64_t(42)));
+    }
+};
+
+} // namespace
+
+BASELINE_F (HeaderTableLookup, FullMatchNewest, table_fixture_t, 10, 100000) {
+    celero::DoNotOptimizeAway(table.find_by_full_match(newest));
+}
+
+BENCHMARK_F(HeaderTableLookup, FullMatchOldest, table_fixture_t, 10, 100000) {
+    celero::DoNotOptimizeAway(table.find_by_full_match(oldest));
+}
+
+BENCHMARK_F(HeaderTableLookup, FullMatchMissing, table_fixture_t, 10, 100000) {
+    celero::DoNotOptimizeAway(table.find_by_full_match(missing));
+}
+
+BENCHMARK_F(HeaderTableLookup, NameStatic, table_fixture_t, 10, 100000) {
+    celero::DoNotOptimizeAway(table.find_by_name(traced));
+}
+
+BENCHMARK_F(HeaderTableLookup, NameMissing, table_fixture_t, 10, 100000) {
+    celero::DoNotOptimizeAway(table.find_by_name(missing));
+}
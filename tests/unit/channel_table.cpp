@@ -0,0 +1,191 @@
+#include <gtest/gtest.h>
+
+#include <cocaine/rpc/channel_table.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <set>
+
+namespace cocaine {
+namespace io {
+namespace {
+
+typedef channel_table<std::shared_ptr<std::uint64_t>> table_type;
+
+void
+insert(table_type& table, std::uint64_t id) {
+    ASSERT_TRUE(table.insert(id, std::make_shared<std::uint64_t>(id)));
+}
+
+TEST(channel_table, is_empty_by_default) {
+    table_type table;
+
+    EXPECT_TRUE(table.empty());
+    EXPECT_EQ(0, table.size());
+    EXPECT_EQ(nullptr, table.find(1));
+}
+
+TEST(channel_table, finds_inserted_channels) {
+    table_type table;
+
+    insert(table, 1);
+    insert(table, 42);
+
+    ASSERT_NE(nullptr, table.find(1));
+    ASSERT_NE(nullptr, table.find(42));
+
+    EXPECT_EQ(1, **table.find(1));
+    EXPECT_EQ(42, **table.find(42));
+    EXPECT_EQ(nullptr, table.find(2));
+    EXPECT_EQ(2, table.size());
+}
+
+TEST(channel_table, keeps_the_first_of_duplicate_channels) {
+    table_type table;
+
+    insert(table, 1);
+
+    EXPECT_FALSE(table.insert(1, std::make_shared<std::uint64_t>(2)));
+    EXPECT_EQ(1, **table.find(1));
+    EXPECT_EQ(1, table.size());
+}
+
+TEST(channel_table, erases_channels) {
+    table_type table;
+
+    insert(table, 1);
+    insert(table, 2);
+
+    EXPECT_TRUE(table.erase(1));
+    EXPECT_FALSE(table.erase(1));
+    EXPECT_FALSE(table.erase(3));
+
+    EXPECT_EQ(nullptr, table.find(1));
+    ASSERT_NE(nullptr, table.find(2));
+    EXPECT_EQ(1, table.size());
+}
+
+TEST(channel_table, releases_erased_values) {
+    table_type table;
+
+    const auto value = std::make_shared<std::uint64_t>(1);
+
+    ASSERT_TRUE(table.insert(1, value));
+    ASSERT_EQ(2, value.use_count());
+
+    table.erase(1);
+
+    EXPECT_EQ(1, value.use_count());
+}
+
+TEST(channel_table, grows_past_the_initial_capacity) {
+    table_type table;
+
+    // Way more than the initial slots, so that the table is regrown several times over.
+    for(std::uint64_t id = 1; id <= 1000; ++id) {
+        insert(table, id);
+    }
+
+    EXPECT_EQ(1000, table.size());
+
+    for(std::uint64_t id = 1; id <= 1000; ++id) {
+        ASSERT_NE(nullptr, table.find(id)) << "channel " << id;
+        EXPECT_EQ(id, **table.find(id));
+    }
+
+    EXPECT_EQ(nullptr, table.find(1001));
+}
+
+TEST(channel_table, finds_channels_shifted_back_by_erasure) {
+    table_type table;
+
+    for(std::uint64_t id = 1; id <= 256; ++id) {
+        insert(table, id);
+    }
+
+    // Every erase shifts the rest of its probe sequence back, which must keep them reachable.
+    for(std::uint64_t id = 1; id <= 256; id += 2) {
+        ASSERT_TRUE(table.erase(id));
+    }
+
+    EXPECT_EQ(128, table.size());
+
+    for(std::uint64_t id = 1; id <= 256; ++id) {
+        if(id % 2) {
+            EXPECT_EQ(nullptr, table.find(id)) << "channel " << id;
+        } else {
+            ASSERT_NE(nullptr, table.find(id)) << "channel " << id;
+            EXPECT_EQ(id, **table.find(id));
+        }
+    }
+}
+
+TEST(channel_table, slides_a_window_of_active_channels) {
+    table_type table;
+
+    const std::uint64_t window = 64;
+
+    for(std::uint64_t id = 1; id <= window; ++id) {
+        insert(table, id);
+    }
+
+    // Channels are opened and revoked in order, like the ones of a busy session.
+    for(std::uint64_t oldest = 1; oldest < 10000; ++oldest) {
+        insert(table, oldest + window);
+        ASSERT_TRUE(table.erase(oldest));
+        ASSERT_NE(nullptr, table.find(oldest + window / 2));
+    }
+
+    EXPECT_EQ(window, table.size());
+}
+
+TEST(channel_table, visits_every_channel) {
+    table_type table;
+
+    for(std::uint64_t id = 1; id <= 100; ++id) {
+        insert(table, id);
+    }
+
+    table.erase(50);
+
+    std::set<std::uint64_t> visited;
+
+    table.each([&](std::uint64_t id, const std::shared_ptr<std::uint64_t>& value) {
+        EXPECT_EQ(id, *value);
+        EXPECT_TRUE(visited.insert(id).second);
+    });
+
+    // Active channels are counted and listed by the session this way.
+    EXPECT_EQ(table.size(), visited.size());
+    EXPECT_EQ(99, visited.size());
+    EXPECT_EQ(0, visited.count(50));
+}
+
+TEST(channel_table, clears_all_channels) {
+    table_type table;
+
+    for(std::uint64_t id = 1; id <= 100; ++id) {
+        insert(table, id);
+    }
+
+    table.clear();
+
+    EXPECT_TRUE(table.empty());
+    EXPECT_EQ(nullptr, table.find(1));
+
+    size_t visited = 0;
+
+    table.each([&](std::uint64_t, const std::shared_ptr<std::uint64_t>&) {
+        visited++;
+    });
+
+    EXPECT_EQ(0, visited);
+
+    insert(table, 1);
+
+    EXPECT_EQ(1, table.size());
+}
+
+} // namespace
+} // namespace io
+} // namespace cocaine
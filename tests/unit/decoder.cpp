@@ -0,0 +1,216 @@
+/*
+    Copyright (c) 2011-2016 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2016 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cocaine/errors.hpp>
+#include <cocaine/hpack/static_table.hpp>
+#include <cocaine/rpc/asio/decoder.hpp>
+
+#include <msgpack.hpp>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace cocaine;
+using namespace cocaine::io;
+
+namespace {
+
+auto
+make_frame(uint64_t span, uint64_t type, const std::string& payload) -> std::string {
+    msgpack::sbuffer buffer;
+    msgpack::packer<msgpack::sbuffer> packer(buffer);
+
+    packer.pack_array(4);
+    packer.pack(span);
+    packer.pack(type);
+    packer.pack_array(1);
+    packer.pack(payload);
+    packer.pack_array(0);
+
+    return std::string(buffer.data(), buffer.size());
+}
+
+// Packs a frame with the given headers, each either a table index or a [store, name, value] literal.
+template<class Packer>
+auto
+make_frame_with_headers(size_t count, Packer&& pack_headers) -> std::string {
+    msgpack::sbuffer buffer;
+    msgpack::packer<msgpack::sbuffer> packer(buffer);
+
+    packer.pack_array(4);
+    packer.pack(1);
+    packer.pack(2);
+    packer.pack_array(0);
+    packer.pack_array(count);
+    pack_headers(packer);
+
+    return std::string(buffer.data(), buffer.size());
+}
+
+void
+pack_literal(msgpack::packer<msgpack::sbuffer>& packer, bool store, const std::string& name,
+             const std::string& value)
+{
+    packer.pack_array(3);
+    packer.pack(store);
+    packer.pack(name);
+    packer.pack(value);
+}
+
+}  // namespace
+
+TEST(decoder_t, whole_frame) {
+    const auto frame = make_frame(1, 2, "le message");
+
+    decoder_t decoder;
+    decoder_t::message_type message;
+    std::error_code ec;
+
+    ASSERT_EQ(decoder.decode(frame.data(), frame.size(), message, ec), frame.size());
+    ASSERT_FALSE(ec);
+    ASSERT_EQ(message.span(), 1);
+    ASSERT_EQ(message.type(), 2);
+    ASSERT_EQ(message.args().via.array.ptr[0].as<std::string>(), "le message");
+}
+
+TEST(decoder_t, chunked_frame) {
+    const auto frame = make_frame(1, 2, std::string(100000, 'x'));
+
+    for(size_t chunk: {1, 7, 4096, 65536}) {
+        decoder_t decoder;
+        decoder_t::message_type message;
+        std::error_code ec;
+
+        size_t received = 0, decoded = 0;
+
+        while(!decoded) {
+            received = std::min(received + chunk, frame.size());
+            ec.clear();
+            decoded = decoder.decode(frame.data(), received, message, ec);
+
+            if(!decoded) {
+                ASSERT_EQ(ec, error::insufficient_bytes);
+                ASSERT_GT(decoder.required(), received);
+            }
+        }
+
+        ASSERT_FALSE(ec);
+        ASSERT_EQ(decoded, frame.size());
+        ASSERT_EQ(message.args().via.array.ptr[0].as<std::string>(), std::string(100000, 'x'));
+    }
+}
+
+TEST(decoder_t, required_size_hint) {
+    const auto frame = make_frame(1, 2, std::string(100000, 'x'));
+
+    decoder_t decoder;
+    decoder_t::message_type message;
+    std::error_code ec;
+
+    // Enough to see the length prefix of the payload.
+    decoder.decode(frame.data(), 16, message, ec);
+
+    ASSERT_EQ(ec, error::insufficient_bytes);
+    ASSERT_GE(decoder.required(), 100000);
+    ASSERT_LT(decoder.required(), frame.size());
+}
+
+TEST(decoder_t, pipelined_frames) {
+    const auto frame = make_frame(1, 2, "first") + make_frame(3, 4, "second");
+
+    decoder_t decoder;
+    decoder_t::message_type message;
+    std::error_code ec;
+
+    const auto offset = decoder.decode(frame.data(), frame.size(), message, ec);
+
+    ASSERT_FALSE(ec);
+    ASSERT_EQ(message.span(), 1);
+    ASSERT_EQ(decoder.decode(frame.data() + offset, frame.size() - offset, message, ec),
+        frame.size() - offset);
+    ASSERT_FALSE(ec);
+    ASSERT_EQ(message.span(), 3);
+}
+
+TEST(decoder_t, parse_error) {
+    const char frame[] = {'\x93', '\x01', '\xc1'};
+
+    decoder_t decoder;
+    decoder_t::message_type message;
+    std::error_code ec;
+
+    decoder.decode(frame, sizeof(frame), message, ec);
+
+    ASSERT_EQ(ec, error::parse_error);
+}
+
+TEST(decoder_t, header_views_reference_frame) {
+    const auto frame = make_frame_with_headers(1, [](msgpack::packer<msgpack::sbuffer>& packer) {
+        pack_literal(packer, false, "x-request", "le value");
+    });
+
+    decoder_t decoder;
+    decoder_t::message_type message;
+    std::error_code ec;
+
+    ASSERT_EQ(decoder.decode(frame.data(), frame.size(), message, ec), frame.size());
+    ASSERT_FALSE(ec);
+    ASSERT_EQ(message.header_views().size(), 1);
+
+    const auto& view = message.header_views()[0];
+
+    ASSERT_GE(view.value().data, frame.data());
+    ASSERT_LT(view.value().data, frame.data() + frame.size());
+    ASSERT_TRUE(hpack::header::find_first(message.header_views(), "x-request"));
+
+    ASSERT_EQ(message.headers().size(), 1);
+    ASSERT_EQ(message.headers()[0], hpack::header_t("x-request", "le value"));
+
+    message.clear();
+
+    ASSERT_TRUE(message.header_views().empty());
+    ASSERT_TRUE(message.headers().empty());
+}
+
+TEST(decoder_t, header_views_survive_eviction) {
+    const auto first = make_frame_with_headers(1, [](msgpack::packer<msgpack::sbuffer>& packer) {
+        pack_literal(packer, true, "x-request", "le value");
+    });
+
+    // References the stored header and then evicts it from the dynamic table in the same frame.
+    const auto second = make_frame_with_headers(2, [](msgpack::packer<msgpack::sbuffer>& packer) {
+        packer.pack(static_cast<uint64_t>(hpack::header_static_table_t::get_size()));
+        pack_literal(packer, true, "x-filler", std::string(4000, 'x'));
+    });
+
+    decoder_t decoder;
+    decoder_t::message_type message;
+    std::error_code ec;
+
+    decoder.decode(first.data(), first.size(), message, ec);
+    ASSERT_FALSE(ec);
+    message.clear();
+
+    decoder.decode(second.data(), second.size(), message, ec);
+    ASSERT_FALSE(ec);
+    ASSERT_EQ(message.header_views().size(), 2);
+    ASSERT_EQ(message.headers()[0], hpack::header_t("x-request", "le value"));
+    ASSERT_EQ(message.headers()[1].value().size(), 4000);
+}
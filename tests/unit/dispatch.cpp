@@ -0,0 +1,163 @@
+#include <gtest/gtest.h>
+
+#include <cocaine/rpc/asio/decoder.hpp>
+#include <cocaine/rpc/asio/encoder.hpp>
+#include <cocaine/rpc/dispatch.hpp>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "test_idl.hpp"
+
+namespace {
+
+// Mutexes locked by the calling thread so far, counted by the interposed pthread_mutex_lock().
+thread_local std::size_t locked = 0;
+
+std::atomic<int(*)(pthread_mutex_t*)> forward(nullptr);
+
+} // namespace
+
+extern "C"
+int
+pthread_mutex_lock(pthread_mutex_t* mutex) {
+    auto next = forward.load();
+
+    if(!next) {
+        next = reinterpret_cast<int(*)(pthread_mutex_t*)>(::dlsym(RTLD_NEXT, "pthread_mutex_lock"));
+        forward.store(next);
+    }
+
+    locked++;
+
+    return next(mutex);
+}
+
+namespace cocaine {
+namespace {
+
+// Decodes the encoded message, keeping the frame alive along with the decoder.
+class frame_t {
+    std::vector<char> data;
+    io::decoder_t decoder;
+
+public:
+    io::decoder_t::message_type message;
+
+    explicit
+    frame_t(io::encoder_t::message_type&& source) {
+        io::encoder_t encoder;
+        std::deque<asio::const_buffer> buffers;
+
+        const auto encoded = encoder.encode(std::move(source));
+        encoded.gather(buffers);
+
+        for(auto it = buffers.begin(); it != buffers.end(); ++it) {
+            const auto chunk = asio::buffer_cast<const char*>(*it);
+            data.insert(data.end(), chunk, chunk + asio::buffer_size(*it));
+        }
+
+        std::error_code ec;
+
+        decoder.decode(data.data(), data.size(), message, ec);
+    }
+};
+
+TEST(dispatch, destroys_dropped_slots) {
+    dispatch<io::test_tag> dispatch("test");
+
+    auto token = std::make_shared<int>(42);
+    std::weak_ptr<int> weak = token;
+
+    dispatch.on<io::test::method1>([token] { });
+    token.reset();
+
+    ASSERT_FALSE(weak.expired());
+
+    // Nothing is processing messages, so the replaced table is destroyed along with the slot.
+    dispatch.drop<io::test::method1>();
+
+    EXPECT_TRUE(weak.expired());
+}
+
+TEST(dispatch, destroys_halted_slots) {
+    dispatch<io::test_tag> dispatch("test");
+
+    auto token = std::make_shared<int>(42);
+    std::weak_ptr<int> weak = token;
+
+    dispatch.on<io::test::method1>([token] { });
+    token.reset();
+
+    dispatch.halt();
+
+    EXPECT_TRUE(weak.expired());
+    EXPECT_THROW(dispatch.drop<io::test::method1>(), std::system_error);
+}
+
+TEST(dispatch, retains_slots_dropped_while_processing) {
+    dispatch<io::test_tag> dispatch("test");
+
+    auto token = std::make_shared<int>(42);
+    std::weak_ptr<int> weak = token;
+
+    bool retained = false;
+
+    dispatch.on<io::test::method1>([&, token] {
+        dispatch.drop<io::test::method1>();
+
+        // The slot is still running, so it must not be destroyed yet.
+        retained = !weak.expired();
+    });
+
+    token.reset();
+
+    frame_t frame(io::encoded<io::test::method1>(1));
+
+    dispatch.process(frame.message, nullptr);
+
+    EXPECT_TRUE(retained);
+    ASSERT_FALSE(weak.expired());
+
+    // Nothing is processing messages anymore, so the next update destroys the dropped slot.
+    dispatch.halt();
+
+    EXPECT_TRUE(weak.expired());
+}
+
+TEST(dispatch, looks_slots_up_without_locking) {
+    dispatch<io::test_tag> dispatch("test");
+
+    size_t calls = 0;
+
+    dispatch.on<io::test::method1>([&] {
+        calls++;
+    });
+
+    frame_t frame(io::encoded<io::test::method1>(1));
+
+    // Warm up, so that nothing is lazily initialized while the locks are counted.
+    dispatch.process(frame.message, nullptr);
+
+    const auto origin = locked;
+
+    for(size_t i = 0; i < 1000; ++i) {
+        dispatch.process(frame.message, nullptr);
+    }
+
+    EXPECT_EQ(1001, calls);
+    EXPECT_EQ(origin, locked);
+
+    // Updates are still serialized by a lock, which proves that the locks are actually counted.
+    dispatch.drop<io::test::method1>();
+
+    EXPECT_LT(origin, locked);
+}
+
+} // namespace
+} // namespace cocaine
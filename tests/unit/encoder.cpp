@@ -0,0 +1,362 @@
+/*
+    Copyright (c) 2011-2016 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2016 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cocaine/idl/primitive.hpp>
+#include <cocaine/rpc/asio/decoder.hpp>
+#include <cocaine/rpc/asio/encoder.hpp>
+#include <cocaine/trace/trace.hpp>
+
+#include <msgpack.hpp>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <deque>
+#include <thread>
+
+using namespace cocaine;
+using namespace cocaine::io;
+using namespace cocaine::io::aux;
+
+TEST(encoded_buffers_pool_t, size_classes) {
+    encoded_buffers_pool_t pool;
+
+    auto buffer = pool.acquire(1);
+    ASSERT_EQ(buffer.size(), encoded_buffers_pool_t::kMinBufferSize);
+
+    buffer = pool.acquire(encoded_buffers_pool_t::kMinBufferSize + 1);
+    ASSERT_EQ(buffer.size(), encoded_buffers_pool_t::kMinBufferSize * 2);
+
+    buffer = pool.acquire(encoded_buffers_pool_t::kMaxBufferSize + 1);
+    ASSERT_EQ(buffer.size(), encoded_buffers_pool_t::kMaxBufferSize + 1);
+}
+
+TEST(encoded_buffers_pool_t, reuse) {
+    encoded_buffers_pool_t pool;
+
+    auto buffer = pool.acquire(4096);
+    const auto data = buffer.data();
+
+    pool.release(buffer);
+    ASSERT_TRUE(buffer.empty());
+    ASSERT_EQ(pool.stats().retained, 4096);
+
+    buffer = pool.acquire(3000);
+    ASSERT_EQ(buffer.data(), data);
+
+    const auto stats = pool.stats();
+    ASSERT_EQ(stats.hits, 1);
+    ASSERT_EQ(stats.misses, 1);
+    ASSERT_EQ(stats.retained, 0);
+}
+
+TEST(encoded_buffers_pool_t, oversized_buffers_are_not_retained) {
+    encoded_buffers_pool_t pool;
+
+    auto buffer = pool.acquire(encoded_buffers_pool_t::kMaxBufferSize * 2);
+
+    pool.release(buffer);
+    ASSERT_EQ(pool.stats().retained, 0);
+}
+
+TEST(encoded_buffers_pool_t, retention_limit) {
+    encoded_buffers_pool_t pool;
+
+    const size_t limit = encoded_buffers_pool_t::kMaxRetainedSize / encoded_buffers_pool_t::kMaxBufferSize;
+
+    std::vector<encoded_buffers_pool_t::buffer_type> buffers;
+
+    for(size_t i = 0; i < limit + 1; ++i) {
+        buffers.push_back(pool.acquire(encoded_buffers_pool_t::kMaxBufferSize));
+    }
+
+    for(auto it = buffers.begin(); it != buffers.end(); ++it) {
+        pool.release(*it);
+    }
+
+    ASSERT_EQ(pool.stats().retained, encoded_buffers_pool_t::kMaxRetainedSize);
+}
+
+TEST(encoded_buffers_t, grows_across_classes) {
+    const std::string payload(encoded_buffers_t::kInitialBufferSize * 3, 'x');
+
+    encoded_buffers_t buffer;
+
+    buffer.write("le", 2);
+    buffer.write(payload.data(), payload.size());
+
+    ASSERT_EQ(buffer.size(), payload.size() + 2);
+    ASSERT_EQ(std::string(buffer.inline_data(), 2), "le");
+    ASSERT_EQ(std::string(buffer.inline_data() + 2, payload.size()), payload);
+}
+
+TEST(encoded_buffers_pool_t, thread_local) {
+    auto& pool = encoded_buffers_pool_t::current();
+
+    encoded_buffers_pool_t* other = nullptr;
+
+    std::thread([&] {
+        other = &encoded_buffers_pool_t::current();
+    }).join();
+
+    ASSERT_NE(&pool, other);
+    ASSERT_EQ(&pool, &encoded_buffers_pool_t::current());
+}
+
+TEST(encoded_buffers_t, move_assignment_releases_replaced_buffer) {
+    auto& pool = encoded_buffers_pool_t::current();
+
+    encoded_buffers_t target;
+    encoded_buffers_t source;
+
+    source.write("le message", 10);
+
+    const auto retained = pool.stats().retained;
+
+    target = std::move(source);
+
+    ASSERT_EQ(pool.stats().retained, retained + encoded_buffers_t::kInitialBufferSize);
+    ASSERT_EQ(target.size(), 10);
+    ASSERT_EQ(std::string(target.inline_data(), 10), "le message");
+
+    // The moved-from buffer owns nothing, so its destruction doesn't release anything.
+    {
+        encoded_buffers_t moved(std::move(target));
+    }
+
+    ASSERT_EQ(pool.stats().retained, retained + encoded_buffers_t::kInitialBufferSize * 2);
+}
+
+TEST(encoded_buffers_t, released_to_the_releasing_thread_pool) {
+    auto& pool = encoded_buffers_pool_t::current();
+
+    const size_t count = encoded_buffers_pool_t::kMaxRetainedSize / encoded_buffers_t::kInitialBufferSize;
+
+    std::vector<encoded_buffers_t> buffers(count + 1);
+
+    const auto origin = pool.stats();
+
+    encoded_buffers_pool_t::stats_t stats;
+
+    std::thread([&] {
+        buffers.clear();
+        stats = encoded_buffers_pool_t::current().stats();
+    }).join();
+
+    // The owning pool doesn't get anything back, while the releasing one retains up to its limit.
+    ASSERT_EQ(pool.stats().retained, origin.retained);
+    ASSERT_EQ(stats.retained, encoded_buffers_pool_t::kMaxRetainedSize);
+}
+
+namespace {
+
+auto
+flatten(const encoded_message_t& message) -> std::string {
+    std::deque<std::pair<const char*, size_t>> chain;
+    std::string result;
+
+    message.gather(chain);
+
+    for(auto it = chain.begin(); it != chain.end(); ++it) {
+        result.append(it->first, it->second);
+    }
+
+    return result;
+}
+
+}  // namespace
+
+TEST(encoded_buffers_t, references_pinned_regions) {
+    const std::string payload(encoded_buffers_t::kMinReferencedSize, 'x');
+
+    encoded_buffers_t buffer;
+
+    buffer.pin(payload.data(), payload.size());
+
+    buffer.write("le", 2);
+    buffer.write(payload.data(), payload.size());
+    buffer.write("ad", 2);
+
+    std::deque<std::pair<const char*, size_t>> chain;
+
+    ASSERT_EQ(buffer.gather(chain), 3);
+    ASSERT_EQ(buffer.size(), payload.size() + 4);
+    ASSERT_EQ(buffer.inline_size(), 4);
+    ASSERT_EQ(std::string(buffer.inline_data(), buffer.inline_size()), "lead");
+    ASSERT_EQ(chain[1].first, payload.data());
+    ASSERT_EQ(chain[1].second, payload.size());
+}
+
+TEST(encoded_buffers_t, copies_small_and_unpinned_regions) {
+    const std::string small("le message");
+    const std::string large(encoded_buffers_t::kMinReferencedSize, 'x');
+
+    encoded_buffers_t buffer;
+
+    buffer.pin(small.data(), small.size());
+
+    buffer.write(small.data(), small.size());
+    buffer.write(large.data(), large.size());
+
+    std::deque<std::pair<const char*, size_t>> chain;
+
+    ASSERT_EQ(buffer.gather(chain), 1);
+    ASSERT_EQ(buffer.size(), small.size() + large.size());
+}
+
+TEST(encoder_t, large_arguments_are_not_copied) {
+    typedef primitive<boost::mpl::list<std::string>::type>::value event_type;
+
+    const std::string expected(encoded_buffers_t::kMinReferencedSize * 4, 'x');
+
+    std::string payload(expected);
+    const auto data = payload.data();
+
+    encoder_t encoder;
+
+    const auto message = encoder.encode(encoded<event_type>(42, std::move(payload)));
+
+    std::deque<std::pair<const char*, size_t>> chain;
+
+    message.gather(chain);
+
+    ASSERT_TRUE(std::any_of(chain.begin(), chain.end(), [&](const std::pair<const char*, size_t>& segment) {
+        return segment.first == data;
+    }));
+
+    const auto frame = flatten(message);
+
+    msgpack::unpacked unpacked;
+    msgpack::unpack(&unpacked, frame.data(), frame.size());
+
+    const msgpack::object& object = unpacked.get();
+
+    ASSERT_EQ(object.via.array.size, 4);
+    ASSERT_EQ(object.via.array.ptr[0].as<uint64_t>(), 42);
+    ASSERT_EQ(object.via.array.ptr[2].via.array.ptr[0].as<std::string>(), expected);
+}
+
+TEST(encoder_t, compressed_headers) {
+    typedef primitive<boost::mpl::list<std::string>::type>::value event_type;
+
+    const std::vector<hpack::header_t> headers = {
+        hpack::header_t("x-request-source", "le-frontend")
+    };
+
+    encoder_t encoder;
+    decoder_t decoder;
+
+    encoder.compress(true);
+
+    std::vector<std::string> frames;
+
+    for(int i = 0; i < 2; ++i) {
+        frames.push_back(flatten(encoder.encode(encoded<event_type>(1, headers, std::string("le message")))));
+    }
+
+    // Second time all the headers are referenced from the dynamic table.
+    ASSERT_LT(frames[1].size(), frames[0].size());
+
+    for(auto it = frames.begin(); it != frames.end(); ++it) {
+        decoder_t::message_type message;
+        std::error_code ec;
+
+        ASSERT_EQ(decoder.decode(it->data(), it->size(), message, ec), it->size());
+        ASSERT_FALSE(ec);
+
+        const auto header = hpack::header::find_first(message.headers(), "x-request-source");
+
+        ASSERT_TRUE(header);
+        ASSERT_EQ(header->value(), "le-frontend");
+    }
+
+    const auto stats = encoder.drain();
+
+    ASSERT_LT(stats.packed, stats.plain);
+    ASSERT_EQ(encoder.drain().plain, 0);
+}
+
+TEST(encoder_t, unique_headers_are_not_indexed) {
+    typedef primitive<boost::mpl::list<std::string>::type>::value event_type;
+
+    const std::vector<hpack::header_t> headers = {
+        hpack::header_t("x-request-source", "le-frontend")
+    };
+
+    encoder_t encoder;
+    decoder_t decoder;
+
+    encoder.compress(true);
+
+    std::vector<std::string> frames;
+
+    for(std::uint64_t id = 1; id <= 2; ++id) {
+        trace_t::restore_scope_t scope(trace_t(id, id, id, "test"));
+        frames.push_back(flatten(encoder.encode(encoded<event_type>(1, headers, std::string("le message")))));
+    }
+
+    msgpack::unpacked unpacked;
+    msgpack::unpack(&unpacked, frames[1].data(), frames[1].size());
+
+    const msgpack::object& packed = unpacked.get().via.array.ptr[3];
+
+    ASSERT_EQ(packed.via.array.size, 4);
+
+    // Tracing headers are sent as literals which are never stored in the dynamic table.
+    for(size_t i = 0; i < 3; ++i) {
+        ASSERT_EQ(packed.via.array.ptr[i].type, msgpack::type::ARRAY);
+        ASSERT_FALSE(packed.via.array.ptr[i].via.array.ptr[0].via.boolean);
+    }
+
+    // So the header which is the same for both messages is still the newest dynamic table entry.
+    ASSERT_EQ(packed.via.array.ptr[3].type, msgpack::type::POSITIVE_INTEGER);
+    ASSERT_EQ(packed.via.array.ptr[3].via.u64, hpack::header_static_table_t::get_size());
+
+    for(std::uint64_t id = 1; id <= 2; ++id) {
+        const auto& frame = frames[id - 1];
+
+        decoder_t::message_type message;
+        std::error_code ec;
+
+        ASSERT_EQ(decoder.decode(frame.data(), frame.size(), message, ec), frame.size());
+        ASSERT_FALSE(ec);
+
+        const auto trace = hpack::header::find_first<hpack::headers::trace_id<>>(message.headers());
+
+        ASSERT_TRUE(trace);
+        ASSERT_EQ(hpack::header::unpack<std::uint64_t>(trace->value()), id);
+        ASSERT_EQ(hpack::header::find_first(message.headers(), "x-request-source")->value(), "le-frontend");
+    }
+}
+
+TEST(encoder_t, uncompressed_headers_by_default) {
+    typedef primitive<boost::mpl::list<std::string>::type>::value event_type;
+
+    encoder_t encoder;
+
+    for(int i = 0; i < 2; ++i) {
+        encoder.encode(encoded<event_type>(1, std::string("le message")));
+    }
+
+    const auto stats = encoder.drain();
+
+    ASSERT_EQ(stats.packed, stats.plain);
+}
@@ -38,7 +38,8 @@ TEST(display, graph) {
     ASSERT_EQ(to_string(sample),
               "{0: [method1, {}, {}], "
               "1: [method2, {0: [inner_method1, {}]}, {0: [inner_method1, {}]}], "
-              "65532: [goaway, {}, {0: [value, {}], 1: [error, {}]}], "
+              "65531: [window_update, {}, {0: [value, {}], 1: [error, {}]}], "
+              "65532: [goaway, {}, {}], "
               "65533: [ping, {}, {0: [value, {}], 1: [error, {}]}], "
               "65534: [settings, {}, {0: [value, {}], 1: [error, {}]}], "
               "65535: [revoke, {}, {0: [value, {}], 1: [error, {}]}]}");
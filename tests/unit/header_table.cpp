@@ -270,3 +270,32 @@ TEST(header_table_t, complex_store_load) {
     }
 }
 
+
+TEST(header_table_t, find_after_eviction) {
+    header_table_t table;
+
+    std::vector<header_t> pushed;
+
+    for(size_t i = 0; i < 1000; i++) {
+        pushed.emplace_back("name" + std::to_string(i % 7), "value" + std::to_string(i));
+        table.push(pushed.back());
+
+        // Every live header is found at its current position, evicted ones are not found at all.
+        for(size_t j = 0; j < pushed.size(); j++) {
+            const size_t age = pushed.size() - 1 - j;
+            const size_t idx = table.find_by_full_match(pushed[j]);
+
+            if(age < table.size() - header_static_table_t::get_size()) {
+                ASSERT_EQ(idx, header_static_table_t::get_size() + age);
+                ASSERT_EQ(table[idx], pushed[j]);
+            } else {
+                ASSERT_EQ(idx, 0);
+            }
+        }
+
+        // Lookups by name always return the newest header with such name.
+        ASSERT_EQ(table.find_by_name(pushed.back()), header_static_table_t::get_size());
+    }
+
+    ASSERT_THROW(table[table.size()], std::out_of_range);
+}
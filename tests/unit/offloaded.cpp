@@ -0,0 +1,317 @@
+#include <gtest/gtest.h>
+
+#include <cocaine/api/executor.hpp>
+#include <cocaine/errors.hpp>
+#include <cocaine/rpc/asio/decoder.hpp>
+#include <cocaine/rpc/asio/transport.hpp>
+#include <cocaine/rpc/dispatch.hpp>
+#include <cocaine/rpc/session.hpp>
+#include <cocaine/rpc/upstream.hpp>
+#include <cocaine/trace/trace.hpp>
+
+#include <asio/local/connect_pair.hpp>
+#include <asio/local/stream_protocol.hpp>
+#include <asio/write.hpp>
+
+#include <blackhole/handler.hpp>
+#include <blackhole/root.hpp>
+#include <blackhole/wrapper.hpp>
+
+#include <metrics/registry.hpp>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "test_idl.hpp"
+
+namespace cocaine {
+namespace {
+
+typedef asio::local::stream_protocol protocol_type;
+
+// Queues the work until it's run explicitly, or rejects it like an overloaded worker pool.
+class manual_executor_t:
+    public api::executor_t
+{
+public:
+    std::deque<work_t> queue;
+    bool overloaded;
+
+    manual_executor_t():
+        overloaded(false)
+    { }
+
+    auto
+    spawn(work_t work) -> void override {
+        if(overloaded) {
+            throw std::system_error(error::workers_overloaded);
+        }
+
+        queue.push_back(std::move(work));
+    }
+
+    void
+    run() {
+        while(!queue.empty()) {
+            const auto work = std::move(queue.front());
+            queue.pop_front();
+            work();
+        }
+    }
+};
+
+// Session of a test service, which is set up by every test, along with the raw socket of its peer.
+class offloaded_test:
+    public ::testing::Test
+{
+protected:
+    asio::io_service loop;
+    metrics::registry_t registry;
+    blackhole::root_logger_t root;
+
+    protocol_type::socket peer;
+    io::encoder_t encoder;
+
+    manual_executor_t executor;
+
+    const std::shared_ptr<dispatch<io::test_tag>> service;
+    std::shared_ptr<session<protocol_type>> server;
+
+    // Raw frames the messages are decoded from.
+    std::deque<std::vector<char>> frames;
+
+    offloaded_test():
+        root(std::vector<std::unique_ptr<blackhole::handler_t>>()),
+        peer(loop),
+        service(std::make_shared<dispatch<io::test_tag>>("test"))
+    { }
+
+   ~offloaded_test() {
+        if(server && !server->is_detached()) {
+            server->detach(std::error_code());
+        }
+
+        loop.poll();
+    }
+
+    void
+    start() {
+        auto socket = std::make_unique<protocol_type::socket>(loop);
+
+        asio::local::connect_pair(*socket, peer);
+
+        server = std::make_shared<session<protocol_type>>(
+            std::make_unique<blackhole::wrapper_t>(root, blackhole::attributes_t()),
+            registry,
+            std::make_unique<io::transport<protocol_type>>(std::move(socket)),
+            service
+        );
+
+        server->pull();
+    }
+
+    auto
+    frame(io::encoder_t::message_type&& message) -> const std::vector<char>& {
+        std::deque<asio::const_buffer> buffers;
+
+        const auto encoded = encoder.encode(std::move(message));
+        encoded.gather(buffers);
+
+        frames.emplace_back();
+
+        for(auto it = buffers.begin(); it != buffers.end(); ++it) {
+            const auto data = asio::buffer_cast<const char*>(*it);
+            frames.back().insert(frames.back().end(), data, data + asio::buffer_size(*it));
+        }
+
+        return frames.back();
+    }
+
+    void
+    send(io::encoder_t::message_type&& message) {
+        asio::write(peer, asio::buffer(frame(std::move(message))));
+    }
+
+    // Reads the next message sent by the server, which must fit into a single read.
+    void
+    receive(io::decoder_t& decoder, io::decoder_t::message_type& message) {
+        while(!peer.available() && loop.run_one()) { }
+
+        frames.emplace_back(peer.available());
+        peer.read_some(asio::buffer(frames.back()));
+
+        std::error_code ec;
+
+        ASSERT_EQ(frames.back().size(), decoder.decode(frames.back().data(), frames.back().size(), message, ec));
+        ASSERT_FALSE(ec);
+    }
+
+    template<class Predicate>
+    void
+    run_until(Predicate predicate) {
+        while(!predicate() && loop.run_one()) { }
+    }
+};
+
+TEST_F(offloaded_test, runs_slots_offloaded_by_dispatch_on_executor) {
+    service->offload(executor);
+
+    bool called = false;
+
+    service->on<io::test::method3>([&](const std::string& name) -> std::string {
+        called = true;
+        return "hello, " + name;
+    });
+
+    start();
+    send(io::encoded<io::test::method3>(1, std::string("world")));
+
+    run_until([&] { return !executor.queue.empty(); });
+
+    // The I/O thread only hands the invocation over.
+    ASSERT_EQ(1, executor.queue.size());
+    EXPECT_FALSE(called);
+
+    executor.run();
+
+    EXPECT_TRUE(called);
+
+    io::decoder_t decoder;
+    io::decoder_t::message_type message;
+
+    receive(decoder, message);
+
+    EXPECT_EQ(1, message.span());
+    EXPECT_EQ(0, message.type());
+    EXPECT_EQ("hello, world", message.args().via.array.ptr[0].as<std::string>());
+}
+
+TEST_F(offloaded_test, runs_slots_offloaded_by_builder_on_executor) {
+    service->on<io::test::method3>().offload(executor).execute(
+        [](const hpack::headers_t&, const std::string& name) -> std::string
+    {
+        return "hello, " + name;
+    });
+
+    // Slots registered without the builder are still run on the I/O thread.
+    bool called = false;
+
+    service->on<io::test::method1>([&] {
+        called = true;
+    });
+
+    start();
+    send(io::encoded<io::test::method1>(1));
+    send(io::encoded<io::test::method3>(3, std::string("world")));
+
+    run_until([&] { return !executor.queue.empty(); });
+
+    EXPECT_TRUE(called);
+    ASSERT_EQ(1, executor.queue.size());
+
+    executor.run();
+
+    io::decoder_t decoder;
+    io::decoder_t::message_type message;
+
+    receive(decoder, message);
+
+    EXPECT_EQ(3, message.span());
+    EXPECT_EQ(0, message.type());
+    EXPECT_EQ("hello, world", message.args().via.array.ptr[0].as<std::string>());
+}
+
+TEST_F(offloaded_test, replies_with_error_once_executor_rejects) {
+    service->offload(executor);
+
+    bool called = false;
+
+    service->on<io::test::method3>([&](const std::string& name) -> std::string {
+        called = true;
+        return name;
+    });
+
+    executor.overloaded = true;
+
+    start();
+    send(io::encoded<io::test::method3>(1, std::string("world")));
+
+    io::decoder_t decoder;
+    io::decoder_t::message_type message;
+
+    receive(decoder, message);
+
+    EXPECT_EQ(1, message.span());
+    EXPECT_EQ(1, message.type());
+
+    std::error_code ec;
+    io::type_traits<std::error_code>::unpack(message.args().via.array.ptr[0], ec);
+
+    EXPECT_EQ(error::workers_overloaded, ec);
+    EXPECT_FALSE(called);
+    EXPECT_FALSE(server->is_detached());
+}
+
+TEST_F(offloaded_test, rethrows_rejections_of_mute_slots) {
+    service->offload(executor);
+    service->on<io::test::method1>([] { });
+
+    executor.overloaded = true;
+
+    const auto& data = frame(io::encoded<io::test::method1>(1));
+
+    io::decoder_t decoder;
+    io::decoder_t::message_type message;
+    std::error_code ec;
+
+    ASSERT_EQ(data.size(), decoder.decode(data.data(), data.size(), message, ec));
+
+    // Mute slots have nowhere to reply to, so the error is left for the session to handle, just
+    // like any error thrown by the slot itself.
+    try {
+        service->process(message, nullptr);
+        FAIL();
+    } catch(const std::system_error& e) {
+        EXPECT_EQ(error::workers_overloaded, e.code());
+    }
+
+    EXPECT_TRUE(executor.queue.empty());
+}
+
+TEST_F(offloaded_test, runs_offloaded_slots_in_trace_of_invocation) {
+    service->offload(executor);
+
+    trace_t traced;
+
+    service->on<io::test::method1>([&] {
+        traced = trace_t::current();
+    });
+
+    const auto& data = frame(io::encoded<io::test::method1>(1));
+
+    io::decoder_t decoder;
+    io::decoder_t::message_type message;
+    std::error_code ec;
+
+    ASSERT_EQ(data.size(), decoder.decode(data.data(), data.size(), message, ec));
+
+    {
+        trace_t::restore_scope_t scope(trace_t(1, 2, 3, "method1"));
+        service->process(message, nullptr);
+    }
+
+    ASSERT_TRUE(trace_t::current().empty());
+    ASSERT_EQ(1, executor.queue.size());
+
+    executor.run();
+
+    EXPECT_EQ(1, traced.get_trace_id());
+    EXPECT_EQ(2, traced.get_id());
+
+    // The executor's thread is left in its own trace afterwards.
+    EXPECT_TRUE(trace_t::current().empty());
+}
+
+} // namespace
+} // namespace cocaine
@@ -24,6 +24,7 @@ static_assert(
             io::storage::write,
             io::storage::remove,
             io::storage::find,
+            io::control::window_update,
             io::control::goaway,
             io::control::ping,
             io::control::settings,
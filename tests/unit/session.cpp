@@ -0,0 +1,355 @@
+#include <gtest/gtest.h>
+
+#include <cocaine/errors.hpp>
+#include <cocaine/idl/control.hpp>
+#include <cocaine/idl/primitive.hpp>
+#include <cocaine/idl/streaming.hpp>
+#include <cocaine/rpc/asio/decoder.hpp>
+#include <cocaine/rpc/asio/transport.hpp>
+#include <cocaine/rpc/dispatch.hpp>
+#include <cocaine/rpc/session.hpp>
+#include <cocaine/rpc/upstream.hpp>
+
+#include <asio/local/connect_pair.hpp>
+#include <asio/local/stream_protocol.hpp>
+#include <asio/write.hpp>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <blackhole/handler.hpp>
+#include <blackhole/root.hpp>
+#include <blackhole/wrapper.hpp>
+
+#include <metrics/registry.hpp>
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "test_idl.hpp"
+
+namespace cocaine {
+namespace {
+
+typedef asio::local::stream_protocol protocol_type;
+typedef io::primitive<boost::mpl::list<std::string>::type>::value event_type;
+
+// Session of a test service along with the raw socket of its peer.
+class session_test:
+    public ::testing::Test
+{
+protected:
+    asio::io_service loop;
+    metrics::registry_t registry;
+    blackhole::root_logger_t root;
+
+    protocol_type::socket peer;
+    io::encoder_t encoder;
+
+    std::shared_ptr<session<protocol_type>> server;
+
+    session_test():
+        root(std::vector<std::unique_ptr<blackhole::handler_t>>()),
+        peer(loop)
+    {
+        auto socket = std::make_unique<protocol_type::socket>(loop);
+
+        asio::local::connect_pair(*socket, peer);
+
+        server = std::make_shared<session<protocol_type>>(
+            std::make_unique<blackhole::wrapper_t>(root, blackhole::attributes_t()),
+            registry,
+            std::make_unique<io::transport<protocol_type>>(std::move(socket)),
+            std::make_shared<dispatch<io::test_tag>>("test")
+        );
+
+        server->pull();
+    }
+
+   ~session_test() {
+        if(!server->is_detached()) {
+            server->detach(std::error_code());
+        }
+
+        loop.poll();
+    }
+
+    void
+    send(io::encoder_t::message_type&& message) {
+        std::deque<asio::const_buffer> buffers;
+
+        const auto encoded = encoder.encode(std::move(message));
+        encoded.gather(buffers);
+
+        asio::write(peer, buffers);
+    }
+
+    template<class Predicate>
+    void
+    run_until(Predicate predicate) {
+        while(!predicate() && loop.run_one()) { }
+    }
+
+    // Whether the server refuses to open new channels.
+    bool
+    refuses_channels() {
+        try {
+            server->fork(nullptr);
+        } catch(const std::system_error& e) {
+            return e.code() == error::session_draining;
+        }
+
+        return false;
+    }
+};
+
+TEST_F(session_test, replenishes_windows_of_upstreams_without_channels) {
+    typedef std::map<std::string, std::uint64_t> settings_type;
+
+    send(io::encoded<io::control::settings>(1, settings_type{{"initial_window_size", 1024}}));
+
+    run_until([&] { return server->initial_window() == 1024; });
+
+    // Upstreams of channels without dispatches, like the ones of streamed replies with void
+    // dispatches, are not kept in the channel table at all.
+    const auto upstream = server->fork(nullptr);
+    const std::string chunk(600, 'x');
+
+    ASSERT_FALSE(upstream->send_credited<event_type>({}, chunk));
+    ASSERT_EQ(error::window_exhausted, upstream->send_credited<event_type>({}, chunk));
+
+    bool replenished = false;
+
+    ASSERT_TRUE(upstream->wait_window([&] { replenished = true; }));
+
+    send(io::encoded<io::control::window_update>(2, upstream->channel_id(), 1024));
+
+    run_until([&] { return replenished; });
+
+    ASSERT_TRUE(replenished);
+    EXPECT_FALSE(upstream->send_credited<event_type>({}, chunk));
+}
+
+TEST_F(session_test, stops_opening_channels_once_peer_drains) {
+    ASSERT_FALSE(refuses_channels());
+
+    // Control messages on the channel zero are handled by the session itself.
+    send(io::encoded<io::control::goaway>(0, std::error_code()));
+
+    run_until([&] { return refuses_channels(); });
+
+    EXPECT_TRUE(refuses_channels());
+    EXPECT_FALSE(server->is_detached());
+}
+
+TEST_F(session_test, answers_pings_on_channel_zero) {
+    send(io::encoded<io::control::ping>(0));
+
+    run_until([&] { return peer.available() > 0; });
+
+    std::vector<char> frame(peer.available());
+    peer.read_some(asio::buffer(frame));
+
+    io::decoder_t decoder;
+    io::decoder_t::message_type message;
+    std::error_code ec;
+
+    ASSERT_EQ(frame.size(), decoder.decode(frame.data(), frame.size(), message, ec));
+    ASSERT_FALSE(ec);
+
+    // Pings are answered with a value on the same channel, so that they're never mistaken for
+    // anything else.
+    EXPECT_EQ(0, message.span());
+    EXPECT_EQ(0, message.type());
+}
+
+TEST_F(session_test, applies_acknowledged_settings) {
+    typedef std::map<std::string, std::uint64_t> settings_type;
+    typedef io::primitive<boost::mpl::list<settings_type>::type>::value reply_type;
+
+    server->announce();
+
+    run_until([&] { return peer.available() > 0; });
+
+    std::vector<char> frame(peer.available());
+    peer.read_some(asio::buffer(frame));
+
+    io::decoder_t decoder;
+    io::decoder_t::message_type message;
+    std::error_code ec;
+
+    ASSERT_EQ(frame.size(), decoder.decode(frame.data(), frame.size(), message, ec));
+    ASSERT_FALSE(ec);
+
+    EXPECT_EQ(0, message.span());
+    EXPECT_EQ(static_cast<std::uint64_t>(io::event_traits<io::control::settings>::id), message.type());
+
+    ASSERT_EQ(0, server->initial_window());
+
+    // The peer's settings arrive with the acknowledgement, which isn't mistaken for a pong.
+    send(io::encoded<reply_type>(0, settings_type{{"initial_window_size", 1024}}));
+
+    run_until([&] { return server->initial_window() == 1024; });
+
+    const auto upstream = server->fork(nullptr);
+
+    EXPECT_TRUE(upstream->flow_controlled());
+    EXPECT_EQ(error::window_exhausted, upstream->send_credited<event_type>({}, std::string(2048, 'x')));
+    EXPECT_FALSE(server->is_detached());
+}
+
+TEST_F(session_test, streams_more_than_one_window_between_sessions) {
+    typedef boost::mpl::list<std::string>::type sequence_type;
+    typedef io::streaming<sequence_type>::chunk chunk_type;
+
+    const std::uint64_t window = 4096;
+
+    // The peer's end of the connection is handled by another session, which consumes the stream and
+    // replenishes the window granted to the server as it goes.
+    const auto client = std::make_shared<session<protocol_type>>(
+        std::make_unique<blackhole::wrapper_t>(root, blackhole::attributes_t()),
+        registry,
+        std::make_unique<io::transport<protocol_type>>(std::make_unique<protocol_type::socket>(std::move(peer))),
+        nullptr
+    );
+
+    client->grant(window);
+    client->pull();
+    client->announce();
+
+    run_until([&] { return server->initial_window() == window; });
+
+    size_t received = 0;
+
+    const auto sink = std::make_shared<dispatch<io::streaming_tag<sequence_type>>>("sink");
+
+    sink->on<chunk_type>([&](const std::string& chunk) {
+        received += chunk.size();
+    });
+
+    client->fork(sink);
+
+    const auto upstream = server->fork(nullptr);
+
+    ASSERT_EQ(upstream->channel_id(), 1);
+    ASSERT_TRUE(upstream->flow_controlled());
+
+    const std::string chunk(512, 'x');
+    const size_t total = window * 4;
+
+    size_t sent = 0;
+    size_t stalls = 0;
+
+    while(sent < total) {
+        if(!upstream->send_credited<chunk_type>({}, chunk)) {
+            sent += chunk.size();
+            continue;
+        }
+
+        bool replenished = false;
+
+        ASSERT_TRUE(upstream->wait_window([&] { replenished = true; }));
+
+        run_until([&] { return replenished; });
+
+        ASSERT_TRUE(replenished);
+        stalls++;
+    }
+
+    run_until([&] { return received == total; });
+
+    EXPECT_EQ(total, received);
+    EXPECT_LE(3, stalls);
+
+    client->detach(std::error_code());
+}
+
+TEST_F(session_test, revokes_channels_opened_while_draining) {
+    // The active channel keeps the draining session attached.
+    server->fork(std::make_shared<dispatch<io::test_transition_tag>>("active"));
+    server->drain(std::error_code(), boost::posix_time::seconds(10));
+
+    send(io::encoded<io::test::method1>(5));
+    send(io::encoded<io::test::method1>(5));
+
+    // Replies are sent in order, so the pong marks the end of the replies to the messages above.
+    send(io::encoded<io::control::ping>(0));
+
+    std::vector<char> data;
+    size_t offset = 0;
+
+    io::decoder_t decoder;
+
+    std::vector<std::uint64_t> revoked;
+    bool ponged = false;
+
+    while(!ponged) {
+        run_until([&] { return peer.available() > 0; });
+
+        std::vector<char> chunk(peer.available());
+        peer.read_some(asio::buffer(chunk));
+        data.insert(data.end(), chunk.begin(), chunk.end());
+
+        while(offset < data.size()) {
+            io::decoder_t::message_type message;
+            std::error_code ec;
+
+            const size_t size = decoder.decode(data.data() + offset, data.size() - offset, message, ec);
+
+            if(ec == error::insufficient_bytes) {
+                break;
+            }
+
+            ASSERT_FALSE(ec);
+            offset += size;
+
+            if(message.type() == static_cast<std::uint64_t>(io::event_traits<io::control::revoke>::id)) {
+                revoked.push_back(message.args().via.array.ptr[0].as<std::uint64_t>());
+            } else if(message.span() == 0 && message.type() == 0) {
+                ponged = true;
+            }
+        }
+    }
+
+    // The channel is revoked only once, no matter how many messages it has got.
+    EXPECT_EQ(std::vector<std::uint64_t>(1, 5), revoked);
+    EXPECT_FALSE(server->is_detached());
+}
+
+TEST_F(session_test, counts_active_channels) {
+    // Enough channels to regrow the channel table a few times.
+    for(size_t i = 0; i < 100; ++i) {
+        server->fork(std::make_shared<dispatch<io::test_transition_tag>>("active"));
+    }
+
+    // Forked channels are inserted on the reactor.
+    run_until([&] { return server->active_channels_count() == 100; });
+
+    ASSERT_EQ(100, server->active_channels_count());
+
+    const auto channels = server->active_channels();
+
+    ASSERT_EQ(100, channels.size());
+    EXPECT_EQ(1, channels.begin()->first);
+    EXPECT_EQ(100, channels.rbegin()->first);
+    EXPECT_EQ("active", channels.begin()->second);
+}
+
+TEST_F(session_test, detaches_drained_session_without_waiting_for_timeout) {
+    const auto timeout = boost::posix_time::seconds(10);
+    const auto started = std::chrono::steady_clock::now();
+
+    server->drain(std::error_code(), timeout);
+
+    // There are no active channels, so the session detaches as soon as the goaway is sent, and
+    // nothing is left to run in the loop after that.
+    loop.run();
+
+    EXPECT_TRUE(server->is_detached());
+    EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(timeout.total_seconds()));
+}
+
+} // namespace
+} // namespace cocaine
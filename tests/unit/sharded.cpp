@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+
+#include <cocaine/utility/sharded.hpp>
+
+#include <thread>
+#include <vector>
+
+namespace cocaine {
+namespace utility {
+namespace {
+
+TEST(sharded_counter, empty) {
+    sharded_counter counter;
+
+    EXPECT_EQ(0, counter.load());
+}
+
+TEST(sharded_counter, merges_shards) {
+    sharded_counter counter;
+
+    std::vector<std::thread> threads;
+
+    for(int i = 0; i < 8; ++i) {
+        threads.emplace_back([&] {
+            for(int j = 0; j < 10000; ++j) {
+                counter.add(1);
+            }
+
+            counter.add(-1);
+        });
+    }
+
+    for(auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(8 * 10000 - 8, counter.load());
+}
+
+} // namespace
+} // namespace utility
+} // namespace cocaine
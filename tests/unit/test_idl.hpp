@@ -1,5 +1,6 @@
 #include <cocaine/common.hpp>
 #include <cocaine/forwards.hpp>
+#include <cocaine/idl/primitive.hpp>
 #include <cocaine/rpc/protocol.hpp>
 
 namespace cocaine {
@@ -23,6 +24,13 @@ struct test {
         typedef test_transition_tag dispatch_type;
         typedef test_transition_tag upstream_type;
     };
+
+    struct method3 {
+        typedef test_tag tag;
+        static const char* alias() { return "method3"; }
+        typedef boost::mpl::list<std::string>::type argument_type;
+        typedef option_of<std::string>::tag upstream_type;
+    };
 };
 
 struct inner_test {
@@ -37,7 +45,7 @@ struct inner_test {
 template<>
 struct protocol<test_tag> {
     typedef boost::mpl::int_<1>::type version;
-    typedef boost::mpl::list<test::method1, test::method2>::type messages;
+    typedef boost::mpl::list<test::method1, test::method2, test::method3>::type messages;
     typedef test scope;
 };
 
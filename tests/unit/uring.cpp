@@ -0,0 +1,266 @@
+#include <gtest/gtest.h>
+
+#include <cocaine/rpc/asio/decoder.hpp>
+#include <cocaine/rpc/asio/readable_stream.hpp>
+#include <cocaine/rpc/asio/uring.hpp>
+
+#include <asio/error.hpp>
+#include <asio/local/connect_pair.hpp>
+#include <asio/local/stream_protocol.hpp>
+#include <asio/write.hpp>
+
+#include <msgpack.hpp>
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace cocaine {
+namespace io {
+namespace {
+
+struct socket_pair_t {
+    int fds[2];
+
+    socket_pair_t() {
+        ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    }
+
+    ~socket_pair_t() {
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+};
+
+TEST(uring, stays_disabled_unless_configured) {
+    asio::io_service loop;
+
+    EXPECT_FALSE(asio::use_service<uring_service_t>(loop).enabled());
+    EXPECT_FALSE(asio::use_service<uring_service_t>(loop).configure(false));
+}
+
+TEST(uring, receives_everything_sent) {
+    if(!uring_service_t::supported()) {
+        return;
+    }
+
+    asio::io_service loop;
+    auto& uring = asio::use_service<uring_service_t>(loop);
+
+    ASSERT_TRUE(uring.configure(true));
+
+    socket_pair_t pair;
+
+    // Larger than all the registered buffers together, so that the receive has to be resumed.
+    const std::string payload(2 * uring_service_t::kBufferCount * uring_service_t::kBufferSize, 'x');
+
+    std::string received;
+    std::error_code result;
+
+    uring.receive(pair.fds[0], [&](const std::error_code& ec, const char* data, size_t size) {
+        if(ec) {
+            result = ec;
+        } else {
+            received.append(data, size);
+        }
+    });
+
+    size_t sent = 0;
+
+    iovec buffer;
+    msghdr header;
+
+    std::function<void()> send = [&] {
+        buffer.iov_base = const_cast<char*>(payload.data() + sent);
+        buffer.iov_len  = payload.size() - sent;
+
+        std::memset(&header, 0, sizeof(header));
+
+        header.msg_iov    = &buffer;
+        header.msg_iovlen = 1;
+
+        uring.send(pair.fds[1], &header, [&](const std::error_code& ec, size_t size) {
+            ASSERT_FALSE(ec);
+
+            if((sent += size) < payload.size()) {
+                send();
+            } else {
+                ::shutdown(pair.fds[1], SHUT_WR);
+            }
+        });
+    };
+
+    send();
+
+    while(!result && loop.run_one()) { }
+
+    EXPECT_EQ(asio::error::eof, result);
+    EXPECT_EQ(payload, received);
+}
+
+TEST(uring, submits_more_than_submission_queue_holds) {
+    if(!uring_service_t::supported()) {
+        return;
+    }
+
+    asio::io_service loop;
+    auto& uring = asio::use_service<uring_service_t>(loop);
+
+    ASSERT_TRUE(uring.configure(true));
+
+    socket_pair_t pair;
+
+    // Way more sends than the submission queue has entries, all of them prepared before the loop
+    // gets a chance to submit any.
+    const size_t count = 2048;
+    const char byte = 'x';
+
+    iovec buffer;
+
+    buffer.iov_base = const_cast<char*>(&byte);
+    buffer.iov_len  = 1;
+
+    std::vector<msghdr> headers(count);
+
+    size_t completed = 0;
+    size_t sent = 0;
+
+    for(auto it = headers.begin(); it != headers.end(); ++it) {
+        std::memset(&*it, 0, sizeof(*it));
+
+        it->msg_iov    = &buffer;
+        it->msg_iovlen = 1;
+
+        uring.send(pair.fds[1], &*it, [&](const std::error_code& ec, size_t size) {
+            EXPECT_FALSE(ec);
+
+            completed++;
+            sent += size;
+        });
+    }
+
+    while(completed < count && loop.run_one()) { }
+
+    ASSERT_EQ(count, completed);
+    EXPECT_EQ(count, sent);
+
+    std::vector<char> received(count + 1);
+
+    const ssize_t size = ::recv(pair.fds[0], received.data(), received.size(), MSG_DONTWAIT);
+
+    EXPECT_EQ(static_cast<ssize_t>(count), size);
+}
+
+TEST(uring, cancels_receives) {
+    if(!uring_service_t::supported()) {
+        return;
+    }
+
+    asio::io_service loop;
+    auto& uring = asio::use_service<uring_service_t>(loop);
+
+    ASSERT_TRUE(uring.configure(true));
+
+    socket_pair_t pair;
+    std::error_code result;
+
+    const auto receive = uring.receive(pair.fds[0], [&](const std::error_code& ec, const char*, size_t) {
+        result = ec;
+    });
+
+    loop.poll();
+    uring.cancel(receive);
+
+    while(!result && loop.run_one()) { }
+
+    EXPECT_EQ(asio::error::operation_aborted, result);
+}
+
+TEST(uring, keeps_decoded_messages_intact_until_next_read) {
+    if(!uring_service_t::supported()) {
+        return;
+    }
+
+    asio::io_service loop;
+
+    ASSERT_TRUE(asio::use_service<uring_service_t>(loop).configure(true));
+
+    typedef asio::local::stream_protocol protocol_type;
+
+    auto socket = std::make_shared<protocol_type::socket>(loop);
+    protocol_type::socket peer(loop);
+
+    asio::local::connect_pair(*socket, peer);
+
+    auto stream = std::make_shared<readable_stream<protocol_type, decoder_t>>(socket);
+
+    // The second frame doesn't fit into what's left of the ring after the first one.
+    const std::string first(48 * 1024, 'a'), second(256 * 1024, 'b');
+
+    msgpack::sbuffer frames;
+    msgpack::packer<msgpack::sbuffer> packer(frames);
+
+    for(const auto& payload: {first, second}) {
+        packer.pack_array(4);
+        packer.pack(1);
+        packer.pack(0);
+        packer.pack_array(1);
+        packer.pack(payload);
+        packer.pack_array(0);
+    }
+
+    // Both frames are pipelined, but the peer might block once the socket buffer is full.
+    std::thread writer([&] {
+        asio::write(peer, asio::buffer(frames.data(), frames.size()));
+    });
+
+    decoder_t::message_type message;
+    std::error_code result;
+    bool done = false;
+
+    stream->read(message, [&](const std::error_code& ec) {
+        result = ec;
+        done = true;
+    });
+
+    while(!done && loop.run_one()) { }
+
+    ASSERT_FALSE(result);
+
+    // The handler is slow, so the second frame keeps arriving while the first message is in use.
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+
+    while(std::chrono::steady_clock::now() < deadline) {
+        loop.poll();
+    }
+
+    EXPECT_EQ(first, message.args().via.array.ptr[0].as<std::string>());
+
+    loop.reset();
+    done = false;
+
+    stream->read(message, [&](const std::error_code& ec) {
+        result = ec;
+        done = true;
+    });
+
+    while(!done && loop.run_one()) { }
+
+    writer.join();
+
+    ASSERT_FALSE(result);
+    EXPECT_EQ(second, message.args().via.array.ptr[0].as<std::string>());
+
+    socket->close();
+    loop.poll();
+}
+
+} // namespace
+} // namespace io
+} // namespace cocaine
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+
+#include <cocaine/errors.hpp>
+#include <cocaine/executor/pool.hpp>
+
+#include <metrics/registry.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+
+namespace cocaine {
+namespace executor {
+namespace {
+
+TEST(worker_pool, runs_queued_work_before_destruction) {
+    metrics::registry_t registry;
+    std::atomic<int> done(0);
+
+    {
+        worker_pool_t pool(4, 1024, registry, "workers");
+
+        for(int i = 0; i < 1000; ++i) {
+            pool.spawn([&]() noexcept {
+                done++;
+            });
+        }
+    }
+
+    EXPECT_EQ(1000, done);
+}
+
+TEST(worker_pool, rejects_work_over_capacity) {
+    metrics::registry_t registry;
+    std::promise<void> barrier;
+    auto released = barrier.get_future().share();
+
+    worker_pool_t pool(1, 2, registry, "workers");
+
+    // Keep the only worker busy, so that everything else is queued.
+    std::promise<void> started;
+    pool.spawn([&]() noexcept {
+        started.set_value();
+        released.wait();
+    });
+    started.get_future().wait();
+
+    pool.spawn([]() noexcept {});
+    pool.spawn([]() noexcept {});
+
+    EXPECT_EQ(2u, pool.depth());
+
+    try {
+        pool.spawn([]() noexcept {});
+        FAIL();
+    } catch(const std::system_error& e) {
+        EXPECT_EQ(error::workers_overloaded, e.code());
+    }
+
+    barrier.set_value();
+}
+
+TEST(worker_pool, idle_workers_steal_work) {
+    metrics::registry_t registry;
+    std::promise<void> barrier;
+    auto released = barrier.get_future().share();
+
+    worker_pool_t pool(2, 1024, registry, "workers");
+
+    // Work is distributed in a round-robin manner, so one of the workers is stuck with the blocked
+    // task while the rest of its queue must be picked up by the other one.
+    std::atomic<int> done(0);
+
+    pool.spawn([&]() noexcept {
+        released.wait();
+    });
+
+    for(int i = 0; i < 99; ++i) {
+        pool.spawn([&]() noexcept {
+            done++;
+        });
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+    while(done < 99 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    EXPECT_EQ(99, done);
+
+    barrier.set_value();
+}
+
+}  // namespace
+}  // namespace executor
+}  // namespace cocaine
@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+
+#include <cocaine/idl/primitive.hpp>
+#include <cocaine/rpc/asio/encoder.hpp>
+#include <cocaine/rpc/asio/writable_stream.hpp>
+#include <cocaine/trace/trace.hpp>
+
+#include <asio/local/connect_pair.hpp>
+#include <asio/local/stream_protocol.hpp>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+namespace cocaine {
+namespace io {
+namespace {
+
+typedef asio::local::stream_protocol protocol_type;
+typedef primitive<boost::mpl::list<std::string>::type>::value event_type;
+
+TEST(writable_stream, writes_right_away_when_idle) {
+    asio::io_service loop;
+
+    auto socket = std::make_shared<protocol_type::socket>(loop);
+    protocol_type::socket peer(loop);
+
+    asio::local::connect_pair(*socket, peer);
+
+    auto stream = std::make_shared<writable_stream<protocol_type, encoder_t>>(socket);
+
+    size_t syscalls = 0;
+    size_t messages = 0;
+
+    stream->observe([&](size_t completed) {
+        syscalls++;
+        messages += completed;
+    });
+
+    bool written = false;
+
+    stream->write(encoded<event_type>(1, std::string("le message")), [&](const std::error_code& ec) {
+        EXPECT_FALSE(ec);
+        written = true;
+    });
+
+    // The message is sent before the write returns, but its handler is still called from the reactor.
+    EXPECT_EQ(1, syscalls);
+    EXPECT_EQ(1, messages);
+    EXPECT_FALSE(written);
+
+    loop.run();
+
+    EXPECT_TRUE(written);
+}
+
+TEST(writable_stream, coalesces_writes_while_one_is_pending) {
+    asio::io_service loop;
+
+    auto socket = std::make_shared<protocol_type::socket>(loop);
+    protocol_type::socket peer(loop);
+
+    asio::local::connect_pair(*socket, peer);
+
+    auto stream = std::make_shared<writable_stream<protocol_type, encoder_t>>(socket);
+
+    std::vector<size_t> syscalls;
+
+    stream->observe([&](size_t completed) {
+        syscalls.push_back(completed);
+    });
+
+    // Way more than the socket buffer takes, so that the rest of it stays queued.
+    stream->write(encoded<event_type>(0, std::string(8 * 1024 * 1024, 'x')), [&](const std::error_code& ec) {
+        EXPECT_FALSE(ec);
+    });
+
+    ASSERT_EQ(std::vector<size_t>(1, 0), syscalls);
+
+    const trace_t trace(42, 43, 44, "write");
+    std::vector<std::uint64_t> traces;
+
+    {
+        trace_t::restore_scope_t scope(trace);
+
+        for(int i = 1; i <= 3; ++i) {
+            stream->write(encoded<event_type>(i, std::string("le message")), [&](const std::error_code& ec) {
+                EXPECT_FALSE(ec);
+                traces.push_back(trace_t::current().get_trace_id());
+            });
+        }
+    }
+
+    // Nothing is written until the pending message makes progress.
+    EXPECT_EQ(1, syscalls.size());
+
+    std::thread reader([&] {
+        char buffer[65536];
+
+        while(::read(peer.native_handle(), buffer, sizeof(buffer)) > 0)
+            ;
+    });
+
+    loop.run();
+
+    socket->shutdown(protocol_type::socket::shutdown_both);
+    reader.join();
+
+    // The queued messages are completed all at once, possibly along with the tail of the pending one.
+    ASSERT_LE(2, syscalls.size());
+    EXPECT_LE(3, syscalls.back());
+
+    // Every completion is notified within the trace its message was written in.
+    EXPECT_EQ(std::vector<std::uint64_t>(3, trace.get_trace_id()), traces);
+}
+
+} // namespace
+} // namespace io
+} // namespace cocaine